@@ -0,0 +1,254 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <mncommon/util.h>
+#include <mncommon/dumpm.h>
+
+#include "bench.h"
+
+const char *bench_suite = "";
+const char *bench_tag = "";
+
+static int json_nfields;
+
+
+uint64_t
+bench_now_nsec(void)
+{
+    struct timespec ts;
+
+    (void)clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+/**
+ * User plus system CPU time of the process.
+ */
+uint64_t
+bench_cpu_nsec(void)
+{
+    struct rusage ru;
+
+    (void)getrusage(RUSAGE_SELF, &ru);
+    return (uint64_t)(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000000 +
+        (uint64_t)(ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) * 1000;
+}
+
+
+/**
+ * Resident set size of the process.
+ */
+uint64_t
+bench_rss_bytes(void)
+{
+    FILE *f;
+    unsigned long size, resident;
+    struct rusage ru;
+
+    if ((f = fopen("/proc/self/statm", "r")) != NULL) {
+        if (fscanf(f, "%lu %lu", &size, &resident) == 2) {
+            fclose(f);
+            return (uint64_t)resident * sysconf(_SC_PAGESIZE);
+        }
+        fclose(f);
+    }
+    /* peak, not current, in kilobytes */
+    (void)getrusage(RUSAGE_SELF, &ru);
+    return (uint64_t)ru.ru_maxrss * 1024;
+}
+
+
+/**
+ * Number of memory mappings of the process, -1 if unknown.
+ */
+int64_t
+bench_vma_count(void)
+{
+    FILE *f;
+    int64_t n;
+    int ch;
+
+    if ((f = fopen("/proc/self/maps", "r")) == NULL) {
+        return -1;
+    }
+    n = 0;
+    while ((ch = fgetc(f)) != EOF) {
+        if (ch == '\n') {
+            ++n;
+        }
+    }
+    fclose(f);
+    return n;
+}
+
+
+/**
+ * The limit on the number of memory mappings, SIZE_MAX if unknown.
+ */
+size_t
+bench_max_map_count(void)
+{
+    FILE *f;
+    unsigned long n;
+
+    if ((f = fopen("/proc/sys/vm/max_map_count", "r")) == NULL) {
+        return SIZE_MAX;
+    }
+    if (fscanf(f, "%lu", &n) != 1) {
+        n = SIZE_MAX;
+    }
+    fclose(f);
+    return n;
+}
+
+
+void
+bench_samples_init(bench_samples_t *s)
+{
+    s->data = NULL;
+    s->elnum = 0;
+    s->sz = 0;
+}
+
+
+void
+bench_samples_fini(bench_samples_t *s)
+{
+    free(s->data);
+    bench_samples_init(s);
+}
+
+
+void
+bench_samples_add(bench_samples_t *s, uint64_t v)
+{
+    if (s->elnum == s->sz) {
+        uint64_t *tmp;
+
+        s->sz = s->sz ? s->sz * 2 : 1024;
+        if ((tmp = realloc(s->data, s->sz * sizeof(uint64_t))) == NULL) {
+            FAIL("realloc");
+        }
+        s->data = tmp;
+    }
+    s->data[s->elnum++] = v;
+}
+
+
+static int
+u64_cmp(const void *a, const void *b)
+{
+    return MNCMP(*(const uint64_t *)a, *(const uint64_t *)b);
+}
+
+
+/**
+ * Return the pct-th percentile (0.0 .. 100.0) of the samples.
+ */
+uint64_t
+bench_samples_pct(bench_samples_t *s, double pct)
+{
+    size_t i;
+
+    if (s->elnum == 0) {
+        return 0;
+    }
+    /* cheap enough to keep it simple */
+    qsort(s->data, s->elnum, sizeof(uint64_t), u64_cmp);
+    i = (size_t)(pct / 100.0 * (double)(s->elnum - 1) + 0.5);
+    return s->data[MIN(i, s->elnum - 1)];
+}
+
+
+void
+bench_json_begin(const char *bench)
+{
+    json_nfields = 0;
+    printf("{");
+    bench_json_str("suite", bench_suite);
+    bench_json_str("bench", bench);
+    bench_json_str("tag", bench_tag);
+}
+
+
+static void
+json_key(const char *key)
+{
+    printf("%s\"%s\":", json_nfields++ ? "," : "", key);
+}
+
+
+void
+bench_json_u64(const char *key, uint64_t v)
+{
+    json_key(key);
+    printf("%llu", (unsigned long long)v);
+}
+
+
+void
+bench_json_double(const char *key, double v)
+{
+    json_key(key);
+    printf("%.2f", v);
+}
+
+
+void
+bench_json_str(const char *key, const char *v)
+{
+    json_key(key);
+    printf("\"");
+    for (; *v != '\0'; ++v) {
+        if (*v == '"' || *v == '\\') {
+            printf("\\%c", *v);
+        } else if ((unsigned char)*v >= 0x20) {
+            printf("%c", *v);
+        }
+    }
+    printf("\"");
+}
+
+
+void
+bench_json_samples(bench_samples_t *s)
+{
+    if (s == NULL || s->elnum == 0) {
+        return;
+    }
+    bench_json_u64("p50", bench_samples_pct(s, 50.0));
+    bench_json_u64("p90", bench_samples_pct(s, 90.0));
+    bench_json_u64("p99", bench_samples_pct(s, 99.0));
+    bench_json_u64("p999", bench_samples_pct(s, 99.9));
+    bench_json_u64("max", bench_samples_pct(s, 100.0));
+}
+
+
+void
+bench_json_end(void)
+{
+    printf("}\n");
+    fflush(stdout);
+}
+
+
+/**
+ * Report nops operations that took nsec nanoseconds in total.
+ */
+void
+bench_report(const char *bench,
+             uint64_t nops,
+             uint64_t nsec,
+             bench_samples_t *s)
+{
+    bench_json_begin(bench);
+    bench_json_u64("nops", nops);
+    bench_json_double("ns_per_op", nops ? (double)nsec / (double)nops : 0.0);
+    bench_json_samples(s);
+    bench_json_end();
+}
@@ -0,0 +1,52 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Benchmark support: clocks, latency samples and JSON reports.
+ *
+ * Every measurement is reported as a single line JSON object:
+ *
+ *  {"suite":"sched","bench":"switch","tag":"ev","nops":1000000,
+ *   "ns_per_op":101.3,"p50":98,"p90":110,"p99":180,"p999":420,"max":9100}
+ *
+ * Latency percentiles are in nanoseconds.  The tag is given on the
+ * command line (-t), and is meant to distinguish backends, builds and
+ * hosts in the collected results.
+ */
+
+extern const char *bench_suite;
+extern const char *bench_tag;
+
+typedef struct _bench_samples {
+    uint64_t *data;
+    size_t elnum;
+    size_t sz;
+} bench_samples_t;
+
+uint64_t bench_now_nsec(void);
+uint64_t bench_cpu_nsec(void);
+uint64_t bench_rss_bytes(void);
+int64_t bench_vma_count(void);
+size_t bench_max_map_count(void);
+
+/* a thread stack takes two mappings: the guard page and the rest */
+#define BENCH_THREAD_VMAS 2
+
+void bench_samples_init(bench_samples_t *);
+void bench_samples_fini(bench_samples_t *);
+void bench_samples_add(bench_samples_t *, uint64_t);
+uint64_t bench_samples_pct(bench_samples_t *, double);
+
+void bench_json_begin(const char *);
+void bench_json_u64(const char *, uint64_t);
+void bench_json_double(const char *, double);
+void bench_json_str(const char *, const char *);
+void bench_json_samples(bench_samples_t *);
+void bench_json_end(void);
+
+void bench_report(const char *, uint64_t, uint64_t, bench_samples_t *);
+
+#endif
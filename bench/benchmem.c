@@ -0,0 +1,270 @@
+/*
+ * Memory scaling benchmark.
+ *
+ *  benchmem [-m MAXTHREADS] [-t TAG] [sleep|read|cond ...]
+ *
+ * Spawn from 10k up to MAXTHREADS (1M by default) idle threads parked
+ * in mnthr_sleep(), in mnthr_wait_for_read() on a socketpair each, or
+ * in mnthr_cond_wait(), then wake them all up.  Report the resident
+ * memory and the number of mappings per parked thread, and the time
+ * to spawn, wake up and garbage collect them.
+ *
+ * Sizes that exceed vm.max_map_count or the open files limit are
+ * skipped.
+ */
+#include <assert.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <mncommon/dumpm.h>
+#include <mncommon/util.h>
+
+#include <mnthr.h>
+
+#include "bench.h"
+
+#define KIND_SLEEP 0
+#define KIND_READ 1
+#define KIND_COND 2
+static const char *kinds[] = {"sleep", "read", "cond"};
+
+static size_t maxthreads = 1000000;
+
+static mnthr_cond_t cond;
+static size_t nparked;
+static size_t nwoken;
+
+
+static int
+idler(UNUSED int argc, void *argv[])
+{
+    int kind;
+    int fd;
+
+    kind = (int)(intptr_t)argv[0];
+    fd = (int)(intptr_t)argv[1];
+
+    ++nparked;
+    switch (kind) {
+    case KIND_SLEEP:
+        (void)mnthr_sleep(3600000);
+        break;
+
+    case KIND_READ:
+        (void)mnthr_wait_for_read(fd);
+        break;
+
+    default:
+        (void)mnthr_cond_wait(&cond);
+        break;
+    }
+    ++nwoken;
+    return 0;
+}
+
+
+static void
+bench_kind_n(int kind, size_t n)
+{
+    mnthr_ctx_t **ctxes;
+    int *fds;
+    uint64_t rss0, rss1, t0, spawn_nsec, wakeup_nsec, gc_nsec;
+    int64_t vma0, vma1;
+    size_t i;
+
+    if ((ctxes = malloc(n * sizeof(mnthr_ctx_t *))) == NULL) {
+        FAIL("malloc");
+    }
+    fds = NULL;
+    if (kind == KIND_READ) {
+        if ((fds = malloc(2 * n * sizeof(int))) == NULL) {
+            FAIL("malloc");
+        }
+        for (i = 0; i < n; ++i) {
+            if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds + 2 * i) != 0) {
+                FAIL("socketpair");
+            }
+        }
+    }
+    mnthr_cond_init(&cond);
+
+    (void)mnthr_gc();
+    rss0 = bench_rss_bytes();
+    vma0 = bench_vma_count();
+
+    nparked = 0;
+    nwoken = 0;
+    t0 = bench_now_nsec();
+    for (i = 0; i < n; ++i) {
+        ctxes[i] = mnthr_spawn(kinds[kind],
+                               idler,
+                               2,
+                               (void *)(intptr_t)kind,
+                               (void *)(intptr_t)(fds ? fds[2 * i] : -1));
+    }
+    while (nparked < n) {
+        (void)mnthr_yield();
+    }
+    spawn_nsec = bench_now_nsec() - t0;
+
+    rss1 = bench_rss_bytes();
+    vma1 = bench_vma_count();
+
+    t0 = bench_now_nsec();
+    switch (kind) {
+    case KIND_SLEEP:
+        for (i = 0; i < n; ++i) {
+            mnthr_set_interrupt(ctxes[i]);
+        }
+        break;
+
+    case KIND_READ:
+        for (i = 0; i < n; ++i) {
+            if (write(fds[2 * i + 1], "", 1) != 1) {
+                FAIL("write");
+            }
+        }
+        break;
+
+    default:
+        mnthr_cond_signal_all(&cond);
+        break;
+    }
+    while (nwoken < n) {
+        (void)mnthr_yield();
+    }
+    /* let them exit */
+    (void)mnthr_yield();
+    wakeup_nsec = bench_now_nsec() - t0;
+
+    t0 = bench_now_nsec();
+    (void)mnthr_gc();
+    (void)mnthr_compact_sleepq(0);
+    gc_nsec = bench_now_nsec() - t0;
+
+    bench_json_begin(kinds[kind]);
+    bench_json_u64("nthreads", n);
+    bench_json_u64("ctx_sizeof", mnthr_ctx_sizeof());
+    bench_json_u64("rss_bytes", rss1);
+    bench_json_double("rss_per_thread", (double)(rss1 - rss0) / n);
+    if (vma0 >= 0) {
+        bench_json_u64("vmas", vma1);
+        bench_json_double("vmas_per_thread", (double)(vma1 - vma0) / n);
+    }
+    bench_json_double("spawn_ns_per_thread", (double)spawn_nsec / n);
+    bench_json_double("wakeup_ns_per_thread", (double)wakeup_nsec / n);
+    bench_json_double("gc_ns_per_thread", (double)gc_nsec / n);
+    bench_json_end();
+
+    mnthr_cond_fini(&cond);
+    if (fds != NULL) {
+        for (i = 0; i < 2 * n; ++i) {
+            close(fds[i]);
+        }
+        free(fds);
+    }
+    free(ctxes);
+}
+
+
+static void
+bench_kind(int kind)
+{
+    size_t n, maxmap;
+    struct rlimit rl;
+
+    maxmap = bench_max_map_count();
+    rl.rlim_cur = RLIM_INFINITY;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        (void)setrlimit(RLIMIT_NOFILE, &rl);
+    }
+
+    for (n = 10000; n <= maxthreads; n *= 10) {
+        if (BENCH_THREAD_VMAS * n + 1000 > maxmap) {
+            CTRACE("skipping %s at %zu: vm.max_map_count is %zu",
+                   kinds[kind], n, maxmap);
+            break;
+        }
+        if (kind == KIND_READ &&
+            rl.rlim_cur != RLIM_INFINITY &&
+            2 * n + 100 > rl.rlim_cur) {
+            CTRACE("skipping %s at %zu: open files limit is %lu",
+                   kinds[kind], n, (unsigned long)rl.rlim_cur);
+            break;
+        }
+        bench_kind_n(kind, n);
+    }
+}
+
+
+static int
+run(UNUSED int argc, void *argv[])
+{
+    int nnames;
+    char **names;
+    size_t i;
+    int j;
+
+    nnames = (int)(intptr_t)argv[0];
+    names = argv[1];
+    for (i = 0; i < countof(kinds); ++i) {
+        if (nnames > 0) {
+            for (j = 0; j < nnames; ++j) {
+                if (strcmp(names[j], kinds[i]) == 0) {
+                    break;
+                }
+            }
+            if (j == nnames) {
+                continue;
+            }
+        }
+        bench_kind((int)i);
+    }
+
+    mnthr_shutdown();
+    return 0;
+}
+
+
+int
+main(int argc, char *argv[])
+{
+    int ch;
+
+    bench_suite = "mem";
+    while ((ch = getopt(argc, argv, "m:t:")) != -1) {
+        switch (ch) {
+        case 'm':
+            maxthreads = strtoull(optarg, NULL, 10);
+            break;
+
+        case 't':
+            bench_tag = optarg;
+            break;
+
+        default:
+            fprintf(stderr,
+                    "usage: %s [-m MAXTHREADS] [-t TAG] "
+                    "[sleep|read|cond ...]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+
+    (void)mnthr_init();
+    (void)mnthr_spawn("run",
+                      run,
+                      2,
+                      (void *)(intptr_t)(argc - optind),
+                      argv + optind);
+    (void)mnthr_loop();
+    (void)mnthr_fini();
+
+    return 0;
+}
@@ -0,0 +1,453 @@
+/*
+ * Network macro-benchmark.
+ *
+ *  benchnet [-m echo|rr] [-c NCONNS] [-d SECONDS] [-s SIZE] [-r RSIZE]
+ *           [-e] [-b BACKEND] [-t TAG]
+ *
+ * A server process (forked off) and a load generator process, both
+ * running on mnthr, talk over loopback.  In the echo mode the server
+ * writes back whatever it reads, in the rr (request/response) mode
+ * requests and responses are length-prefixed messages of SIZE and RSIZE
+ * bytes.  -e switches both sides to the edge-triggered (_et) helpers,
+ * -b picks the poller backend of both (see mnthr_set_backend()).
+ *
+ * The load generator reports throughput and round trip latency
+ * percentiles, the server reports CPU time per request and an estimate
+ * of syscalls per request: I/O helper calls plus the poller's own
+ * wakeups, ioctls and registration changes (see mnthr_metrics_get()).
+ */
+#include <assert.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <mncommon/dumpm.h>
+#include <mncommon/util.h>
+
+#include <mnthr.h>
+
+#include "bench.h"
+
+#define MODE_ECHO 0
+#define MODE_RR 1
+static int mode = MODE_ECHO;
+static int nconns = 100;
+static unsigned duration = 5;
+static size_t reqsz = 64;
+static size_t respsz = 0;
+static bool et = false;
+
+static struct sockaddr_in server_addr;
+static int listen_fd = -1;
+
+/* server side */
+static int nclosed;
+static uint64_t nrequests;
+static uint64_t niocalls;
+
+/* client side */
+static bench_samples_t latencies;
+static uint64_t deadline;
+
+
+static ssize_t
+read_some(int fd, char *buf, size_t sz)
+{
+    ++niocalls;
+    return et ? mnthr_read_allb_et(fd, buf, sz) : mnthr_read_allb(fd, buf, sz);
+}
+
+
+/*
+ * Read exactly sz bytes.  Return 0 on success, -1 on error or EOF.
+ */
+static int
+read_full(int fd, char *buf, size_t sz)
+{
+    size_t n;
+
+    for (n = 0; n < sz;) {
+        ssize_t nread;
+
+        if ((nread = read_some(fd, buf + n, sz - n)) <= 0) {
+            return -1;
+        }
+        n += nread;
+    }
+    return 0;
+}
+
+
+static int
+write_full(int fd, const char *buf, size_t sz)
+{
+    ++niocalls;
+    return et ? mnthr_write_all_et(fd, buf, sz) : mnthr_write_all(fd, buf, sz);
+}
+
+
+static int
+set_nonblock(int fd)
+{
+    int one = 1;
+
+    (void)setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return fcntl(fd, F_SETFL, O_NONBLOCK);
+}
+
+
+/*
+ * Server
+ */
+static int
+server_conn(UNUSED int argc, void *argv[])
+{
+    int fd;
+    char *buf;
+    size_t bufsz;
+
+    fd = (int)(intptr_t)argv[0];
+    bufsz = MAX(MAX(reqsz, respsz), 4096);
+    if ((buf = malloc(bufsz)) == NULL) {
+        FAIL("malloc");
+    }
+    memset(buf, 'x', bufsz);
+
+    if (mode == MODE_ECHO) {
+        while (true) {
+            ssize_t nread;
+
+            if ((nread = read_some(fd, buf, bufsz)) <= 0) {
+                break;
+            }
+            if (write_full(fd, buf, nread) != 0) {
+                break;
+            }
+            ++nrequests;
+        }
+    } else {
+        while (true) {
+            uint32_t len;
+
+            if (read_full(fd, (char *)&len, sizeof(len)) != 0) {
+                break;
+            }
+            len = ntohl(len);
+            if (len > bufsz) {
+                CTRACE("request too large: %u", len);
+                break;
+            }
+            if (read_full(fd, buf, len) != 0) {
+                break;
+            }
+            len = htonl((uint32_t)respsz);
+            if (write_full(fd, (char *)&len, sizeof(len)) != 0 ||
+                write_full(fd, buf, respsz) != 0) {
+                break;
+            }
+            ++nrequests;
+        }
+    }
+
+    free(buf);
+    close(fd);
+    if (++nclosed == nconns) {
+        mnthr_shutdown();
+    }
+    return 0;
+}
+
+
+static int
+server_accept(UNUSED int argc, UNUSED void *argv[])
+{
+    while (!mnthr_shutting_down()) {
+        mnthr_socket_t *socks = NULL;
+        off_t nsocks = 0, i;
+
+        if (mnthr_accept_all2(listen_fd, &socks, &nsocks) != 0) {
+            free(socks);
+            continue;
+        }
+        for (i = 0; i < nsocks; ++i) {
+            if (set_nonblock(socks[i].fd) != 0) {
+                perror("fcntl");
+                close(socks[i].fd);
+                continue;
+            }
+            (void)mnthr_spawn("conn",
+                              server_conn,
+                              1,
+                              (void *)(intptr_t)socks[i].fd);
+        }
+        free(socks);
+    }
+    return 0;
+}
+
+
+static void
+server(void)
+{
+    mnthr_metrics_counters_t c;
+    uint64_t cpu0, cpu1, nsys;
+
+    (void)mnthr_init();
+    cpu0 = bench_cpu_nsec();
+    (void)mnthr_spawn("accept", server_accept, 0);
+    (void)mnthr_loop();
+    cpu1 = bench_cpu_nsec();
+    mnthr_metrics_get(&c);
+    (void)mnthr_fini();
+
+    nsys = niocalls +
+        c.poller_wakeups +
+        c.poller_ioctls +
+        c.poller_reg_add +
+        c.poller_reg_del;
+
+    bench_json_begin(mode == MODE_ECHO ? "echo_server" : "rr_server");
+    bench_json_u64("nconns", nconns);
+    bench_json_u64("size", reqsz);
+    bench_json_str("helpers", et ? "et" : "lt");
+    bench_json_u64("requests", nrequests);
+    bench_json_double("cpu_ns_per_req",
+                      nrequests ? (double)(cpu1 - cpu0) / nrequests : 0.0);
+    bench_json_double("syscalls_per_req",
+                      nrequests ? (double)nsys / nrequests : 0.0);
+    bench_json_double("wakeups_per_req",
+                      nrequests ? (double)c.poller_wakeups / nrequests : 0.0);
+    bench_json_double("events_per_wakeup",
+                      c.poller_wakeups ?
+                          (double)c.poller_events / c.poller_wakeups : 0.0);
+    bench_json_end();
+}
+
+
+/*
+ * Load generator
+ */
+static int
+client_conn(UNUSED int argc, UNUSED void *argv[])
+{
+    int fd;
+    char *req, *resp;
+    size_t respbufsz;
+
+    if ((fd = socket(AF_INET, SOCK_STREAM, 0)) == -1) {
+        FAIL("socket");
+    }
+    if (mnthr_connect(fd,
+                      (struct sockaddr *)&server_addr,
+                      sizeof(server_addr)) != 0) {
+        CTRACE("connect failed");
+        close(fd);
+        return 1;
+    }
+    (void)set_nonblock(fd);
+
+    respbufsz = mode == MODE_ECHO ? reqsz : respsz;
+    if ((req = malloc(reqsz + sizeof(uint32_t))) == NULL ||
+        (resp = malloc(respbufsz + sizeof(uint32_t))) == NULL) {
+        FAIL("malloc");
+    }
+    memset(req, 'r', reqsz + sizeof(uint32_t));
+    if (mode == MODE_RR) {
+        uint32_t len = htonl((uint32_t)reqsz);
+
+        memcpy(req, &len, sizeof(len));
+    }
+
+    while (bench_now_nsec() < deadline) {
+        uint64_t t0;
+
+        t0 = bench_now_nsec();
+        if (mode == MODE_ECHO) {
+            if (write_full(fd, req, reqsz) != 0 ||
+                read_full(fd, resp, reqsz) != 0) {
+                break;
+            }
+        } else {
+            if (write_full(fd, req, reqsz + sizeof(uint32_t)) != 0 ||
+                read_full(fd, resp, respsz + sizeof(uint32_t)) != 0) {
+                break;
+            }
+        }
+        bench_samples_add(&latencies, bench_now_nsec() - t0);
+    }
+
+    free(req);
+    free(resp);
+    close(fd);
+    return 0;
+}
+
+
+static int
+client_run(UNUSED int argc, UNUSED void *argv[])
+{
+    mnthr_ctx_t **ctxes;
+    uint64_t start, cpu0, elapsed;
+    int i;
+
+    if ((ctxes = malloc(nconns * sizeof(mnthr_ctx_t *))) == NULL) {
+        FAIL("malloc");
+    }
+
+    bench_samples_init(&latencies);
+    start = bench_now_nsec();
+    cpu0 = bench_cpu_nsec();
+    deadline = start + (uint64_t)duration * 1000000000;
+    for (i = 0; i < nconns; ++i) {
+        ctxes[i] = mnthr_spawn("client", client_conn, 0);
+    }
+    for (i = 0; i < nconns; ++i) {
+        (void)mnthr_join(ctxes[i]);
+    }
+    elapsed = bench_now_nsec() - start;
+
+    bench_json_begin(mode == MODE_ECHO ? "echo" : "rr");
+    bench_json_u64("nconns", nconns);
+    bench_json_u64("size", reqsz);
+    bench_json_str("helpers", et ? "et" : "lt");
+    bench_json_u64("requests", latencies.elnum);
+    bench_json_double("rps",
+                      (double)latencies.elnum * 1000000000.0 / elapsed);
+    bench_json_double("client_cpu_ns_per_req",
+                      latencies.elnum ?
+                          (double)(bench_cpu_nsec() - cpu0) /
+                          latencies.elnum : 0.0);
+    bench_json_samples(&latencies);
+    bench_json_end();
+
+    bench_samples_fini(&latencies);
+    free(ctxes);
+    mnthr_shutdown();
+    return 0;
+}
+
+
+int
+main(int argc, char *argv[])
+{
+    int ch;
+    socklen_t addrlen;
+    pid_t pid;
+    int status;
+
+    bench_suite = "net";
+    while ((ch = getopt(argc, argv, "b:c:d:em:r:s:t:")) != -1) {
+        switch (ch) {
+        case 'b':
+            if (mnthr_set_backend(optarg) != 0) {
+                fprintf(stderr, "unsupported backend %s\n", optarg);
+                return 1;
+            }
+            break;
+
+        case 'c':
+            nconns = strtol(optarg, NULL, 10);
+            break;
+
+        case 'd':
+            duration = strtoul(optarg, NULL, 10);
+            break;
+
+        case 'e':
+            et = true;
+            break;
+
+        case 'm':
+            if (strcmp(optarg, "echo") == 0) {
+                mode = MODE_ECHO;
+            } else if (strcmp(optarg, "rr") == 0) {
+                mode = MODE_RR;
+            } else {
+                fprintf(stderr, "unknown mode %s\n", optarg);
+                return 1;
+            }
+            break;
+
+        case 'r':
+            respsz = strtoul(optarg, NULL, 10);
+            break;
+
+        case 's':
+            reqsz = strtoul(optarg, NULL, 10);
+            break;
+
+        case 't':
+            bench_tag = optarg;
+            break;
+
+        default:
+            fprintf(stderr,
+                    "usage: %s [-m echo|rr] [-c NCONNS] [-d SECONDS] "
+                    "[-s SIZE] [-r RSIZE] [-e] [-b BACKEND] [-t TAG]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+    if (respsz == 0) {
+        respsz = reqsz;
+    }
+    if (nconns <= 0 || reqsz == 0) {
+        fprintf(stderr, "invalid parameters\n");
+        return 1;
+    }
+
+    (void)signal(SIGPIPE, SIG_IGN);
+
+    if ((listen_fd = socket(AF_INET, SOCK_STREAM, 0)) == -1) {
+        FAIL("socket");
+    }
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    server_addr.sin_port = 0;
+    if (bind(listen_fd,
+             (struct sockaddr *)&server_addr,
+             sizeof(server_addr)) != 0 ||
+        listen(listen_fd, MAX(nconns, 128)) != 0 ||
+        set_nonblock(listen_fd) != 0) {
+        FAIL("bind/listen");
+    }
+    addrlen = sizeof(server_addr);
+    if (getsockname(listen_fd,
+                    (struct sockaddr *)&server_addr,
+                    &addrlen) != 0) {
+        FAIL("getsockname");
+    }
+
+    fflush(stdout);
+    if ((pid = fork()) == -1) {
+        FAIL("fork");
+    }
+
+    if (pid == 0) {
+        server();
+        return 0;
+    }
+
+    close(listen_fd);
+    (void)mnthr_init();
+    (void)mnthr_spawn("client", client_run, 0);
+    (void)mnthr_loop();
+    (void)mnthr_fini();
+
+    if (waitpid(pid, &status, 0) == -1) {
+        perror("waitpid");
+    }
+
+    return 0;
+}
@@ -0,0 +1,582 @@
+/*
+ * Scheduler micro-benchmarks.
+ *
+ *  benchsched [-n NOPS] [-b BATCH] [-c NTHREADS] [-m MAXSLEEPQ] [-p FLAGS]
+ *             [-t TAG] [BENCH ...]
+ *
+ * BENCH is one of switch, spawn, yield, sleepq, cond, sema, rwlock,
+ * waitfor; all are run by default.  Where an operation is too short to
+ * be timed individually, a latency sample is the mean over a batch of
+ * BATCH operations.  FLAGS are MNTHR_PLACE_* flags passed to
+ * mnthr_set_placement(), to compare switch and wakeup costs with ctxes
+ * and stacks on huge pages and the local NUMA node.
+ */
+#include <assert.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <mncommon/dumpm.h>
+#include <mncommon/util.h>
+
+#include <mnthr.h>
+
+#include "bench.h"
+
+static uint64_t nops = 1000000;
+static uint64_t batch = 1000;
+static int nthreads = 100;
+static size_t maxsleepq = 1000000;
+
+
+/*
+ * switch: a thread yielding to the scheduler and back.
+ */
+static void
+bench_switch(void)
+{
+    bench_samples_t s;
+    uint64_t i, j, start;
+
+    bench_samples_init(&s);
+    start = bench_now_nsec();
+    for (i = 0; i < nops / batch; ++i) {
+        uint64_t t0;
+
+        t0 = bench_now_nsec();
+        for (j = 0; j < batch; ++j) {
+            (void)mnthr_yield();
+        }
+        bench_samples_add(&s, (bench_now_nsec() - t0) / batch);
+    }
+    bench_report("switch", nops / batch * batch, bench_now_nsec() - start, &s);
+    bench_samples_fini(&s);
+}
+
+
+/*
+ * spawn: spawn a thread that exits immediately.
+ */
+static uint64_t nexited;
+
+static int
+noop(UNUSED int argc, UNUSED void *argv[])
+{
+    ++nexited;
+    return 0;
+}
+
+
+static void
+bench_spawn(void)
+{
+    bench_samples_t s;
+    uint64_t i, j, start;
+
+    bench_samples_init(&s);
+    start = bench_now_nsec();
+    for (i = 0; i < nops / batch; ++i) {
+        uint64_t t0;
+
+        t0 = bench_now_nsec();
+        nexited = 0;
+        for (j = 0; j < batch; ++j) {
+            (void)mnthr_spawn("noop", noop, 0);
+        }
+        while (nexited < batch) {
+            (void)mnthr_yield();
+        }
+        bench_samples_add(&s, (bench_now_nsec() - t0) / batch);
+    }
+    bench_report("spawn", nops / batch * batch, bench_now_nsec() - start, &s);
+    bench_samples_fini(&s);
+    (void)mnthr_gc();
+}
+
+
+/*
+ * yield: nthreads threads yielding in turn.  A sample is a full round
+ * divided by nthreads, as seen by the first thread.
+ */
+static int
+yielder(UNUSED int argc, void *argv[])
+{
+    bench_samples_t *s;
+    uint64_t i, n, t0;
+
+    s = argv[0];
+    n = nops / nthreads;
+
+    t0 = bench_now_nsec();
+    for (i = 0; i < n; ++i) {
+        (void)mnthr_yield();
+        if (s != NULL) {
+            uint64_t t1;
+
+            t1 = bench_now_nsec();
+            bench_samples_add(s, (t1 - t0) / nthreads);
+            t0 = t1;
+        }
+    }
+    return 0;
+}
+
+
+static void
+bench_yield(void)
+{
+    bench_samples_t s;
+    mnthr_ctx_t **ctxes;
+    uint64_t start;
+    int i;
+
+    if ((ctxes = malloc(nthreads * sizeof(mnthr_ctx_t *))) == NULL) {
+        FAIL("malloc");
+    }
+    bench_samples_init(&s);
+    start = bench_now_nsec();
+    for (i = 0; i < nthreads; ++i) {
+        ctxes[i] = mnthr_spawn("yielder", yielder, 1, i == 0 ? &s : NULL);
+    }
+    for (i = 0; i < nthreads; ++i) {
+        (void)mnthr_join(ctxes[i]);
+    }
+    bench_report("yield",
+                 nops / nthreads * nthreads,
+                 bench_now_nsec() - start,
+                 &s);
+    bench_samples_fini(&s);
+    free(ctxes);
+    (void)mnthr_gc();
+}
+
+
+/*
+ * sleepq: n threads arm a long timer each (insert), then all timers are
+ * cancelled by mnthr_set_interrupt() (remove).
+ */
+static mnthr_cond_t sleepq_cond;
+static size_t nparked;
+static size_t narmed;
+static size_t ncancelled;
+static uint64_t arm_t0;
+static bench_samples_t *arm_samples;
+
+
+static int
+sleeper(UNUSED int argc, UNUSED void *argv[])
+{
+    ++nparked;
+    (void)mnthr_cond_wait(&sleepq_cond);
+
+    if (++narmed % batch == 0) {
+        uint64_t t1;
+
+        t1 = bench_now_nsec();
+        bench_samples_add(arm_samples, (t1 - arm_t0) / batch);
+        arm_t0 = t1;
+    }
+    /* spread keys over an hour or so */
+    (void)mnthr_sleep(3600000 + random() % 1000000);
+    ++ncancelled;
+    return 0;
+}
+
+
+static void
+bench_sleepq_n(size_t n)
+{
+    bench_samples_t s;
+    mnthr_ctx_t **ctxes;
+    uint64_t t0, t1;
+    size_t i;
+
+    if ((ctxes = malloc(n * sizeof(mnthr_ctx_t *))) == NULL) {
+        FAIL("malloc");
+    }
+
+    mnthr_cond_init(&sleepq_cond);
+    nparked = 0;
+    for (i = 0; i < n; ++i) {
+        ctxes[i] = mnthr_spawn("sleeper", sleeper, 0);
+    }
+    while (nparked < n) {
+        (void)mnthr_yield();
+    }
+
+    /* insert */
+    bench_samples_init(&s);
+    arm_samples = &s;
+    narmed = 0;
+    ncancelled = 0;
+    t0 = bench_now_nsec();
+    arm_t0 = t0;
+    mnthr_cond_signal_all(&sleepq_cond);
+    while (narmed < n) {
+        (void)mnthr_yield();
+    }
+    t1 = bench_now_nsec();
+    bench_json_begin("sleepq_insert");
+    bench_json_u64("size", n);
+    bench_json_u64("nops", n);
+    bench_json_double("ns_per_op", (double)(t1 - t0) / (double)n);
+    bench_json_samples(&s);
+    bench_json_end();
+    bench_samples_fini(&s);
+
+    /* cancel */
+    bench_samples_init(&s);
+    t0 = bench_now_nsec();
+    for (i = 0; i < n; i += batch) {
+        uint64_t b0;
+        size_t j;
+
+        b0 = bench_now_nsec();
+        for (j = i; j < MIN(i + batch, n); ++j) {
+            mnthr_set_interrupt(ctxes[j]);
+        }
+        bench_samples_add(&s, (bench_now_nsec() - b0) / (j - i));
+    }
+    t1 = bench_now_nsec();
+    bench_json_begin("sleepq_cancel");
+    bench_json_u64("size", n);
+    bench_json_u64("nops", n);
+    bench_json_double("ns_per_op", (double)(t1 - t0) / (double)n);
+    bench_json_samples(&s);
+    bench_json_end();
+    bench_samples_fini(&s);
+
+    while (ncancelled < n) {
+        (void)mnthr_yield();
+    }
+    mnthr_cond_fini(&sleepq_cond);
+    free(ctxes);
+    (void)mnthr_gc();
+    (void)mnthr_compact_sleepq(0);
+}
+
+
+static void
+bench_sleepq(void)
+{
+    size_t n, maxmap;
+
+    maxmap = bench_max_map_count();
+    for (n = 1000; n <= maxsleepq; n *= 10) {
+        if (BENCH_THREAD_VMAS * n + 1000 > maxmap) {
+            CTRACE("skipping sleepq size %zu: vm.max_map_count is %zu",
+                   n, maxmap);
+            break;
+        }
+        bench_sleepq_n(n);
+    }
+}
+
+
+/*
+ * cond: ping-pong between two threads over two condition variables.
+ */
+static mnthr_cond_t ping, pong;
+static int turn;
+static bool pingpong_done;
+
+
+static int
+ponger(UNUSED int argc, UNUSED void *argv[])
+{
+    while (!pingpong_done) {
+        while (turn == 0 && !pingpong_done) {
+            (void)mnthr_cond_wait(&pong);
+        }
+        turn = 0;
+        mnthr_cond_signal_one(&ping);
+    }
+    return 0;
+}
+
+
+static void
+bench_cond(void)
+{
+    bench_samples_t s;
+    mnthr_ctx_t *ctx;
+    uint64_t i, j, start;
+
+    mnthr_cond_init(&ping);
+    mnthr_cond_init(&pong);
+    turn = 0;
+    pingpong_done = false;
+    ctx = mnthr_spawn("ponger", ponger, 0);
+
+    bench_samples_init(&s);
+    start = bench_now_nsec();
+    for (i = 0; i < nops / batch; ++i) {
+        uint64_t t0;
+
+        t0 = bench_now_nsec();
+        for (j = 0; j < batch; ++j) {
+            turn = 1;
+            mnthr_cond_signal_one(&pong);
+            while (turn == 1) {
+                (void)mnthr_cond_wait(&ping);
+            }
+        }
+        bench_samples_add(&s, (bench_now_nsec() - t0) / batch);
+    }
+    bench_report("cond", nops / batch * batch, bench_now_nsec() - start, &s);
+    bench_samples_fini(&s);
+
+    pingpong_done = true;
+    mnthr_cond_signal_one(&pong);
+    (void)mnthr_join(ctx);
+    mnthr_cond_fini(&ping);
+    mnthr_cond_fini(&pong);
+}
+
+
+/*
+ * sema, rwlock: nthreads threads contending for a resource they hold
+ * across a yield.  A sample is the latency of one acquire/release.
+ */
+static mnthr_sema_t sema;
+static mnthr_rwlock_t rwlock;
+
+
+static int
+sema_user(UNUSED int argc, void *argv[])
+{
+    bench_samples_t *s;
+    uint64_t i, n;
+
+    s = argv[0];
+    n = nops / nthreads;
+
+    for (i = 0; i < n; ++i) {
+        uint64_t t0;
+
+        t0 = bench_now_nsec();
+        (void)mnthr_sema_acquire(&sema);
+        (void)mnthr_yield();
+        mnthr_sema_release(&sema);
+        bench_samples_add(s, bench_now_nsec() - t0);
+    }
+    return 0;
+}
+
+
+static int
+rwlock_user(UNUSED int argc, void *argv[])
+{
+    bench_samples_t *s;
+    uint64_t i, n;
+
+    s = argv[0];
+    n = nops / nthreads;
+
+    for (i = 0; i < n; ++i) {
+        uint64_t t0;
+
+        t0 = bench_now_nsec();
+        /* 1 writer to 9 readers */
+        if (random() % 10 == 0) {
+            (void)mnthr_rwlock_acquire_write(&rwlock);
+            (void)mnthr_yield();
+            mnthr_rwlock_release_write(&rwlock);
+        } else {
+            (void)mnthr_rwlock_acquire_read(&rwlock);
+            (void)mnthr_yield();
+            mnthr_rwlock_release_read(&rwlock);
+        }
+        bench_samples_add(s, bench_now_nsec() - t0);
+    }
+    return 0;
+}
+
+
+static void
+bench_contention(const char *name, mnthr_cofunc_t f)
+{
+    bench_samples_t s;
+    mnthr_ctx_t **ctxes;
+    uint64_t start;
+    int i;
+
+    if ((ctxes = malloc(nthreads * sizeof(mnthr_ctx_t *))) == NULL) {
+        FAIL("malloc");
+    }
+    bench_samples_init(&s);
+    start = bench_now_nsec();
+    for (i = 0; i < nthreads; ++i) {
+        ctxes[i] = mnthr_spawn(name, f, 1, &s);
+    }
+    for (i = 0; i < nthreads; ++i) {
+        (void)mnthr_join(ctxes[i]);
+    }
+    bench_json_begin(name);
+    bench_json_u64("nthreads", nthreads);
+    bench_json_u64("nops", nops / nthreads * nthreads);
+    bench_json_double("ns_per_op",
+                      (double)(bench_now_nsec() - start) /
+                      (double)(nops / nthreads * nthreads));
+    bench_json_samples(&s);
+    bench_json_end();
+    bench_samples_fini(&s);
+    free(ctxes);
+    (void)mnthr_gc();
+}
+
+
+static void
+bench_sema(void)
+{
+    mnthr_sema_init(&sema, 4);
+    bench_contention("sema", sema_user);
+    mnthr_sema_fini(&sema);
+}
+
+
+static void
+bench_rwlock(void)
+{
+    mnthr_rwlock_init(&rwlock);
+    bench_contention("rwlock", rwlock_user);
+    mnthr_rwlock_fini(&rwlock);
+}
+
+
+/*
+ * waitfor: mnthr_wait_for() a thread that completes immediately.
+ */
+static int
+noop_rc(UNUSED int argc, UNUSED void *argv[])
+{
+    return 0;
+}
+
+
+static void
+bench_waitfor(void)
+{
+    bench_samples_t s;
+    uint64_t i, j, start;
+
+    bench_samples_init(&s);
+    start = bench_now_nsec();
+    for (i = 0; i < nops / batch; ++i) {
+        uint64_t t0;
+
+        t0 = bench_now_nsec();
+        for (j = 0; j < batch; ++j) {
+            (void)mnthr_wait_for(1000, "noop", noop_rc, 0);
+        }
+        bench_samples_add(&s, (bench_now_nsec() - t0) / batch);
+    }
+    bench_report("waitfor", nops / batch * batch, bench_now_nsec() - start, &s);
+    bench_samples_fini(&s);
+    (void)mnthr_gc();
+}
+
+
+static struct {
+    const char *name;
+    void (*fn)(void);
+} benches[] = {
+    {"switch", bench_switch},
+    {"spawn", bench_spawn},
+    {"yield", bench_yield},
+    {"sleepq", bench_sleepq},
+    {"cond", bench_cond},
+    {"sema", bench_sema},
+    {"rwlock", bench_rwlock},
+    {"waitfor", bench_waitfor},
+};
+
+
+static int
+run(UNUSED int argc, void *argv[])
+{
+    int nnames;
+    char **names;
+    size_t i;
+    int j;
+
+    nnames = (int)(intptr_t)argv[0];
+    names = argv[1];
+    for (i = 0; i < countof(benches); ++i) {
+        if (nnames > 0) {
+            for (j = 0; j < nnames; ++j) {
+                if (strcmp(names[j], benches[i].name) == 0) {
+                    break;
+                }
+            }
+            if (j == nnames) {
+                continue;
+            }
+        }
+        benches[i].fn();
+    }
+
+    mnthr_shutdown();
+    return 0;
+}
+
+
+int
+main(int argc, char *argv[])
+{
+    int ch;
+
+    bench_suite = "sched";
+    while ((ch = getopt(argc, argv, "b:c:m:n:p:t:")) != -1) {
+        switch (ch) {
+        case 'b':
+            batch = strtoull(optarg, NULL, 10);
+            break;
+
+        case 'c':
+            nthreads = strtol(optarg, NULL, 10);
+            break;
+
+        case 'm':
+            maxsleepq = strtoull(optarg, NULL, 10);
+            break;
+
+        case 'n':
+            nops = strtoull(optarg, NULL, 10);
+            break;
+
+        case 'p':
+            mnthr_set_placement(strtoul(optarg, NULL, 0));
+            break;
+
+        case 't':
+            bench_tag = optarg;
+            break;
+
+        default:
+            fprintf(stderr,
+                    "usage: %s [-n NOPS] [-b BATCH] [-c NTHREADS] "
+                    "[-m MAXSLEEPQ] [-p FLAGS] [-t TAG] [BENCH ...]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+    if (batch == 0 || nthreads <= 0 || nops < batch) {
+        fprintf(stderr, "invalid parameters\n");
+        return 1;
+    }
+
+    srandom(0);
+    (void)mnthr_init();
+    (void)mnthr_spawn("run",
+                      run,
+                      2,
+                      (void *)(intptr_t)(argc - optind),
+                      argv + optind);
+    (void)mnthr_loop();
+    (void)mnthr_fini();
+
+    return 0;
+}
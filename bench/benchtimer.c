@@ -0,0 +1,265 @@
+/*
+ * Timer churn benchmark.
+ *
+ *  benchtimer [-c NCONNS] [-r RATE] [-T TIMEOUT_MSEC] [-i IDLE_PCT]
+ *             [-d SECONDS] [-t TAG] [timer|notimer ...]
+ *
+ * Simulate NCONNS connections, each waiting for its next message with
+ * an idle timeout of TIMEOUT_MSEC re-armed on every message, as a
+ * server would.  Messages arrive at RATE per second in total, spread
+ * at random over the connections, except for IDLE_PCT percent of them
+ * that never get any and whose timers eventually fire.
+ *
+ * The timer run re-arms the timeout on every message, the notimer run
+ * waits for messages without a timeout: the difference in CPU time per
+ * message is the cost of the sleepq churn.  Timer accuracy is reported
+ * as percentiles of how late the idle timers fire, in nanoseconds.
+ */
+#include <assert.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <mncommon/dumpm.h>
+#include <mncommon/util.h>
+
+#include <mnthr.h>
+
+#include "bench.h"
+
+static int nconns = 100000;
+static uint64_t rate = 100000;
+static uint64_t timeout = 30000;
+static unsigned idle_pct = 1;
+static unsigned duration = 35;
+
+static const char *modes[] = {"timer", "notimer"};
+
+static mnthr_signal_t *signals;
+static bool use_timer;
+static bool done;
+static uint64_t nmessages;
+static uint64_t nfired;
+static bench_samples_t lateness;
+
+
+static int
+conn(UNUSED int argc, void *argv[])
+{
+    mnthr_signal_t *signal;
+
+    signal = argv[0];
+
+    while (!done) {
+        if (use_timer) {
+            uint64_t due, now;
+
+            due = bench_now_nsec() + timeout * 1000000;
+            (void)mnthr_signal_subscribe_with_timeout(signal, timeout);
+            /* woken up by the timer, not by a message */
+            if ((now = bench_now_nsec()) >= due) {
+                bench_samples_add(&lateness, now - due);
+                ++nfired;
+                /* an idle connection would be closed now */
+                break;
+            }
+        } else {
+            (void)mnthr_signal_subscribe(signal);
+        }
+        ++nmessages;
+    }
+    return 0;
+}
+
+
+static void
+bench_mode(int mode)
+{
+    mnthr_ctx_t **ctxes;
+    uint64_t start, end, cpu0, cpu1, last;
+    double credit;
+    int i, nactive;
+
+    if ((ctxes = malloc(nconns * sizeof(mnthr_ctx_t *))) == NULL ||
+        (signals = malloc(nconns * sizeof(mnthr_signal_t))) == NULL) {
+        FAIL("malloc");
+    }
+
+    use_timer = (mode == 0);
+    done = false;
+    nmessages = 0;
+    nfired = 0;
+    bench_samples_init(&lateness);
+
+    for (i = 0; i < nconns; ++i) {
+        MNTHR_SIGNAL_INIT(&signals[i]);
+        ctxes[i] = mnthr_spawn("conn", conn, 1, &signals[i]);
+    }
+    /* the idle ones come first */
+    nactive = nconns - (int)((uint64_t)nconns * idle_pct / 100);
+
+    start = bench_now_nsec();
+    end = start + (uint64_t)duration * 1000000000;
+    cpu0 = bench_cpu_nsec();
+    last = start;
+    credit = 0.0;
+    while (true) {
+        uint64_t now;
+
+        (void)mnthr_sleep(1);
+        now = bench_now_nsec();
+        if (now >= end) {
+            break;
+        }
+        credit += (double)rate * (double)(now - last) / 1000000000.0;
+        last = now;
+        if (nactive > 0) {
+            for (; credit >= 1.0; credit -= 1.0) {
+                i = nconns - nactive + (int)(random() % nactive);
+                mnthr_signal_send(&signals[i]);
+            }
+        }
+    }
+    cpu1 = bench_cpu_nsec();
+
+    bench_json_begin(modes[mode]);
+    bench_json_u64("nconns", nconns);
+    bench_json_u64("rate", rate);
+    bench_json_u64("timeout_msec", timeout);
+    bench_json_u64("messages", nmessages);
+    bench_json_double("cpu_ns_per_msg",
+                      nmessages ? (double)(cpu1 - cpu0) / nmessages : 0.0);
+    bench_json_double("cpu_pct",
+                      100.0 * (double)(cpu1 - cpu0) /
+                      (double)(bench_now_nsec() - start));
+    if (use_timer) {
+        bench_json_u64("fired", nfired);
+        bench_json_samples(&lateness);
+    }
+    bench_json_end();
+
+    done = true;
+    for (i = 0; i < nconns; ++i) {
+        if (!mnthr_is_dead(ctxes[i])) {
+            mnthr_signal_send(&signals[i]);
+        }
+    }
+    while (true) {
+        for (i = 0; i < nconns; ++i) {
+            if (!mnthr_is_dead(ctxes[i])) {
+                break;
+            }
+        }
+        if (i == nconns) {
+            break;
+        }
+        (void)mnthr_yield();
+    }
+
+    bench_samples_fini(&lateness);
+    free(signals);
+    free(ctxes);
+    (void)mnthr_gc();
+    (void)mnthr_compact_sleepq(0);
+}
+
+
+static int
+run(UNUSED int argc, void *argv[])
+{
+    int nnames;
+    char **names;
+    size_t i;
+    int j;
+
+    nnames = (int)(intptr_t)argv[0];
+    names = argv[1];
+    for (i = 0; i < countof(modes); ++i) {
+        if (nnames > 0) {
+            for (j = 0; j < nnames; ++j) {
+                if (strcmp(names[j], modes[i]) == 0) {
+                    break;
+                }
+            }
+            if (j == nnames) {
+                continue;
+            }
+        }
+        bench_mode((int)i);
+    }
+
+    mnthr_shutdown();
+    return 0;
+}
+
+
+int
+main(int argc, char *argv[])
+{
+    int ch;
+    size_t maxmap;
+
+    bench_suite = "timer";
+    while ((ch = getopt(argc, argv, "c:d:i:r:t:T:")) != -1) {
+        switch (ch) {
+        case 'c':
+            nconns = strtol(optarg, NULL, 10);
+            break;
+
+        case 'd':
+            duration = strtoul(optarg, NULL, 10);
+            break;
+
+        case 'i':
+            idle_pct = strtoul(optarg, NULL, 10);
+            break;
+
+        case 'r':
+            rate = strtoull(optarg, NULL, 10);
+            break;
+
+        case 't':
+            bench_tag = optarg;
+            break;
+
+        case 'T':
+            timeout = strtoull(optarg, NULL, 10);
+            break;
+
+        default:
+            fprintf(stderr,
+                    "usage: %s [-c NCONNS] [-r RATE] [-T TIMEOUT_MSEC] "
+                    "[-i IDLE_PCT] [-d SECONDS] [-t TAG] "
+                    "[timer|notimer ...]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+    if (nconns <= 0 || idle_pct > 100) {
+        fprintf(stderr, "invalid parameters\n");
+        return 1;
+    }
+
+    maxmap = bench_max_map_count();
+    if (BENCH_THREAD_VMAS * (size_t)nconns + 1000 > maxmap) {
+        nconns = (int)((maxmap - 1000) / BENCH_THREAD_VMAS);
+        fprintf(stderr,
+                "vm.max_map_count is %zu, limiting to %d connections\n",
+                maxmap,
+                nconns);
+    }
+
+    srandom(0);
+    (void)mnthr_init();
+    (void)mnthr_spawn("run",
+                      run,
+                      2,
+                      (void *)(intptr_t)(argc - optind),
+                      argv + optind);
+    (void)mnthr_loop();
+    (void)mnthr_fini();
+
+    return 0;
+}
@@ -0,0 +1,141 @@
+/**
+ * Loop lag and admission control.
+ *
+ * The loop lag is how long runnable threads wait to be run.  Every
+ * poller_sift_sleepq() takes a sample: how far past its deadline the
+ * earliest expired timer is, or, for the threads made runnable
+ * directly (mnthr_yield(), mnthr_set_resume() and such), the time since
+ * the previous sift.  The samples are smoothed into an exponentially
+ * weighted moving average, published as the loop_lag_nsec metric.
+ *
+ * Once the lag, or the number of live threads, is over its limit, the
+ * loop is overloaded, and the admission policy decides what to do
+ * about new work:
+ *
+ *  - MNTHR_ADMIT_PAUSE_ACCEPT: mnthr_accept_all() and
+ *    mnthr_accept_all2() stop accepting, and leave the connections in
+ *    the listen backlog until the loop has recovered;
+ *
+ *  - MNTHR_ADMIT_FAIL_SPAWN: mnthr_spawn() and mnthr_spawn_sig() fail
+ *    with EAGAIN.  mnthr_new(), mnthr_new_sig() and mnthr_wait_for()
+ *    are not gated: they cannot fail, and the library's own threads
+ *    (pool workers, flushers) are created with them.
+ *
+ * The lag limit has some hysteresis: the loop stays overloaded until
+ * the lag is back under 3/4 of the limit.
+ */
+#include <assert.h>
+#include <stdbool.h>
+
+#ifdef HAVE_CONFIG_H
+#   include "config.h"
+#endif
+
+#ifdef DO_MEMDEBUG
+#include <mncommon/memdebug.h>
+MEMDEBUG_DECLARE(mnthr_admission);
+#endif
+
+#include <mncommon/btrie.h>
+
+#include "mnthr_private.h"
+
+//#define TRACE_VERBOSE
+#include "diag.h"
+#include <mncommon/dumpm.h>
+
+/* the weight of a new sample is 1/LOOP_LAG_SMOOTHING */
+#define LOOP_LAG_SMOOTHING 8
+#define ADMISSION_PAUSE_MSEC 5
+
+unsigned admission_policy = 0;
+static uint64_t max_lag_nsec = 0;
+static size_t max_threads = 0;
+static bool lagging = false;
+
+
+/**
+ * Set the overload limits, 0 for no limit, and the policy, a
+ * combination of MNTHR_ADMIT_* flags.
+ */
+void
+mnthr_set_admission(uint64_t max_lag_usec, size_t nthreads, unsigned policy)
+{
+    max_lag_nsec = max_lag_usec * 1000;
+    max_threads = nthreads;
+    admission_policy = policy;
+    lagging = false;
+}
+
+
+/**
+ * Smoothed loop lag in nsec.
+ */
+uint64_t
+mnthr_get_loop_lag(void)
+{
+    return mnthr_stats.loop_lag_nsec;
+}
+
+
+bool
+mnthr_overloaded(void)
+{
+    if (max_lag_nsec != 0) {
+        uint64_t lag;
+
+        lag = mnthr_stats.loop_lag_nsec;
+        if (lag > max_lag_nsec) {
+            lagging = true;
+        } else if (lag <= max_lag_nsec - max_lag_nsec / 4) {
+            lagging = false;
+        }
+        if (lagging) {
+            return true;
+        }
+    }
+
+    if (max_threads != 0) {
+        size_t nctxes, nfree;
+
+        ctxes_count(&nctxes, &nfree);
+        if (nctxes - nfree >= max_threads) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+void
+loop_lag_update(uint64_t sample)
+{
+    uint64_t lag;
+
+    lag = mnthr_stats.loop_lag_nsec;
+    if (sample > lag) {
+        lag += (sample - lag) / LOOP_LAG_SMOOTHING;
+    } else {
+        lag -= (lag - sample) / LOOP_LAG_SMOOTHING;
+    }
+    mnthr_stats.loop_lag_nsec = lag;
+}
+
+
+/**
+ * Hold the calling thread while the loop is overloaded.
+ */
+int
+admission_pause(void)
+{
+    while (mnthr_overloaded()) {
+        int res;
+
+        ++mnthr_stats.admission_pauses;
+        if ((res = mnthr_sleep(ADMISSION_PAUSE_MSEC)) != 0) {
+            return res;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,202 @@
+/**
+ * Per thread arena allocator.
+ *
+ * mnthr_alloc() bump-allocates from a list of chunks hung on the
+ * current ctx.  There is no individual free: the whole arena is
+ * released when the thread exits (mnthr_ctx_finalize()), or by the
+ * thread itself with mnthr_arena_reset() or mnthr_arena_release().
+ *
+ * Released chunks of the standard size go to a free list shared by all
+ * threads of the loop, and are handed out again before malloc(3) is
+ * asked for a new one, up to ARENA_CACHE_MAX cached chunks.  Requests
+ * larger than a chunk get a chunk of their own, that is not cached.
+ */
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_CONFIG_H
+#   include "config.h"
+#endif
+
+#ifdef DO_MEMDEBUG
+#include <mncommon/memdebug.h>
+MEMDEBUG_DECLARE(mnthr_arena);
+#endif
+
+#include <mncommon/btrie.h>
+
+#include "mnthr_private.h"
+
+//#define TRACE_VERBOSE
+#include "diag.h"
+#include <mncommon/dumpm.h>
+
+#define ARENA_ALIGN 16
+#define ARENA_CHUNK_SIZE (64 * 1024)
+#define ARENA_CACHE_MAX 256
+
+struct _mnthr_arena_chunk {
+    struct _mnthr_arena_chunk *next;
+    size_t size;
+    size_t used;
+};
+
+#define ARENA_ROUNDUP(sz) (((sz) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1))
+#define ARENA_CHUNK_HDR ARENA_ROUNDUP(sizeof(struct _mnthr_arena_chunk))
+#define ARENA_CHUNK_DATA(c) ((char *)(c) + ARENA_CHUNK_HDR)
+
+static struct _mnthr_arena_chunk *cache = NULL;
+static size_t ncached = 0;
+
+
+static struct _mnthr_arena_chunk *
+arena_chunk_new(size_t sz)
+{
+    struct _mnthr_arena_chunk *c;
+
+    if (sz <= ARENA_CHUNK_SIZE && cache != NULL) {
+        c = cache;
+        cache = c->next;
+        --ncached;
+        ++mnthr_stats.arena_chunk_reuses;
+    } else {
+        sz = MAX(sz, ARENA_CHUNK_SIZE);
+        if ((c = malloc(ARENA_CHUNK_HDR + sz)) == NULL) {
+            FAIL("malloc");
+        }
+        c->size = sz;
+        ++mnthr_stats.arena_chunk_allocs;
+    }
+    c->used = 0;
+    return c;
+}
+
+
+static void
+arena_chunk_destroy(struct _mnthr_arena_chunk *c)
+{
+    if (c->size == ARENA_CHUNK_SIZE && ncached < ARENA_CACHE_MAX) {
+        c->next = cache;
+        cache = c;
+        ++ncached;
+    } else {
+        free(c);
+    }
+}
+
+
+void *
+mnthr_alloc(size_t sz)
+{
+    struct _mnthr_arena_chunk *c;
+    void *res;
+
+    assert(me != NULL);
+
+    sz = ARENA_ROUNDUP(sz);
+    c = me->arena;
+    if (c == NULL || c->size - c->used < sz) {
+        c = arena_chunk_new(sz);
+        c->next = me->arena;
+        me->arena = c;
+    }
+    res = ARENA_CHUNK_DATA(c) + c->used;
+    c->used += sz;
+    return res;
+}
+
+
+void *
+mnthr_alloc0(size_t sz)
+{
+    void *res;
+
+    res = mnthr_alloc(sz);
+    memset(res, 0, sz);
+    return res;
+}
+
+
+char *
+mnthr_strdup(const char *s)
+{
+    size_t sz;
+    char *res;
+
+    sz = strlen(s) + 1;
+    res = mnthr_alloc(sz);
+    memcpy(res, s, sz);
+    return res;
+}
+
+
+/**
+ * Remember the current top of the arena, to release everything
+ * allocated after it with mnthr_arena_release().
+ */
+mnthr_arena_mark_t
+mnthr_arena_mark(void)
+{
+    mnthr_arena_mark_t mark;
+
+    assert(me != NULL);
+
+    mark.chunk = me->arena;
+    mark.used = me->arena != NULL ? me->arena->used : 0;
+    return mark;
+}
+
+
+void
+mnthr_arena_release(mnthr_arena_mark_t mark)
+{
+    struct _mnthr_arena_chunk *c;
+
+    assert(me != NULL);
+
+    while ((c = me->arena) != mark.chunk) {
+        assert(c != NULL);
+        me->arena = c->next;
+        arena_chunk_destroy(c);
+    }
+    if (c != NULL) {
+        c->used = mark.used;
+    }
+}
+
+
+void
+mnthr_arena_reset(void)
+{
+    assert(me != NULL);
+    arena_fini(me);
+}
+
+
+void
+arena_fini(mnthr_ctx_t *ctx)
+{
+    struct _mnthr_arena_chunk *c;
+
+    while ((c = ctx->arena) != NULL) {
+        ctx->arena = c->next;
+        arena_chunk_destroy(c);
+    }
+}
+
+
+/**
+ * Give the cached chunks back to malloc(3).
+ */
+void
+arena_cache_flush(void)
+{
+    struct _mnthr_arena_chunk *c;
+
+    while ((c = cache) != NULL) {
+        cache = c->next;
+        free(c);
+    }
+    ncached = 0;
+}
@@ -0,0 +1,316 @@
+/**
+ * Backtraces of parked threads.
+ *
+ * A parked thread's execution context is saved by swapcontext(3) in its
+ * co.uc.  Debuggers and profilers cannot unwind through it, so we do it
+ * ourselves: either by libunwind (configured --with-libunwind) starting
+ * from the saved ucontext_t, or by walking the frame pointer chain
+ * within the bounds of the thread's stack.  The latter requires user
+ * code to be compiled with -fno-omit-frame-pointer, and silently yields
+ * shorter backtraces otherwise.
+ */
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#ifdef HAVE_CONFIG_H
+#   include "config.h"
+#endif
+
+#ifdef HAVE_DLFCN_H
+#include <dlfcn.h>
+#endif
+
+#ifdef HAVE_LIBUNWIND
+#define UNW_LOCAL_ONLY
+#include <libunwind.h>
+#endif
+
+#ifdef DO_MEMDEBUG
+#include <mncommon/memdebug.h>
+MEMDEBUG_DECLARE(mnthr_backtrace);
+#endif
+
+#include <mncommon/btrie.h>
+
+#include "mnthr_private.h"
+
+//#define TRACE_VERBOSE
+#include "diag.h"
+#include <mncommon/dumpm.h>
+
+
+/**
+ * Walk the frame pointer chain starting at pc/fp.  Only frames within
+ * [lo, hi) are followed.  Return the number of return addresses stored
+ * in frames.
+ */
+int
+mnthr_fp_walk(uintptr_t pc,
+              uintptr_t fp,
+              uintptr_t lo,
+              uintptr_t hi,
+              void **frames,
+              int nframes)
+{
+    int n;
+
+    n = 0;
+    if (pc != 0 && n < nframes) {
+        frames[n++] = (void *)pc;
+    }
+
+    while (n < nframes) {
+        uintptr_t *p;
+
+        if (fp < lo ||
+            fp + 2 * sizeof(uintptr_t) > hi ||
+            fp % sizeof(uintptr_t) != 0) {
+            break;
+        }
+        p = (uintptr_t *)fp;
+        if (p[1] == 0) {
+            break;
+        }
+        frames[n++] = (void *)p[1];
+        /* the chain must grow towards the stack top */
+        if (p[0] <= fp) {
+            break;
+        }
+        fp = p[0];
+    }
+
+    return n;
+}
+
+
+/**
+ * Capture up to nframes return addresses of a parked thread.  Return
+ * the number of frames captured, 0 if ctx is not parked.
+ */
+int
+mnthr_backtrace(const mnthr_ctx_t *ctx, void **frames, int nframes)
+{
+    if (ctx == me ||
+        !(ctx->co.state & CO_STATE_RESUMABLE) ||
+        ctx->co.stack == MAP_FAILED ||
+        /* its frames are off the stack, see hibernate.c */
+        ctx->hibernated != NULL) {
+        return 0;
+    }
+
+#if defined(HAVE_LIBUNWIND) && (defined(__x86_64__) || defined(__amd64__))
+    {
+        /* on x86-64 unw_context_t is ucontext_t */
+        unw_context_t uc;
+        unw_cursor_t cursor;
+        int n;
+
+        uc = ctx->co.uc;
+        if (unw_init_local(&cursor, &uc) != 0) {
+            return 0;
+        }
+
+        n = 0;
+        do {
+            unw_word_t pc;
+
+            if (unw_get_reg(&cursor, UNW_REG_IP, &pc) != 0 || pc == 0) {
+                break;
+            }
+            frames[n++] = (void *)pc;
+        } while (n < nframes && unw_step(&cursor) > 0);
+
+        return n;
+    }
+#elif defined(MNTHR_UC_PC)
+    return mnthr_fp_walk(MNTHR_UC_PC(&ctx->co.uc),
+                         MNTHR_UC_FP(&ctx->co.uc),
+                         (uintptr_t)ctx->co.stack + PAGE_SIZE,
+                         (uintptr_t)ctx->co.stack +
+                            ctx->co.uc.uc_stack.ss_size,
+                         frames,
+                         nframes);
+#else
+    (void)frames;
+    (void)nframes;
+    return 0;
+#endif
+}
+
+
+static void
+dump_frame(int i, void *pc)
+{
+#ifdef HAVE_DLFCN_H
+    Dl_info info;
+
+    if (dladdr(pc, &info) != 0 && info.dli_sname != NULL) {
+        TRACEC("  #%-2d %p %s+0x%lx (%s)\n",
+               i,
+               pc,
+               info.dli_sname,
+               (unsigned long)((uintptr_t)pc - (uintptr_t)info.dli_saddr),
+               info.dli_fname);
+        return;
+    }
+#endif
+    TRACEC("  #%-2d %p\n", i, pc);
+}
+
+
+void
+mnthr_dump_backtrace(const mnthr_ctx_t *ctx)
+{
+    void *frames[MNTHR_BACKTRACE_DEPTH];
+    int i, n;
+
+    n = mnthr_backtrace(ctx, frames, countof(frames));
+    for (i = 0; i < n; ++i) {
+        dump_frame(i, frames[i]);
+    }
+}
+
+
+/*
+ * Top blocked call sites.
+ *
+ * A call site of a parked thread is the innermost frame that does not
+ * belong to the library itself.
+ */
+typedef struct _blocked_site {
+    void *pc;
+    size_t count;
+} blocked_site_t;
+
+
+typedef struct _blocked_sites {
+    blocked_site_t *data;
+    size_t elnum;
+    size_t sz;
+} blocked_sites_t;
+
+
+static bool
+frame_is_internal(void *pc)
+{
+#ifdef HAVE_DLFCN_H
+    static Dl_info self;
+    static bool self_is_lib = false;
+    Dl_info info;
+
+    if (self.dli_fname == NULL) {
+        if (dladdr((void *)(uintptr_t)mnthr_backtrace, &self) != 0) {
+            self_is_lib = strstr(self.dli_fname, "libmnthr") != NULL;
+        }
+    }
+
+    if (dladdr(pc, &info) == 0) {
+        return false;
+    }
+    if (self_is_lib) {
+        return info.dli_fbase == self.dli_fbase;
+    }
+    /* statically linked */
+    return info.dli_sname != NULL &&
+        (strncmp(info.dli_sname, "mnthr_", 6) == 0 ||
+         strncmp(info.dli_sname, "poller_", 7) == 0 ||
+         strcmp(info.dli_sname, "yield") == 0 ||
+         strcmp(info.dli_sname, "swapcontext") == 0);
+#else
+    (void)pc;
+    return false;
+#endif
+}
+
+
+static int
+blocked_site_cmp(const void *a, const void *b)
+{
+    const blocked_site_t *sa = a, *sb = b;
+
+    return MNCMP(sb->count, sa->count);
+}
+
+
+static int
+collect_blocked_site(mnthr_ctx_t *ctx, void *udata)
+{
+    blocked_sites_t *sites = udata;
+    void *frames[MNTHR_BACKTRACE_DEPTH];
+    void *pc;
+    size_t j;
+    int i, n;
+
+    if ((n = mnthr_backtrace(ctx, frames, countof(frames))) == 0) {
+        return 0;
+    }
+
+    pc = frames[n - 1];
+    for (i = 0; i < n; ++i) {
+        if (!frame_is_internal(frames[i])) {
+            pc = frames[i];
+            break;
+        }
+    }
+
+    for (j = 0; j < sites->elnum; ++j) {
+        if (sites->data[j].pc == pc) {
+            ++sites->data[j].count;
+            return 0;
+        }
+    }
+
+    if (sites->elnum == sites->sz) {
+        blocked_site_t *tmp;
+
+        sites->sz = sites->sz ? sites->sz * 2 : 64;
+        if ((tmp = realloc(sites->data,
+                           sites->sz * sizeof(blocked_site_t))) == NULL) {
+            FAIL("realloc");
+        }
+        sites->data = tmp;
+    }
+    sites->data[sites->elnum].pc = pc;
+    sites->data[sites->elnum].count = 1;
+    ++sites->elnum;
+
+    return 0;
+}
+
+
+/**
+ * Report up to top call sites where threads are parked, most populated
+ * first.
+ */
+void
+mnthr_dump_blocked_sites(size_t top)
+{
+    blocked_sites_t sites;
+    size_t i;
+
+    sites.data = NULL;
+    sites.elnum = 0;
+    sites.sz = 0;
+
+    (void)ctxes_traverse(collect_blocked_site, &sites);
+
+    if (sites.elnum > 0) {
+        qsort(sites.data,
+              sites.elnum,
+              sizeof(blocked_site_t),
+              blocked_site_cmp);
+    }
+
+    TRACEC("blocked sites:\n");
+    for (i = 0; i < sites.elnum && i < top; ++i) {
+        TRACEC("%8zu", sites.data[i].count);
+        dump_frame((int)i, sites.data[i].pc);
+    }
+    TRACEC("end of blocked sites\n");
+
+    free(sites.data);
+}
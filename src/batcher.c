@@ -0,0 +1,262 @@
+/**
+ * Micro-batching.
+ *
+ * Threads submit items to a batcher and park until their item is done.
+ * A flusher thread owned by the batcher collects the items and runs the
+ * handler over them at once, when either:
+ *
+ *  - the batch is full (nmax items), or
+ *  - usec have passed since the first item of the batch arrived.
+ *
+ * The flusher keeps a single sleepq timer for the batch, and is woken
+ * up through mnthr_signal_send(), so that it runs in the loop iteration
+ * after the one the batch has filled up in: with usec 0 a batch is
+ * whatever has been submitted within one loop iteration.
+ */
+#include <assert.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_CONFIG_H
+#   include "config.h"
+#endif
+
+#ifdef DO_MEMDEBUG
+#include <mncommon/memdebug.h>
+MEMDEBUG_DECLARE(mnthr_batcher);
+#endif
+
+#include <mncommon/btrie.h>
+
+#include "mnthr_private.h"
+
+//#define TRACE_VERBOSE
+#include "diag.h"
+#include <mncommon/dumpm.h>
+
+
+struct _mnthr_batcher {
+    size_t nmax;
+    uint64_t wait_nsec;
+    mnthr_batch_func_t fn;
+    void *udata;
+    bool closing;
+    /* mnthr_get_now_nsec() of the first pending item */
+    uint64_t first;
+    DTQUEUE(_mnthr_batch_item, pending);
+    mnthr_batch_item_t **batch;
+    mnthr_signal_t signal;
+    mnthr_ctx_t *flusher;
+    mnthr_batcher_stats_t stats;
+};
+
+
+static void
+batcher_flush(mnthr_batcher_t *b)
+{
+    mnthr_batch_item_t *item;
+    size_t i, n;
+    int res;
+
+    for (n = 0;
+         n < b->nmax && (item = DTQUEUE_HEAD(&b->pending)) != NULL;
+         ++n) {
+        DTQUEUE_DEQUEUE(&b->pending, link);
+        DTQUEUE_ENTRY_FINI(link, item);
+        b->batch[n] = item;
+    }
+    /* what is left starts the next batch */
+    b->first = mnthr_get_now_nsec();
+
+    ++b->stats.batches;
+    b->stats.items += n;
+
+    if ((res = b->fn(b->batch, n, b->udata)) != 0) {
+        for (i = 0; i < n; ++i) {
+            b->batch[i]->rc = res;
+        }
+    }
+
+    for (i = 0; i < n; ++i) {
+        b->batch[i]->done = true;
+        mnthr_cond_signal_all(&b->batch[i]->cond);
+    }
+}
+
+
+static int
+batcher_flusher(UNUSED int argc, void *argv[])
+{
+    mnthr_batcher_t *b;
+
+    assert(argc == 1);
+    b = argv[0];
+
+    while (true) {
+        int res;
+
+        if (DTQUEUE_EMPTY(&b->pending)) {
+            if (b->closing) {
+                break;
+            }
+            if (mnthr_signal_subscribe(&b->signal) != 0) {
+                break;
+            }
+            continue;
+        }
+
+        if (DTQUEUE_LENGTH(&b->pending) < b->nmax && !b->closing) {
+            uint64_t now, deadline;
+
+            now = mnthr_get_now_nsec();
+            deadline = b->first + b->wait_nsec;
+            if (now < deadline) {
+                res = mnthr_signal_subscribe_with_timeout_usec(
+                        &b->signal, (deadline - now) / 1000 + 1);
+                if (res != 0 && res != (int)MNTHR_WAIT_TIMEOUT) {
+                    break;
+                }
+                continue;
+            }
+            ++b->stats.timer_flushes;
+        } else if (DTQUEUE_LENGTH(&b->pending) >= b->nmax) {
+            ++b->stats.full_flushes;
+        }
+
+        batcher_flush(b);
+    }
+
+    /* interrupted, do not leave anyone parked */
+    while (!DTQUEUE_EMPTY(&b->pending)) {
+        batcher_flush(b);
+    }
+    mnthr_signal_fini(&b->signal);
+    b->flusher = NULL;
+    return 0;
+}
+
+
+/**
+ * Create a batcher that runs fn over up to nmax items at once, no
+ * later than usec after the first of them has been submitted.
+ */
+mnthr_batcher_t *
+mnthr_batcher_new(const char *name,
+                  size_t nmax,
+                  uint64_t usec,
+                  mnthr_batch_func_t fn,
+                  void *udata)
+{
+    mnthr_batcher_t *b;
+
+    if ((b = malloc(sizeof(mnthr_batcher_t))) == NULL) {
+        FAIL("malloc");
+    }
+    b->nmax = MAX(nmax, 1);
+    b->wait_nsec = usec * 1000;
+    b->fn = fn;
+    b->udata = udata;
+    b->closing = false;
+    b->first = 0;
+    DTQUEUE_INIT(&b->pending);
+    if ((b->batch = malloc(b->nmax * sizeof(mnthr_batch_item_t *))) == NULL) {
+        FAIL("malloc");
+    }
+    mnthr_signal_init(&b->signal, NULL);
+    memset(&b->stats, 0, sizeof(b->stats));
+
+    b->flusher = mnthr_new(name != NULL ? name : "batcher",
+                           batcher_flusher,
+                           1,
+                           b);
+    mnthr_run(b->flusher);
+    return b;
+}
+
+
+/**
+ * Submit the item, and wait for the handler to have run over it.
+ * Return the item's rc, or the error the wait has been interrupted
+ * with, or an error if the batcher is being destroyed or its flusher
+ * has been interrupted.  An item that the handler is already running over is waited
+ * for anyway, so that it never outlives the call.
+ */
+int
+mnthr_batcher_submit(mnthr_batcher_t *b, mnthr_batch_item_t *item)
+{
+    int res;
+
+    assert(me != NULL);
+
+    if (b->closing) {
+        TRRET(MNTHR_BATCHER_SUBMIT + 1);
+    }
+    if (b->flusher == NULL) {
+        /* interrupted, nobody would flush it */
+        TRRET(MNTHR_BATCHER_SUBMIT + 2);
+    }
+
+    DTQUEUE_ENTRY_INIT(link, item);
+    item->rc = 0;
+    item->done = false;
+    mnthr_cond_init(&item->cond);
+
+    if (DTQUEUE_EMPTY(&b->pending)) {
+        b->first = mnthr_get_now_nsec();
+        DTQUEUE_ENQUEUE(&b->pending, link, item);
+        mnthr_signal_send(&b->signal);
+    } else {
+        DTQUEUE_ENQUEUE(&b->pending, link, item);
+        if (DTQUEUE_LENGTH(&b->pending) == b->nmax) {
+            mnthr_signal_send(&b->signal);
+        }
+    }
+
+    res = 0;
+    while (!item->done) {
+        int res1;
+
+        if ((res1 = mnthr_cond_wait(&item->cond)) != 0) {
+            res = res1;
+            if (!DTQUEUE_ORPHAN(&b->pending, link, item)) {
+                DTQUEUE_REMOVE(&b->pending, link, item);
+                DTQUEUE_ENTRY_FINI(link, item);
+                ++b->stats.cancelled;
+                break;
+            }
+        }
+    }
+
+    mnthr_cond_fini(&item->cond);
+    return res != 0 ? res : item->rc;
+}
+
+
+void
+mnthr_batcher_get_stats(const mnthr_batcher_t *b,
+                        mnthr_batcher_stats_t *stats)
+{
+    *stats = b->stats;
+}
+
+
+/**
+ * Flush what is pending, stop the flusher, and free the batcher.
+ */
+int
+mnthr_batcher_destroy(mnthr_batcher_t *b)
+{
+    int res;
+
+    b->closing = true;
+    if (b->flusher != NULL) {
+        mnthr_signal_send(&b->signal);
+        if ((res = mnthr_join(b->flusher)) != 0) {
+            return res;
+        }
+    }
+    free(b->batch);
+    free(b);
+    return 0;
+}
@@ -0,0 +1,157 @@
+/**
+ * I/O buffer pool.
+ *
+ * Fixed size buffers in BUFPOOL_NCLASSES size classes, carved out of
+ * BUFPOOL_SLAB_SIZE slabs mmap(2)'ed on demand, and kept on a free list
+ * per class.  A connection that borrows a buffer only when there is
+ * data to read (mnthr_read_buf()) holds no memory while idle, and the
+ * buffer is handed over to the caller without copying, to be given
+ * back with mnthr_buf_put().
+ *
+ * With MNTHR_BUFPOOL_HUGEPAGES the slabs are backed by huge pages
+ * (MAP_HUGETLB), or at least advised to be (MADV_HUGEPAGE) when none
+ * are reserved.  Slabs are kept until mnthr_fini().
+ */
+#include <assert.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+#ifdef HAVE_CONFIG_H
+#   include "config.h"
+#endif
+
+#ifdef DO_MEMDEBUG
+#include <mncommon/memdebug.h>
+MEMDEBUG_DECLARE(mnthr_bufpool);
+#endif
+
+#include <mncommon/btrie.h>
+
+#include "mnthr_private.h"
+
+//#define TRACE_VERBOSE
+#include "diag.h"
+#include <mncommon/dumpm.h>
+
+#define BUFPOOL_NCLASSES 4
+#define BUFPOOL_SLAB_SIZE (2 * 1024 * 1024)
+
+static const size_t class_size[BUFPOOL_NCLASSES] = {
+    4 * 1024,
+    16 * 1024,
+    64 * 1024,
+    256 * 1024,
+};
+
+struct bufpool_slab {
+    struct bufpool_slab *next;
+    void *mem;
+    mnthr_buf_t *bufs;
+};
+
+static mnthr_buf_t *free_bufs[BUFPOOL_NCLASSES];
+static struct bufpool_slab *slabs = NULL;
+static unsigned bufpool_flags = 0;
+
+
+void
+mnthr_bufpool_set_flags(unsigned flags)
+{
+    bufpool_flags = flags;
+}
+
+
+static void
+bufpool_grow(int cls)
+{
+    struct bufpool_slab *slab;
+    size_t i, n;
+    void *mem;
+
+    if ((mem = placement_mmap(BUFPOOL_SLAB_SIZE,
+                              (bufpool_flags & MNTHR_BUFPOOL_HUGEPAGES) ?
+                                  PLACEMENT_HUGETLB : 0)) == MAP_FAILED) {
+        FAIL("placement_mmap");
+    }
+
+    n = BUFPOOL_SLAB_SIZE / class_size[cls];
+    if ((slab = malloc(sizeof(struct bufpool_slab))) == NULL) {
+        FAIL("malloc");
+    }
+    if ((slab->bufs = malloc(n * sizeof(mnthr_buf_t))) == NULL) {
+        FAIL("malloc");
+    }
+    slab->mem = mem;
+    slab->next = slabs;
+    slabs = slab;
+    mnthr_stats.bufpool_slab_bytes += BUFPOOL_SLAB_SIZE;
+
+    for (i = 0; i < n; ++i) {
+        mnthr_buf_t *buf;
+
+        buf = slab->bufs + i;
+        buf->data = (char *)mem + i * class_size[cls];
+        buf->size = class_size[cls];
+        buf->len = 0;
+        buf->cls = cls;
+        buf->next = free_bufs[cls];
+        free_bufs[cls] = buf;
+    }
+}
+
+
+/**
+ * Borrow a buffer of at least sz bytes, or of the largest class if
+ * sz is larger than that.
+ */
+mnthr_buf_t *
+mnthr_buf_get(size_t sz)
+{
+    mnthr_buf_t *buf;
+    int cls;
+
+    for (cls = 0; cls < BUFPOOL_NCLASSES - 1; ++cls) {
+        if (sz <= class_size[cls]) {
+            break;
+        }
+    }
+    if (free_bufs[cls] == NULL) {
+        bufpool_grow(cls);
+    }
+    buf = free_bufs[cls];
+    free_bufs[cls] = buf->next;
+    buf->next = NULL;
+    buf->len = 0;
+    ++mnthr_stats.bufpool_borrowed;
+    return buf;
+}
+
+
+void
+mnthr_buf_put(mnthr_buf_t *buf)
+{
+    assert(buf->cls >= 0 && buf->cls < BUFPOOL_NCLASSES);
+    buf->next = free_bufs[buf->cls];
+    free_bufs[buf->cls] = buf;
+    --mnthr_stats.bufpool_borrowed;
+}
+
+
+void
+bufpool_fini(void)
+{
+    struct bufpool_slab *slab;
+    int cls;
+
+    while ((slab = slabs) != NULL) {
+        slabs = slab->next;
+        (void)munmap(slab->mem, BUFPOOL_SLAB_SIZE);
+        free(slab->bufs);
+        free(slab);
+    }
+    for (cls = 0; cls < BUFPOOL_NCLASSES; ++cls) {
+        free_bufs[cls] = NULL;
+    }
+    mnthr_stats.bufpool_slab_bytes = 0;
+    mnthr_stats.bufpool_borrowed = 0;
+}
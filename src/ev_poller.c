@@ -1,9 +1,19 @@
 #include <assert.h>
 #include <errno.h>
 #include <math.h> /* INFINITY */
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include <sys/ioctl.h>
 
+#ifdef HAVE_CONFIG_H
+#   include "config.h"
+#endif
+
+#ifdef HAVE_SYS_EPOLL_H
+#   include <sys/epoll.h>
+#endif
+
 #define NO_PROFILE
 #include <mncommon/profile.h>
 
@@ -20,6 +30,7 @@ MEMDEBUG_DECLARE(mnthr_ev_poller);
 #include <mncommon/util.h>
 
 #include "mnthr_private.h"
+#include "mnthr_probes.h"
 
 //#define TRACE_VERBOSE
 //#define TRRET_DEBUG
@@ -113,9 +124,140 @@ static void ev_stat_cb(EV_P_ ev_stat *, int);
 
 static ev_idle eidle;
 static ev_timer etimer;
+static ev_timer otimer;
 static ev_prepare eprepare;
 static ev_check echeck;
 
+/* there are watcher changes libev has not yet passed to the kernel */
+static bool changes_pending = false;
+/* EVBACKEND_*, 0 - libev's choice */
+static unsigned ev_backend_flags = 0;
+
+
+/*
+ * libev does not expose its backend fd, so mnthr_get_poll_fd() gives
+ * an epoll(7) set of our own, mirroring the I/O watchers.  It is only
+ * maintained once asked for.
+ */
+#ifdef HAVE_SYS_EPOLL_H
+typedef struct _mirror_fd {
+    unsigned short nread;
+    unsigned short nwrite;
+} mirror_fd_t;
+
+static int mirror = -1;
+static mirror_fd_t *mirror_fds = NULL;
+static size_t mirror_sz = 0;
+
+
+static void
+mirror_update(int fd, int events, int incr)
+{
+    mirror_fd_t *m;
+    struct epoll_event ee;
+    bool was;
+    int saved_errno;
+
+    if (mirror == -1 || fd < 0) {
+        return;
+    }
+    if ((size_t)fd >= mirror_sz) {
+        size_t sz;
+
+        sz = MAX((size_t)fd + 1, mirror_sz * 2);
+        if ((mirror_fds = realloc(mirror_fds,
+                                  sz * sizeof(mirror_fd_t))) == NULL) {
+            FAIL("realloc");
+        }
+        memset(mirror_fds + mirror_sz,
+               0,
+               (sz - mirror_sz) * sizeof(mirror_fd_t));
+        mirror_sz = sz;
+    }
+
+    m = &mirror_fds[fd];
+    was = m->nread != 0 || m->nwrite != 0;
+    if (events & EV_READ) {
+        m->nread += incr;
+    }
+    if (events & EV_WRITE) {
+        m->nwrite += incr;
+    }
+    memset(&ee, 0, sizeof(ee));
+    ee.events = (m->nread != 0 ? EPOLLIN : 0) |
+                (m->nwrite != 0 ? EPOLLOUT : 0);
+    ee.data.fd = fd;
+
+    /* a closed fd drops out of the set by itself */
+    saved_errno = errno;
+    if (ee.events == 0) {
+        if (was) {
+            (void)epoll_ctl(mirror, EPOLL_CTL_DEL, fd, NULL);
+        }
+    } else if (!was) {
+        if (epoll_ctl(mirror, EPOLL_CTL_ADD, fd, &ee) != 0 &&
+            errno == EEXIST) {
+            (void)epoll_ctl(mirror, EPOLL_CTL_MOD, fd, &ee);
+        }
+    } else {
+        if (epoll_ctl(mirror, EPOLL_CTL_MOD, fd, &ee) != 0 &&
+            errno == ENOENT) {
+            (void)epoll_ctl(mirror, EPOLL_CTL_ADD, fd, &ee);
+        }
+    }
+    errno = saved_errno;
+}
+#else
+#   define mirror_update(fd, events, incr)
+#endif
+
+
+/*
+ * Watcher (de)registrations, accounted for in mnthr_stats.
+ */
+static void
+io_start(ev_io *w)
+{
+    if (!ev_is_active(w)) {
+        ++mnthr_stats.poller_reg_add;
+        mirror_update(w->fd, w->events, 1);
+        changes_pending = true;
+    }
+    ev_io_start(the_loop, w);
+}
+
+
+static void
+io_stop(ev_io *w)
+{
+    if (ev_is_active(w)) {
+        ++mnthr_stats.poller_reg_del;
+        mirror_update(w->fd, w->events, -1);
+        changes_pending = true;
+    }
+    ev_io_stop(the_loop, w);
+}
+
+
+static void
+stat_start(ev_stat *w)
+{
+    if (!ev_is_active(w)) {
+        ++mnthr_stats.poller_reg_add;
+    }
+    ev_stat_start(the_loop, w);
+}
+
+
+static void
+stat_stop(ev_stat *w)
+{
+    if (ev_is_active(w)) {
+        ++mnthr_stats.poller_reg_del;
+    }
+    ev_stat_stop(the_loop, w);
+}
+
 
 static uint64_t timecounter_now;
 
@@ -239,13 +381,13 @@ ev_item_destroy(ev_item_t **ev)
                    (*ev)->ev.io.fd,
                    EV_STR((*ev)->ev.io.events));
 #endif
-            ev_io_stop(the_loop, &(*ev)->ev.io);
+            io_stop(&(*ev)->ev.io);
         } else if ((*ev)->ty == EV_TYPE_STAT) {
 #ifdef TRACE_VERBOSE
             CTRACE(FRED("destroying ev_stat %s/%d"),
                    (*ev)->ev.stat.path, (*ev)->ev.stat.wd);
 #endif
-            ev_stat_stop(the_loop, &(*ev)->ev.stat);
+            stat_stop(&(*ev)->ev.stat);
             BYTES_DECREF(&(*ev)->stat_path);
         } else {
             FAIL("ev_item_destroy");
@@ -357,7 +499,7 @@ mnthr_stat_wait(mnthr_stat_t *st)
            st->ev->ev.stat.path,
            st->ev->ev.stat.wd);
 #endif
-    ev_stat_start(the_loop, &st->ev->ev.stat);
+    stat_start(&st->ev->ev.stat);
 
     /* wait for an event */
     me->co.state = CO_STATE_READ;
@@ -413,6 +555,13 @@ poller_ticks_absolute(uint64_t ticks)
 }
 
 
+uint64_t
+poller_ticks2nsec(uint64_t ticks)
+{
+    return ticks;
+}
+
+
 long double
 mnthr_ticks2sec(uint64_t ticks)
 {
@@ -472,14 +621,14 @@ poller_clear_event(mnthr_ctx_t *ctx)
                ev->ev.io.fd,
                EV_STR(ev->ev.io.events));
 #endif
-            ev_io_stop(the_loop, &ev->ev.io);
+            io_stop(&ev->ev.io);
         } else if (ev->ty == EV_TYPE_STAT) {
 #ifdef TRACE_VERBOSE
         CTRACE(FRED("clearing ev_stat %s/%d"),
                ev->ev.stat.path,
                ev->ev.stat.wd);
 #endif
-            ev_stat_stop(the_loop, &ev->ev.stat);
+            stat_stop(&ev->ev.stat);
         } else {
             FAIL("poller_clear_event");
         }
@@ -495,7 +644,7 @@ clear_event_io(ev_item_t *ev)
            ev->ev.io.fd,
            EV_STR(ev->ev.io.events));
 #endif
-    ev_io_stop(the_loop, &ev->ev.io);
+    io_stop(&ev->ev.io);
 }
 
 
@@ -506,7 +655,7 @@ clear_event_stat(ev_item_t *ev)
     CTRACE(FRED("clearing ev_stat %s/%d"),
            ev->ev.stat.path, ev->ev.stat.wd);
 #endif
-    ev_stat_stop(the_loop, &ev->ev.stat);
+    stat_stop(&ev->ev.stat);
 }
 
 
@@ -540,7 +689,8 @@ mnthr_get_rbuflen(int fd)
            ev->ev.io.fd,
            EV_STR(ev->ev.io.events));
 #endif
-    ev_io_start(the_loop, &ev->ev.io);
+    MNTHR_PROBE3(io_wait, me->co.id, fd, ev->ev.io.events);
+    io_start(&ev->ev.io);
 
     /* wait for an event */
     me->co.state = CO_STATE_READ;
@@ -560,6 +710,7 @@ mnthr_get_rbuflen(int fd)
     }
 
     sz = 0;
+    ++mnthr_stats.poller_ioctls;
     if ((res = ioctl(fd, FIONREAD, &sz)) != 0) {
         perror("ioctl");
         return -1;
@@ -598,7 +749,8 @@ mnthr_wait_for_read(int fd)
            ev->ev.io.fd,
            EV_STR(ev->ev.io.events));
 #endif
-    ev_io_start(the_loop, &ev->ev.io);
+    MNTHR_PROBE3(io_wait, me->co.id, fd, ev->ev.io.events);
+    io_start(&ev->ev.io);
 
     /* wait for an event */
     me->co.state = CO_STATE_READ;
@@ -647,7 +799,8 @@ mnthr_get_wbuflen(int fd)
            ev->ev.io.fd,
            EV_STR(ev->ev.io.events));
 #endif
-    ev_io_start(the_loop, &ev->ev.io);
+    MNTHR_PROBE3(io_wait, me->co.id, fd, ev->ev.io.events);
+    io_start(&ev->ev.io);
 
     /* wait for an event */
     me->co.state = CO_STATE_WRITE;
@@ -669,6 +822,7 @@ mnthr_get_wbuflen(int fd)
 
     sz = 0;
 #ifdef FIONSPACE
+    ++mnthr_stats.poller_ioctls;
     if ((res = ioctl(fd, FIONSPACE, &sz)) != 0) {
         return 1024*1024;
     }
@@ -709,7 +863,8 @@ mnthr_wait_for_write(int fd)
            ev->ev.io.fd,
            EV_STR(ev->ev.io.events));
 #endif
-    ev_io_start(the_loop, &ev->ev.io);
+    MNTHR_PROBE3(io_wait, me->co.id, fd, ev->ev.io.events);
+    io_start(&ev->ev.io);
 
     /* wait for an event */
     me->co.state = CO_STATE_WRITE;
@@ -754,7 +909,8 @@ mnthr_wait_for_events(int fd, int *events)
            ev->ev.io.fd,
            EV_STR(ev->ev.io.events));
 #endif
-    ev_io_start(the_loop, &ev->ev.io);
+    MNTHR_PROBE3(io_wait, me->co.id, fd, ev->ev.io.events);
+    io_start(&ev->ev.io);
 
     /* wait for an event */
     me->co.state = CO_STATE_OTHER_POLLER;
@@ -795,7 +951,7 @@ ev_io_cb(UNUSED EV_P_ ev_io *w, UNUSED int revents)
         CTRACE("no thread for FD %d filter %s "
                "using default [discard]...", w->fd,
                EV_STR(w->events));
-        ev_io_stop(the_loop, w);
+        io_stop(w);
 
     } else {
         ev = ctx->pdata.ev;
@@ -856,7 +1012,7 @@ ev_stat_cb(UNUSED EV_P_ ev_stat *w, UNUSED int revents)
 
     if (ctx == NULL) {
         CTRACE("no thread for stat path %s using default [discard]...", w->path);
-        ev_stat_stop(the_loop, w);
+        stat_stop(w);
 
     } else {
         ev = ctx->pdata.ev;
@@ -909,6 +1065,154 @@ mnthr_loop(void)
 }
 
 
+/**
+ * A single iteration of mnthr_loop(), waiting for events no longer than
+ * usec, UINT64_MAX - until the next one.  Return non-zero once the loop
+ * is done (mnthr_shutdown()).
+ */
+int
+mnthr_loop_once(uint64_t usec)
+{
+    if (mnthr_flags & CO_FLAG_SHUTDOWN) {
+        return 1;
+    }
+    PROFILE_START(mnthr_sched0_p);
+    if (usec == 0) {
+        (void)ev_run(the_loop, EVRUN_NOWAIT);
+    } else if (usec == UINT64_MAX) {
+        (void)ev_run(the_loop, EVRUN_ONCE);
+    } else {
+        ev_timer_set(&otimer, (ev_tstamp)usec / 1000000., 0.);
+        ev_timer_start(the_loop, &otimer);
+        (void)ev_run(the_loop, EVRUN_ONCE);
+        ev_timer_stop(the_loop, &otimer);
+    }
+    PROFILE_STOP(mnthr_sched0_p);
+    return (mnthr_flags & CO_FLAG_SHUTDOWN) ? 1 : 0;
+}
+
+
+/**
+ * An fd that is readable when there are I/O events for the loop, to be
+ * called before the loop is first run.  -1 if there is none on this
+ * platform.
+ */
+int
+mnthr_get_poll_fd(void)
+{
+#ifdef HAVE_SYS_EPOLL_H
+    if (mirror == -1) {
+        if ((mirror = epoll_create1(EPOLL_CLOEXEC)) == -1) {
+            TRRET(MNTHR_GET_POLL_FD + 1);
+        }
+    }
+    return mirror;
+#else
+    return -1;
+#endif
+}
+
+
+bool
+poller_changes_pending(void)
+{
+    return changes_pending;
+}
+
+
+static struct {
+    const char *name;
+    unsigned flags;
+} ev_backends[] = {
+    {"select", EVBACKEND_SELECT},
+    {"poll", EVBACKEND_POLL},
+    {"epoll", EVBACKEND_EPOLL},
+    {"kqueue", EVBACKEND_KQUEUE},
+    {"devpoll", EVBACKEND_DEVPOLL},
+    {"port", EVBACKEND_PORT},
+#if EV_VERSION_MAJOR > 4 || (EV_VERSION_MAJOR == 4 && EV_VERSION_MINOR >= 27)
+    {"linuxaio", EVBACKEND_LINUXAIO},
+#endif
+#if EV_VERSION_MAJOR > 4 || (EV_VERSION_MAJOR == 4 && EV_VERSION_MINOR >= 31)
+    {"io_uring", EVBACKEND_IOURING},
+    {"iouring", EVBACKEND_IOURING},
+#endif
+};
+
+
+/**
+ * Pick the libev backend(s) for the loop created by mnthr_init(): a
+ * comma separated list of backend names, or of EVBACKEND_* flags as a
+ * number, of which libev takes the first that works.  "ev" or an empty
+ * string leave the choice to libev.
+ */
+int
+mnthr_set_backend(const char *spec)
+{
+    unsigned flags;
+    const char *p;
+
+    if (mnthr_flags & CO_FLAG_INITIALIZED) {
+        TRRET(MNTHR_SET_BACKEND + 1);
+    }
+
+    flags = 0;
+    for (p = spec; *p != '\0'; ) {
+        size_t i, len;
+
+        len = strcspn(p, ",");
+        if (len == 0 || (len == 2 && strncmp(p, "ev", 2) == 0)) {
+            /* libev's own choice */
+        } else if (*p >= '0' && *p <= '9') {
+            flags |= (unsigned)strtoul(p, NULL, 0);
+        } else {
+            for (i = 0; i < countof(ev_backends); ++i) {
+                if (strlen(ev_backends[i].name) == len &&
+                    strncmp(p, ev_backends[i].name, len) == 0) {
+                    flags |= ev_backends[i].flags;
+                    break;
+                }
+            }
+            if (i == countof(ev_backends)) {
+                TRRET(MNTHR_SET_BACKEND + 2);
+            }
+        }
+        p += len;
+        if (*p == ',') {
+            ++p;
+        }
+    }
+
+    if (flags & ~ev_supported_backends()) {
+        TRRET(MNTHR_SET_BACKEND + 3);
+    }
+    ev_backend_flags = flags;
+    return 0;
+}
+
+
+/**
+ * The name of the backend the loop runs on, NULL before mnthr_init().
+ */
+const char *
+mnthr_get_backend(void)
+{
+    unsigned flags;
+    size_t i;
+
+    if (!(mnthr_flags & CO_FLAG_INITIALIZED)) {
+        return NULL;
+    }
+    flags = ev_backend(the_loop);
+    for (i = 0; i < countof(ev_backends); ++i) {
+        if (ev_backends[i].flags == flags) {
+            return ev_backends[i].name;
+        }
+    }
+    return "ev";
+}
+
+
 static void
 _idle_cb(UNUSED EV_P_ UNUSED ev_idle *w, UNUSED int revents)
 {
@@ -929,8 +1233,12 @@ _prepare_cb(UNUSED EV_P_ UNUSED ev_prepare *w, UNUSED int revents)
     mnbtrie_node_t *node;
     mnthr_ctx_t *ctx = NULL;
 
+    ++mnthr_stats.poller_iterations;
+
     if (!(mnthr_flags & CO_FLAG_SHUTDOWN)) {
-        timecounter_now = (uint64_t)(ev_now(the_loop) * 1000000000.);
+        if (!(mnthr_flags & CO_FLAG_SIMULATION)) {
+            timecounter_now = (uint64_t)(ev_now(the_loop) * 1000000000.);
+        }
 
 #ifdef TRACE_VERBOSE
         CTRACE(FRED("Sifting sleepq ..."));
@@ -938,6 +1246,11 @@ _prepare_cb(UNUSED EV_P_ UNUSED ev_prepare *w, UNUSED int revents)
         /* this will make sure there are no expired ctxes in the sleepq */
         poller_sift_sleepq();
 
+        if ((mnthr_flags & CO_FLAG_SIMULATION) &&
+            sim_advance(&timecounter_now)) {
+            poller_sift_sleepq();
+        }
+
         /* get the first to wake sleeping mnthr */
         if ((node = BTRIE_MIN(&the_sleepq)) != NULL) {
             ev_tstamp secs;
@@ -945,13 +1258,15 @@ _prepare_cb(UNUSED EV_P_ UNUSED ev_prepare *w, UNUSED int revents)
             ctx = node->value;
             assert(ctx != NULL);
 
-            if (ctx->expire_ticks > timecounter_now) {
+            if (ctx->expire_ticks > timecounter_now &&
+                !(mnthr_flags & CO_FLAG_SIMULATION)) {
                 secs = (ev_tstamp)(ctx->expire_ticks - timecounter_now) /
                     1000000000.;
             } else {
                 /*
                  * some time has elapsed after the call to
-                 * sift_sleepq() that made an event expire.
+                 * sift_sleepq() that made an event expire, or the
+                 * virtual clock is on, and we only poll for I/O.
                  */
                 secs =   0.00000095367431640625;
             }
@@ -961,6 +1276,7 @@ _prepare_cb(UNUSED EV_P_ UNUSED ev_prepare *w, UNUSED int revents)
 #endif
             etimer.repeat = secs;
             ev_timer_again(the_loop, &etimer);
+            ++mnthr_stats.poller_timer_updates;
         } else {
 #ifdef TRACE_VERBOSE
             CTRACE("no wait");
@@ -969,9 +1285,17 @@ _prepare_cb(UNUSED EV_P_ UNUSED ev_prepare *w, UNUSED int revents)
             //etimer.repeat = INFINITY;
             etimer.repeat = 59.0; /* <MAX_BLOCKTIME */
             ev_timer_again(the_loop, &etimer);
+            ++mnthr_stats.poller_timer_updates;
             //ev_timer_stop(the_loop, &etimer);
             //ev_unref(the_loop);
         }
+
+        if (mnthr_metrics != NULL) {
+            metrics_publish();
+        }
+
+        /* libev passes them on right after the prepare watchers */
+        changes_pending = false;
     } else {
         CTRACE("breaking the loop");
         ev_break(the_loop, EVBREAK_ALL);
@@ -989,11 +1313,24 @@ _check_cb(UNUSED EV_P_ UNUSED ev_check *w, UNUSED int revents)
 #ifdef TRACE_VERBOSE
     CTRACE("ev_pending_count=%d", npending);
 #endif
+    ++mnthr_stats.poller_wakeups;
+    if (npending > 0) {
+        mnthr_stats.poller_events += npending;
+        mnthr_stats.poller_events_max =
+            MAX(mnthr_stats.poller_events_max, (uint64_t)npending);
+    } else {
+        ++mnthr_stats.poller_empty_wakeups;
+    }
     if (npending <= 0) {
         //CTRACE("Breaking loop? ...");
         //ev_break(the_loop, EVBREAK_ALL);
     }
-    timecounter_now = (uint64_t)(ev_now(the_loop) * 1000000000.);
+    if (mnthr_flags & CO_FLAG_SIMULATION) {
+        /* our own timer does not count */
+        sim_polled(npending - (ev_is_pending(&etimer) ? 1 : 0) <= 0);
+    } else {
+        timecounter_now = (uint64_t)(ev_now(the_loop) * 1000000000.);
+    }
 
     //CTRACE("revents=%08x", revents);
 }
@@ -1021,7 +1358,18 @@ poller_init(void)
     ev_prepare *prepare = &eprepare;
     ev_check *check = &echeck;
 
-    the_loop = ev_loop_new(EVFLAG_NOSIGMASK);
+    if ((the_loop = ev_loop_new(EVFLAG_NOSIGMASK |
+                                ev_backend_flags)) == NULL) {
+        if (ev_backend_flags == 0) {
+            FAIL("ev_loop_new");
+        }
+        /* not to leave the process without a loop over a tuning knob */
+        CTRACE("backends %08x failed, falling back to the default",
+               ev_backend_flags);
+        if ((the_loop = ev_loop_new(EVFLAG_NOSIGMASK)) == NULL) {
+            FAIL("ev_loop_new");
+        }
+    }
     //CTRACE("v %d.%d", ev_version_major(), ev_version_minor());
     //CTRACE("ev_supported_backends=%08x", ev_supported_backends());
     //CTRACE("ev_recommended_backends=%08x", ev_recommended_backends());
@@ -1033,11 +1381,16 @@ poller_init(void)
     //CTRACE("ev_now=%lf", ev_now());
 #endif
     ev_now_update(the_loop);
-    timecounter_now = (uint64_t)(ev_now(the_loop) * 1000000000.);
+    if (mnthr_flags & CO_FLAG_SIMULATION) {
+        timecounter_now = MNTHR_SIM_EPOCH;
+    } else {
+        timecounter_now = (uint64_t)(ev_now(the_loop) * 1000000000.);
+    }
 
     ev_idle_init(idle, _idle_cb);
     ev_timer_init(timer, _timer_cb, 0.0, 0.0);
     ev_timer_again(the_loop, timer);
+    ev_timer_init(&otimer, _timer_cb, 0.0, 0.0);
     ev_prepare_init(prepare, _prepare_cb);
     ev_prepare_start(the_loop, prepare);
     ev_check_init(check, _check_cb);
@@ -1057,4 +1410,13 @@ poller_fini(void)
 {
     hash_fini(&events);
     ev_loop_destroy(the_loop);
+#ifdef HAVE_SYS_EPOLL_H
+    if (mirror != -1) {
+        (void)close(mirror);
+        mirror = -1;
+    }
+    free(mirror_fds);
+    mirror_fds = NULL;
+    mirror_sz = 0;
+#endif
 }
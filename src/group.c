@@ -0,0 +1,314 @@
+/**
+ * Scheduling groups.
+ *
+ * Every thread belongs to a group, the default one unless set
+ * otherwise, and threads inherit the group of the thread that spawned
+ * them.  The CPU time of each slice is charged to the group of the
+ * thread, and scaled by the group's weight into its virtual time.
+ *
+ * In the fair mode, the threads that poller_sift_sleepq() finds
+ * runnable are not resumed in the sleepq order, but queued per group,
+ * and picked one at a time from the group with the smallest virtual
+ * time (weighted fair queueing).  Once the batch has run for longer
+ * than its budget, the rest is put back to the sleepq to run after the
+ * next poll, so that a busy group cannot hold the loop either.
+ */
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_CONFIG_H
+#   include "config.h"
+#endif
+
+#ifdef DO_MEMDEBUG
+#include <mncommon/memdebug.h>
+MEMDEBUG_DECLARE(mnthr_group);
+#endif
+
+#include <mncommon/btrie.h>
+
+#include "mnthr_private.h"
+#include "mnthr_probes.h"
+
+//#define TRACE_VERBOSE
+#include "diag.h"
+#include <mncommon/dumpm.h>
+
+
+struct _mnthr_group {
+    char name[32];
+    unsigned weight;
+    /* CPU time divided by weight, the smallest runs first */
+    uint64_t vtime;
+    mnthr_group_stats_t stats;
+    STQUEUE(_mnthr_ctx, runq);
+    DTQUEUE_ENTRY(_mnthr_group, active_link);
+};
+
+uint64_t fair_batch_nsec = 0;
+static struct _mnthr_group default_group;
+/* groups with runnable threads in the fair mode */
+static DTQUEUE(_mnthr_group, active);
+static uint64_t vtime_floor = 0;
+struct _mnthr_group *slice_group = NULL;
+
+
+static void
+group_init(mnthr_group_t *g, const char *name, unsigned weight)
+{
+    strncpy(g->name, name, sizeof(g->name) - 1);
+    g->name[sizeof(g->name) - 1] = '\0';
+    g->weight = weight != 0 ? weight : 1;
+    g->vtime = vtime_floor;
+    memset(&g->stats, 0, sizeof(g->stats));
+    STQUEUE_INIT(&g->runq);
+    DTQUEUE_ENTRY_INIT(active_link, g);
+}
+
+
+void
+groups_init(void)
+{
+    group_init(&default_group, "default", MNTHR_GROUP_WEIGHT_DEFAULT);
+    DTQUEUE_INIT(&active);
+}
+
+
+mnthr_group_t *
+mnthr_group_new(const char *name, unsigned weight)
+{
+    mnthr_group_t *g;
+
+    if ((g = malloc(sizeof(mnthr_group_t))) == NULL) {
+        FAIL("malloc");
+    }
+    group_init(g, name != NULL ? name : "", weight);
+    return g;
+}
+
+
+static int
+group_detach(mnthr_ctx_t *ctx, void *udata)
+{
+    if (ctx->group == udata) {
+        group_set(ctx, NULL);
+    }
+    return 0;
+}
+
+
+/**
+ * Destroy the group, its threads move to the default group.
+ */
+void
+mnthr_group_destroy(mnthr_group_t *g)
+{
+    mnthr_ctx_t *ctx;
+
+    assert(g != &default_group);
+
+    (void)ctxes_traverse(group_detach, g);
+    if (slice_group == g) {
+        /* the rest of this slice goes to the default group */
+        slice_group = NULL;
+    }
+
+    if (STQUEUE_HEAD(&g->runq) != NULL) {
+        /* destroyed by a thread in the middle of a fair batch */
+        DTQUEUE_REMOVE(&active, active_link, g);
+        DTQUEUE_ENTRY_FINI(active_link, g);
+        while ((ctx = STQUEUE_HEAD(&g->runq)) != NULL) {
+            STQUEUE_DEQUEUE(&g->runq, runq_link);
+            STQUEUE_ENTRY_FINI(runq_link, ctx);
+            if (STQUEUE_HEAD(&default_group.runq) == NULL) {
+                default_group.vtime = MAX(default_group.vtime, vtime_floor);
+                DTQUEUE_ENQUEUE(&active, active_link, &default_group);
+            }
+            STQUEUE_ENQUEUE(&default_group.runq, runq_link, ctx);
+        }
+    }
+    free(g);
+}
+
+
+void
+mnthr_group_set_weight(mnthr_group_t *g, unsigned weight)
+{
+    if (g == NULL) {
+        g = &default_group;
+    }
+    g->weight = weight != 0 ? weight : 1;
+}
+
+
+const char *
+mnthr_group_name(const mnthr_group_t *g)
+{
+    return g != NULL ? g->name : default_group.name;
+}
+
+
+/**
+ * Per group counters, g NULL is the default group.
+ */
+void
+mnthr_group_get_stats(const mnthr_group_t *g, mnthr_group_stats_t *stats)
+{
+    if (g == NULL) {
+        g = &default_group;
+    }
+    *stats = g->stats;
+}
+
+
+void
+mnthr_set_group(mnthr_ctx_t *ctx, mnthr_group_t *g)
+{
+    group_set(ctx, g);
+}
+
+
+mnthr_group_t *
+mnthr_get_group(mnthr_ctx_t *ctx)
+{
+    return ctx->group;
+}
+
+
+/**
+ * Turn the fair mode on with a budget of usec per loop iteration, or
+ * off with 0.
+ */
+void
+mnthr_set_fair_sched(uint64_t usec)
+{
+    fair_batch_nsec = usec * 1000;
+}
+
+
+void
+group_set(mnthr_ctx_t *ctx, mnthr_group_t *g)
+{
+    if (g == &default_group) {
+        g = NULL;
+    }
+    /* the default group does not count its threads */
+    if (ctx->group != NULL) {
+        --ctx->group->stats.nthreads;
+    }
+    ctx->group = g;
+    if (g != NULL) {
+        ++g->stats.nthreads;
+    }
+}
+
+
+/**
+ * Charge a slice of elapsed nsec to the group.
+ */
+void
+group_account(mnthr_group_t *g, uint64_t elapsed)
+{
+    if (g == NULL) {
+        g = &default_group;
+    }
+    g->stats.cpu_nsec += elapsed;
+    ++g->stats.slices;
+    g->vtime += elapsed / g->weight;
+}
+
+
+static void
+group_enqueue(mnthr_ctx_t *ctx, UNUSED uint64_t now)
+{
+    mnthr_group_t *g;
+
+    if (ctx->expire_ticks > MNTHR_SLEEP_RESUME_NOW) {
+        MNTHR_PROBE3(timer_fire,
+                     ctx->co.id,
+                     CO_NAME(ctx),
+                     now - ctx->expire_ticks);
+    }
+    ctx->expire_ticks = MNTHR_SLEEP_UNDEFINED;
+
+    g = ctx->group != NULL ? ctx->group : &default_group;
+    if (STQUEUE_HEAD(&g->runq) == NULL) {
+        /* no credit for the time it was idle */
+        g->vtime = MAX(g->vtime, vtime_floor);
+        DTQUEUE_ENQUEUE(&active, active_link, g);
+    }
+    STQUEUE_ENQUEUE(&g->runq, runq_link, ctx);
+}
+
+
+/**
+ * Queue an expired sleepq bucket owner and its bucket.
+ */
+void
+group_enqueue_bucket(mnthr_ctx_t *ctx, uint64_t now)
+{
+    mnthr_waitq_t bucket;
+    mnthr_ctx_t *bctx;
+
+    bucket = ctx->sleepq_bucket;
+    DTQUEUE_FINI(&ctx->sleepq_bucket);
+    group_enqueue(ctx, now);
+
+    while ((bctx = DTQUEUE_HEAD(&bucket)) != NULL) {
+        DTQUEUE_DEQUEUE(&bucket, sleepq_link);
+        DTQUEUE_ENTRY_FINI(sleepq_link, bctx);
+        group_enqueue(bctx, now);
+    }
+}
+
+
+/**
+ * Run the queued threads, the group with the smallest virtual time
+ * first.
+ */
+void
+group_run(void)
+{
+    uint64_t start;
+
+    start = monotonic_nsec();
+
+    while (!DTQUEUE_EMPTY(&active)) {
+        mnthr_group_t *g, *gg;
+        mnthr_ctx_t *ctx;
+
+        g = DTQUEUE_HEAD(&active);
+        for (gg = DTQUEUE_NEXT(active_link, g);
+             gg != NULL;
+             gg = DTQUEUE_NEXT(active_link, gg)) {
+            if (gg->vtime < g->vtime) {
+                g = gg;
+            }
+        }
+        vtime_floor = g->vtime;
+
+        ctx = STQUEUE_HEAD(&g->runq);
+        STQUEUE_DEQUEUE(&g->runq, runq_link);
+        STQUEUE_ENTRY_FINI(runq_link, ctx);
+        if (STQUEUE_HEAD(&g->runq) == NULL) {
+            DTQUEUE_REMOVE(&active, active_link, g);
+            DTQUEUE_ENTRY_FINI(active_link, g);
+        }
+
+        if (monotonic_nsec() - start > fair_batch_nsec) {
+            /* out of budget, let the poller run */
+            ctx->expire_ticks = MNTHR_SLEEP_RESUME_NOW;
+            ctx->sleepq_enqueue(ctx);
+            ++g->stats.deferred;
+            continue;
+        }
+
+        if (poller_resume(ctx) != 0) {
+#ifdef TRACE_VERBOSE
+            CTRACE("Could not resume co %ld, discarding ...",
+                   (long)ctx->co.id);
+#endif
+        }
+    }
+}
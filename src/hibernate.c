@@ -0,0 +1,177 @@
+/**
+ * Stack hibernation.
+ *
+ * A thread parked for longer than the hibernation threshold gets its
+ * stack pages given back to the system (madvise(2) MADV_DONTNEED), the
+ * mapping itself is kept, so that the stack stays at the same address.
+ * What is released depends on the policy:
+ *
+ *  - MNTHR_HIBERNATE_TRIM: only the pages below the saved stack
+ *    pointer, that are dead until the thread runs again.  Always safe.
+ *
+ *  - MNTHR_HIBERNATE_COPY: the live part of the stack, from the saved
+ *    stack pointer up, is copied into a heap buffer of its exact size,
+ *    and the whole stack is released.  The copy is put back right
+ *    before the thread is resumed.  Threads parked on a condition, a
+ *    signal, a join and such have objects on their stacks that other
+ *    threads link to and write into (waitq links, batch items), so only
+ *    threads waiting for I/O or sleeping are copied, the others are
+ *    trimmed.
+ *
+ * The parked threads are swept from the loop at most every
+ * HIBERNATE_SWEEP_NSEC.
+ */
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#ifdef HAVE_CONFIG_H
+#   include "config.h"
+#endif
+
+#ifdef DO_MEMDEBUG
+#include <mncommon/memdebug.h>
+MEMDEBUG_DECLARE(mnthr_hibernate);
+#endif
+
+#include <mncommon/btrie.h>
+
+#include "mnthr_private.h"
+
+//#define TRACE_VERBOSE
+#include "diag.h"
+#include <mncommon/dumpm.h>
+
+/* the x86-64 red zone, and enough for others */
+#define HIBERNATE_RED_ZONE 128
+#define HIBERNATE_SWEEP_NSEC 100000000ul
+
+uint64_t hibernate_idle_nsec = 0;
+static int hibernate_policy = MNTHR_HIBERNATE_TRIM;
+static uint64_t last_sweep = 0;
+
+
+/**
+ * Hibernate threads parked for longer than msec, 0 - never.
+ */
+int
+mnthr_set_hibernation(uint64_t msec, int policy)
+{
+#ifndef MNTHR_UC_SP
+    if (msec != 0) {
+        /* the saved stack pointer is not known on this platform */
+        TRRET(MNTHR_SET_HIBERNATION + 1);
+    }
+#endif
+    if (policy != MNTHR_HIBERNATE_TRIM && policy != MNTHR_HIBERNATE_COPY) {
+        TRRET(MNTHR_SET_HIBERNATION + 2);
+    }
+    hibernate_idle_nsec = msec * 1000000;
+    hibernate_policy = policy;
+    return 0;
+}
+
+
+#ifdef MNTHR_UC_SP
+static void
+hibernate(mnthr_ctx_t *ctx)
+{
+    uintptr_t lo, hi, sp, live;
+
+    lo = (uintptr_t)ctx->co.stack + PAGE_SIZE;
+    hi = (uintptr_t)ctx->co.stack + ctx->co.uc.uc_stack.ss_size;
+    sp = MNTHR_UC_SP(&ctx->co.uc);
+    if (sp < lo + HIBERNATE_RED_ZONE || sp > hi) {
+        return;
+    }
+    live = sp - HIBERNATE_RED_ZONE;
+
+    if (hibernate_policy == MNTHR_HIBERNATE_COPY &&
+        ((ctx->co.state & (CO_STATE_READ | CO_STATE_WRITE)) ||
+         ctx->co.state == CO_STATE_SLEEP)) {
+        if ((ctx->hibernated = malloc(hi - live)) == NULL) {
+            FAIL("malloc");
+        }
+        memcpy(ctx->hibernated, (void *)live, hi - live);
+        ctx->hibernated_sz = hi - live;
+        mnthr_stats.hibernated_bytes += hi - live;
+    } else {
+        /* keep the pages the live part is in */
+        hi = live & ~((uintptr_t)PAGE_SIZE - 1);
+    }
+
+    if (hi > lo) {
+        (void)madvise((void *)lo, hi - lo, MADV_DONTNEED);
+        mnthr_stats.hibernate_released_bytes += hi - lo;
+    }
+    ctx->hibernating = true;
+    ++mnthr_stats.hibernations;
+    ++mnthr_stats.hibernated;
+}
+
+
+static int
+hibernate_cb(mnthr_ctx_t *ctx, void *udata)
+{
+    uint64_t now = *(uint64_t *)udata;
+
+    if (!ctx->hibernating &&
+        ctx->co.id != -1 &&
+        ctx->co.stack != MAP_FAILED &&
+        (ctx->co.state & CO_STATE_RESUMABLE) &&
+        ctx->parked_at != 0 &&
+        now - ctx->parked_at > hibernate_idle_nsec) {
+        hibernate(ctx);
+    }
+    return 0;
+}
+#endif
+
+
+void
+hibernate_sweep(void)
+{
+#ifdef MNTHR_UC_SP
+    uint64_t now;
+
+    now = monotonic_nsec();
+    if (now - last_sweep < HIBERNATE_SWEEP_NSEC) {
+        return;
+    }
+    last_sweep = now;
+    (void)ctxes_traverse(hibernate_cb, &now);
+#endif
+}
+
+
+/**
+ * Called right before ctx is resumed.
+ */
+void
+hibernate_wakeup(mnthr_ctx_t *ctx)
+{
+    if (ctx->hibernated != NULL) {
+        void *hi;
+
+        hi = (char *)ctx->co.stack + ctx->co.uc.uc_stack.ss_size;
+        memcpy((char *)hi - ctx->hibernated_sz,
+               ctx->hibernated,
+               ctx->hibernated_sz);
+        hibernate_discard(ctx);
+    }
+    ctx->hibernating = false;
+    --mnthr_stats.hibernated;
+}
+
+
+void
+hibernate_discard(mnthr_ctx_t *ctx)
+{
+    if (ctx->hibernated != NULL) {
+        mnthr_stats.hibernated_bytes -= ctx->hibernated_sz;
+        free(ctx->hibernated);
+        ctx->hibernated = NULL;
+        ctx->hibernated_sz = 0;
+    }
+}
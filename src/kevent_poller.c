@@ -2,6 +2,7 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <math.h>
+#include <string.h>
 #include <unistd.h>
 
 #include <sys/types.h>
@@ -20,6 +21,7 @@ MEMDEBUG_DECLARE(mnthr_kevent_poller);
 #include <mncommon/btrie.h>
 
 #include "mnthr_private.h"
+#include "mnthr_probes.h"
 
 //#define TRACE_VERBOSE
 #include "diag.h"
@@ -56,6 +58,9 @@ static ssize_t event_count = 0;
  */
 static ssize_t event_max = 0;
 
+/* the earliest thread resume time, for mnthr_stats */
+static uint64_t loop_deadline = 0;
+
 static uint64_t nsec_zero, nsec_now;
 UNUSED static uint64_t timecounter_zero, timecounter_now;
 #ifdef USE_TSC
@@ -120,7 +125,9 @@ static void
 update_now(void)
 {
 #ifdef USE_TSC
-    timecounter_now = rdtsc();
+    if (!(mnthr_flags & CO_FLAG_SIMULATION)) {
+        timecounter_now = rdtsc();
+    }
     /* do it here so that get_now() returns precomputed value */
     nsec_now = nsec_zero +
         (uint64_t)(((long double)
@@ -131,6 +138,9 @@ update_now(void)
 #else
     struct timespec ts;
 
+    if (mnthr_flags & CO_FLAG_SIMULATION) {
+        return;
+    }
     if (clock_gettime(CLOCK_REALTIME_PRECISE, &ts) != 0) {
         FAIL("clock_gettime");
     }
@@ -149,6 +159,16 @@ wallclock_init(void)
 {
     struct timespec ts;
 
+    if (mnthr_flags & CO_FLAG_SIMULATION) {
+#ifdef USE_TSC
+        timecounter_zero = MNTHR_SIM_EPOCH;
+#endif
+        timecounter_now = MNTHR_SIM_EPOCH;
+        nsec_zero = MNTHR_SIM_EPOCH;
+        nsec_now = MNTHR_SIM_EPOCH;
+        return;
+    }
+
 #ifdef USE_TSC
     timecounter_zero = rdtsc();
 #endif
@@ -204,6 +224,18 @@ mnthr_msec2ticks(uint64_t msec)
 }
 
 
+uint64_t
+poller_ticks2nsec(uint64_t ticks)
+{
+#ifdef USE_TSC
+    return (uint64_t)((long double)ticks * 1000000000. /
+                      (long double)timecounter_freq);
+#else
+    return ticks;
+#endif
+}
+
+
 long double
 mnthr_ticks2sec(uint64_t ticks)
 {
@@ -277,6 +309,11 @@ new_event(int fd, int filter, int flags, int fflags, intptr_t data, void *udata)
         FAIL("array_incr");
     }
     EV_SET(kev, fd, filter, flags, fflags, data, udata);
+    if (flags & EV_ADD) {
+        ++mnthr_stats.poller_reg_add;
+    } else if (flags & EV_DELETE) {
+        ++mnthr_stats.poller_reg_del;
+    }
     return kev;
 }
 
@@ -422,6 +459,7 @@ mnthr_get_rbuflen(int fd)
 
     me->pdata.kev.ident = fd;
     me->pdata.kev.filter = EVFILT_READ;
+    MNTHR_PROBE3(io_wait, me->co.id, fd, EVFILT_READ);
 
     /* wait for an event */
     me->co.state = CO_STATE_READ;
@@ -460,6 +498,7 @@ mnthr_wait_for_read(int fd)
 
     me->pdata.kev.ident = fd;
     me->pdata.kev.filter = EVFILT_READ;
+    MNTHR_PROBE3(io_wait, me->co.id, fd, EVFILT_READ);
 
     /* wait for an event */
     me->co.state = CO_STATE_READ;
@@ -498,6 +537,7 @@ mnthr_get_wbuflen(int fd)
 
     me->pdata.kev.ident = fd;
     me->pdata.kev.filter = EVFILT_WRITE;
+    MNTHR_PROBE3(io_wait, me->co.id, fd, EVFILT_WRITE);
 
     /* wait for an event */
     me->co.state = CO_STATE_WRITE;
@@ -537,6 +577,7 @@ mnthr_wait_for_write(int fd)
 
     me->pdata.kev.ident = fd;
     me->pdata.kev.filter = EVFILT_WRITE;
+    MNTHR_PROBE3(io_wait, me->co.id, fd, EVFILT_WRITE);
 
     /* wait for an event */
     me->co.state = CO_STATE_WRITE;
@@ -578,6 +619,7 @@ mnthr_wait_for_events(int fd, int *events)
 
     me->pdata.kev.ident = fd;
     me->pdata.kev.filter = 0; /* special case */
+    MNTHR_PROBE3(io_wait, me->co.id, fd, 0);
 
     /* wait for an event */
     me->co.state = CO_STATE_OTHER_POLLER;
@@ -604,258 +646,333 @@ mnthr_wait_for_events(int fd, int *events)
 }
 
 
-/**
- * Combined threads and events loop.
- *
- * The loop processes first threads, then events. It sleeps until the
- * earliest thread resume time, or an I/O event occurs.
- *
+/*
+ * One iteration of the loop: sift the sleepq, and wait for events until
+ * the earliest thread resume time, but no longer than maxtmout if given.
+ * Return non-zero when the loop is done.
  */
-int
-mnthr_loop(void)
+static int
+poller_iteration(const struct timespec *maxtmout, int *pkevres)
 {
     int kevres = 0;
     struct kevent *kev = NULL;
-    struct timespec timeout, *tmout;
+    struct timespec timeout, *tmout, *owntmout;
     mnarray_iter_t it;
+    mnbtrie_node_t *trn;
+    mnthr_ctx_t *ctx = NULL;
 
-    PROFILE_START(mnthr_sched0_p);
-
-    while (!(mnthr_flags & CO_FLAG_SHUTDOWN)) {
-        mnbtrie_node_t *trn;
-        mnthr_ctx_t *ctx = NULL;
-        //sleep(1);
-        update_now();
+    //sleep(1);
+    update_now();
+    ++mnthr_stats.poller_iterations;
 
 #ifdef TRACE_VERBOSE
-        CTRACE(FRED("Sifting sleepq ..."));
+    CTRACE(FRED("Sifting sleepq ..."));
 #endif
-        /* this will make sure there are no expired ctxes in the sleepq */
+    /* this will make sure there are no expired ctxes in the sleepq */
+    poller_sift_sleepq();
+
+    if ((mnthr_flags & CO_FLAG_SIMULATION) &&
+        sim_advance(&timecounter_now)) {
+        update_now();
         poller_sift_sleepq();
+    }
+
+    if (mnthr_metrics != NULL) {
+        metrics_publish();
+    }
 
-        /* get the first to wake up */
-        if ((trn = BTRIE_MIN(&the_sleepq)) != NULL) {
-            ctx = trn->value;
-            assert(ctx != NULL);
+    /* get the first to wake up */
+    if ((trn = BTRIE_MIN(&the_sleepq)) != NULL) {
+        ctx = trn->value;
+        assert(ctx != NULL);
 
-            if (ctx->expire_ticks > timecounter_now) {
+        /* there is no timer to reprogram, count deadline changes */
+        if (ctx->expire_ticks != loop_deadline) {
+            loop_deadline = ctx->expire_ticks;
+            ++mnthr_stats.poller_timer_updates;
+        }
+
+        if (ctx->expire_ticks > timecounter_now &&
+            !(mnthr_flags & CO_FLAG_SIMULATION)) {
 #ifdef USE_TSC
-                long double secs, isecs, nsecs;
-
-                secs = (long double)(ctx->expire_ticks - timecounter_now) /
-                    (long double)timecounter_freq;
-                nsecs = modfl(secs, &isecs);
-                //CTRACE("secs=%Lf isecs=%Lf nsecs=%Lf", secs, isecs, nsecs);
-                timeout.tv_sec = isecs;
-                timeout.tv_nsec = nsecs * 1000000000;
+            long double secs, isecs, nsecs;
+
+            secs = (long double)(ctx->expire_ticks - timecounter_now) /
+                (long double)timecounter_freq;
+            nsecs = modfl(secs, &isecs);
+            //CTRACE("secs=%Lf isecs=%Lf nsecs=%Lf", secs, isecs, nsecs);
+            timeout.tv_sec = isecs;
+            timeout.tv_nsec = nsecs * 1000000000;
 #else
-                int64_t diff;
+            int64_t diff;
 
-                diff = ctx->expire_ticks - timecounter_now;
-                timeout.tv_sec = diff / 1000000000;
-                timeout.tv_nsec = diff % 1000000000;
+            diff = ctx->expire_ticks - timecounter_now;
+            timeout.tv_sec = diff / 1000000000;
+            timeout.tv_nsec = diff % 1000000000;
 #endif
-            } else {
-                /*
-                 * some time has elapsed after the call to
-                 * sift_sleepq() that made an event expire.
-                 */
-                timeout.tv_sec = 0;
-                //timeout.tv_nsec = 100000000; /* 100 msec */
-                timeout.tv_nsec = 0;
-            }
-            tmout = &timeout;
         } else {
-            tmout = NULL;
+            /*
+             * some time has elapsed after the call to
+             * sift_sleepq() that made an event expire, or the
+             * virtual clock is on, and we only poll for I/O.
+             */
+            timeout.tv_sec = 0;
+            //timeout.tv_nsec = 100000000; /* 100 msec */
+            timeout.tv_nsec = 0;
         }
+        tmout = &timeout;
+    } else {
+        if (loop_deadline != 0) {
+            loop_deadline = 0;
+            ++mnthr_stats.poller_timer_updates;
+        }
+        tmout = NULL;
+    }
+
+    /* whether there is anything to wait for is up to the own timeout */
+    owntmout = tmout;
+    if (maxtmout != NULL &&
+        (tmout == NULL ||
+         tmout->tv_sec > maxtmout->tv_sec ||
+         (tmout->tv_sec == maxtmout->tv_sec &&
+          tmout->tv_nsec > maxtmout->tv_nsec))) {
+        timeout = *maxtmout;
+        tmout = &timeout;
+    }
 
 #ifdef TRACE_VERBOSE
-        CTRACE(FRED("nsec_now=%ld tmout=%ld(%ld.%ld) loop..."),
-              (long)nsec_now,
-              (long)(tmout != NULL ?
-                  tmout->tv_nsec + tmout->tv_sec * 1000000000 : -1),
-              (long)(tmout != NULL ? tmout->tv_sec : -1),
-              (long)(tmout != NULL ? tmout->tv_nsec : -1));
-        array_traverse(&kevents0, (array_traverser_t)kevent_dump, NULL);
+    CTRACE(FRED("nsec_now=%ld tmout=%ld(%ld.%ld) loop..."),
+          (long)nsec_now,
+          (long)(tmout != NULL ?
+              tmout->tv_nsec + tmout->tv_sec * 1000000000 : -1),
+          (long)(tmout != NULL ? tmout->tv_sec : -1),
+          (long)(tmout != NULL ? tmout->tv_nsec : -1));
+    array_traverse(&kevents0, (array_traverser_t)kevent_dump, NULL);
 #endif
 
-        if (ARRAY_ELNUM(&kevents0) != 0 || event_count != 0) {
-            event_max = MAX(event_max, event_count);
+    if (ARRAY_ELNUM(&kevents0) != 0 || event_count != 0) {
+        event_max = MAX(event_max, event_count);
 #ifdef TRACE_VERBOSE
-            struct kevent *tmp;
+        struct kevent *tmp;
 #endif
-            /*
-             * kevents1 is a grow-only array.  Here, don't call item
-             * initializers when growing ("dirty" grow).
-             *
-             * Upon return from kevent(), kevres holds the number of
-             * "valid" entries in  kevents1 which is always less than or
-             * equal to ARRAY_ELNUM(&kevents1).
-             */
-            if (array_ensure_len_dirty(&kevents1, event_max, 0) != 0) {
-                FAIL("array_ensure_len");
-            }
+        /*
+         * kevents1 is a grow-only array.  Here, don't call item
+         * initializers when growing ("dirty" grow).
+         *
+         * Upon return from kevent(), kevres holds the number of
+         * "valid" entries in  kevents1 which is always less than or
+         * equal to ARRAY_ELNUM(&kevents1).
+         */
+        if (array_ensure_len_dirty(&kevents1, event_max, 0) != 0) {
+            FAIL("array_ensure_len");
+        }
 
-            kevres = kevent(q0,
-                            ARRAY_DATA(&kevents0), ARRAY_ELNUM(&kevents0),
-                            ARRAY_DATA(&kevents1), ARRAY_ELNUM(&kevents1),
-                            tmout);
+        kevres = kevent(q0,
+                        ARRAY_DATA(&kevents0), ARRAY_ELNUM(&kevents0),
+                        ARRAY_DATA(&kevents1), ARRAY_ELNUM(&kevents1),
+                        tmout);
 
 #ifdef TRACE_VERBOSE
-            CTRACE(FRED("...kevres=%d kevents0.elnum=%ld event_count=%ld"), kevres, ARRAY_ELNUM(&kevents0), event_count);
-            for (tmp = array_first(&kevents1, &it);
-                 tmp != NULL && (int)it.iter < kevres;
-                 tmp = array_next(&kevents1, &it)) {
-                (void)kevent_dump(tmp);
-            }
+        CTRACE(FRED("...kevres=%d kevents0.elnum=%ld event_count=%ld"), kevres, ARRAY_ELNUM(&kevents0), event_count);
+        for (tmp = array_first(&kevents1, &it);
+             tmp != NULL && (int)it.iter < kevres;
+             tmp = array_next(&kevents1, &it)) {
+            (void)kevent_dump(tmp);
+        }
 #endif
 
-            (void)array_clear(&kevents0);
-            update_now();
+        (void)array_clear(&kevents0);
+        update_now();
 
-            if (kevres == -1) {
-                if (errno == EINTR) {
+        if (kevres == -1) {
+            if (errno == EINTR) {
 #ifdef TRACE_VERBOSE
-                    CTRACE("kevent was interrupted, redoing");
+                CTRACE("kevent was interrupted, redoing");
 #endif
-                    errno = 0;
-                    continue;
-                } else if (event_count == 0) {
+                errno = 0;
+                *pkevres = kevres;
+                return 0;
+            } else if (event_count == 0) {
 #ifdef TRACE_VERBOSE
-                    CTRACE("kevent0 was not quite meaningful");
+                CTRACE("kevent0 was not quite meaningful");
 #endif
-                    errno = 0;
-                    continue;
-                }
-                perror("kevent");
-                break;
+                errno = 0;
+                *pkevres = kevres;
+                return 0;
             }
+            perror("kevent");
+            *pkevres = kevres;
+            return 1;
+        }
 
-            if (kevres == 0 && event_count == 0) {
+        ++mnthr_stats.poller_wakeups;
+        if (kevres > 0) {
+            mnthr_stats.poller_events += kevres;
+            mnthr_stats.poller_events_max =
+                MAX(mnthr_stats.poller_events_max, (uint64_t)kevres);
+        } else {
+            ++mnthr_stats.poller_empty_wakeups;
+        }
+        if (mnthr_flags & CO_FLAG_SIMULATION) {
+            sim_polled(kevres == 0);
+        }
+
+        if (kevres == 0 && event_count == 0) {
 #ifdef TRACE_VERBOSE
-                CTRACE("Nothing to process ...");
+            CTRACE("Nothing to process ...");
 #endif
-                if (tmout != NULL) {
+            if (owntmout != NULL) {
 #ifdef TRACE_VERBOSE
-                    CTRACE("Timed out.");
+                CTRACE("Timed out.");
 #endif
-                    continue;
-                } else {
+                *pkevres = kevres;
+                return 0;
+            } else {
 #ifdef TRACE_VERBOSE
-                    CTRACE("No events, exiting.");
+                CTRACE("No events, exiting.");
 #endif
-                    break;
-                }
+                *pkevres = kevres;
+                return 1;
             }
+        }
 
-            for (kev = array_first(&kevents1, &it);
-                 kev != NULL && (int)it.iter < kevres;
-                 kev = array_next(&kevents1, &it)) {
-                int pres;
+        for (kev = array_first(&kevents1, &it);
+             kev != NULL && (int)it.iter < kevres;
+             kev = array_next(&kevents1, &it)) {
+            int pres;
 
-                assert(kev != NULL);
-                if (kev->ident != (uintptr_t)(-1)) {
-                    int corc;
+            assert(kev != NULL);
+            if (kev->ident != (uintptr_t)(-1)) {
+                int corc;
 
-                    ctx = kev->udata;
-                    /*
-                     * we first clear the event, and then the handlers/co's
-                     * might re-add if needed.
-                     */
+                ctx = kev->udata;
+                /*
+                 * we first clear the event, and then the handlers/co's
+                 * might re-add if needed.
+                 */
 #ifdef TRACE_VERBOSE
-                    //CTRACE("Processing:");
-                    //mnthr_dump(ctx);
+                //CTRACE("Processing:");
+                //mnthr_dump(ctx);
 #endif
-                    if (kev->flags & EV_ERROR) {
+                if (kev->flags & EV_ERROR) {
+                    /*
+                     * do not tell kqueue to discard event, let the thread get away
+                     * with it
+                     */
+                    corc = MNTHR_CO_RC_POLLER;
+                } else {
+                    discard_event(kev->ident, kev->filter, ctx);
+                    corc = 0;
+                }
+                if (ctx != NULL) {
+                    if (ctx->co.state == CO_STATE_OTHER_POLLER) {
                         /*
-                         * do not tell kqueue to discard event, let the thread get away
-                         * with it
+                         * special case for mnthr_wait_for_event(),
+                         * defer resume
                          */
-                        corc = MNTHR_CO_RC_POLLER;
-                    } else {
-                        discard_event(kev->ident, kev->filter, ctx);
-                        corc = 0;
-                    }
-                    if (ctx != NULL) {
-                        if (ctx->co.state == CO_STATE_OTHER_POLLER) {
-                            /*
-                             * special case for mnthr_wait_for_event(),
-                             * defer resume
-                             */
-                            ctx->pdata.kev.idx = -1;
-                            if (kev->filter == EVFILT_READ) {
-                                ctx->pdata.kev.filter |=
-                                    MNTHR_WAIT_EVENT_READ;
-                            } else if (kev->filter == EVFILT_WRITE) {
-                                ctx->pdata.kev.filter |=
-                                    MNTHR_WAIT_EVENT_WRITE;
-                            } else {
-                                /**/
-                                FAIL("mnthr_loop");
-                            }
-                            set_resume_fast(ctx);
-
+                        ctx->pdata.kev.idx = -1;
+                        if (kev->filter == EVFILT_READ) {
+                            ctx->pdata.kev.filter |=
+                                MNTHR_WAIT_EVENT_READ;
+                        } else if (kev->filter == EVFILT_WRITE) {
+                            ctx->pdata.kev.filter |=
+                                MNTHR_WAIT_EVENT_WRITE;
                         } else {
-                            ctx->pdata.kev.idx = it.iter;
-                            if (ctx->co.f != NULL) {
-                                ctx->co.rc = corc;
-                                if ((pres = poller_resume(ctx)) != 0) {
+                            /**/
+                            FAIL("mnthr_loop");
+                        }
+                        set_resume_fast(ctx);
+
+                    } else {
+                        ctx->pdata.kev.idx = it.iter;
+                        if (ctx->co.f != NULL) {
+                            ctx->co.rc = corc;
+                            if ((pres = poller_resume(ctx)) != 0) {
 #ifdef TRACE_VERBOSE
-                                    CTRACE("Could not resume co %ld "
-                                          "for read FD %08lx (res=%d)",
-                                          (long)ctx->co.id, kev->ident, pres);
+                                CTRACE("Could not resume co %ld "
+                                      "for read FD %08lx (res=%d)",
+                                      (long)ctx->co.id, kev->ident, pres);
 #endif
-                                }
-                            } else {
-                                //CTRACE("co for FD %08lx is NULL, "
-                                //      "discarding ...", kev->ident);
                             }
+                        } else {
+                            //CTRACE("co for FD %08lx is NULL, "
+                            //      "discarding ...", kev->ident);
                         }
-                    } else {
-                        CTRACE("no thread for FD %08lx filter %s "
-                              "using default [discard]...", kev->ident,
-                              kevent_filter_str(kev->filter));
                     }
                 } else {
-                    CTRACE("kevent returned ident -1");
-                    KEVENT_DUMP(kev);
-                    FAIL("kevent?");
+                    CTRACE("no thread for FD %08lx filter %s "
+                          "using default [discard]...", kev->ident,
+                          kevent_filter_str(kev->filter));
                 }
+            } else {
+                CTRACE("kevent returned ident -1");
+                KEVENT_DUMP(kev);
+                FAIL("kevent?");
             }
+        }
 
-        } else {
-            /*
-             * If we had specified a timeout, but we have found ourselves
-             * here, there must be sleep/resume threads waiting for us.
-             */
-            if (tmout != NULL) {
-                if (tmout->tv_sec != 0 || tmout->tv_nsec != 0) {
+    } else {
+        /*
+         * If we had specified a timeout, but we have found ourselves
+         * here, there must be sleep/resume threads waiting for us.
+         */
+        if (owntmout != NULL) {
+            if (tmout->tv_sec != 0 || tmout->tv_nsec != 0) {
 #ifdef TRACE_VERBOSE
-                    CTRACE("Nothing to pass to kevent(), nanosleep ? ...");
+                CTRACE("Nothing to pass to kevent(), nanosleep ? ...");
 #endif
-                    kevres = nanosleep(tmout, NULL);
-
-                    if (kevres == -1) {
-                        if (errno == EINTR) {
-                            CTRACE("nanosleep was interrupted, redoing");
-                            errno = 0;
-                            continue;
-                        }
-                        perror("nanosleep");
-                        break;
+                kevres = nanosleep(tmout, NULL);
+
+                if (kevres == -1) {
+                    if (errno == EINTR) {
+                        CTRACE("nanosleep was interrupted, redoing");
+                        errno = 0;
+                        *pkevres = kevres;
+                        return 0;
                     }
-                } else {
-#ifdef TRACE_VERBOSE
-                    CTRACE("tmout was zero, no nanosleep.");
-#endif
+                    perror("nanosleep");
+                    *pkevres = kevres;
+                    return 1;
                 }
             } else {
 #ifdef TRACE_VERBOSE
-                CTRACE("Nothing to pass to kevent(), breaking the loop ? ...");
+                CTRACE("tmout was zero, no nanosleep.");
 #endif
-                kevres = 0;
-                break;
             }
+            if (mnthr_flags & CO_FLAG_SIMULATION) {
+                sim_polled(true);
+            }
+        } else {
+#ifdef TRACE_VERBOSE
+            CTRACE("Nothing to pass to kevent(), breaking the loop ? ...");
+#endif
+            *pkevres = 0;
+            return 1;
+        }
+    }
+
+    *pkevres = kevres;
+    return 0;
+}
+
+
+/**
+ * Combined threads and events loop.
+ *
+ * The loop processes first threads, then events. It sleeps until the
+ * earliest thread resume time, or an I/O event occurs.
+ *
+ */
+int
+mnthr_loop(void)
+{
+    int kevres = 0;
+
+    PROFILE_START(mnthr_sched0_p);
+
+    while (!(mnthr_flags & CO_FLAG_SHUTDOWN)) {
+        if (poller_iteration(NULL, &kevres) != 0) {
+            break;
         }
     }
 
@@ -865,6 +982,76 @@ mnthr_loop(void)
 }
 
 
+/**
+ * A single iteration of mnthr_loop(), waiting for events no longer than
+ * usec, UINT64_MAX - until the next one.  Return non-zero once the loop
+ * is done (mnthr_shutdown()).
+ */
+int
+mnthr_loop_once(uint64_t usec)
+{
+    struct timespec maxtmout;
+    int kevres = 0;
+    int res;
+
+    if (mnthr_flags & CO_FLAG_SHUTDOWN) {
+        return 1;
+    }
+    maxtmout.tv_sec = usec / 1000000;
+    maxtmout.tv_nsec = (usec % 1000000) * 1000;
+    PROFILE_START(mnthr_sched0_p);
+    res = poller_iteration(usec != UINT64_MAX ? &maxtmout : NULL, &kevres);
+    PROFILE_STOP(mnthr_sched0_p);
+    return res != 0 || (mnthr_flags & CO_FLAG_SHUTDOWN);
+}
+
+
+/**
+ * The kqueue, that is readable when there are events for the loop.
+ */
+int
+mnthr_get_poll_fd(void)
+{
+    return q0;
+}
+
+
+bool
+poller_changes_pending(void)
+{
+    /* not yet passed to kevent() */
+    return ARRAY_ELNUM(&kevents0) != 0;
+}
+
+
+/**
+ * kevent is the only backend here.
+ */
+int
+mnthr_set_backend(const char *spec)
+{
+    if (mnthr_flags & CO_FLAG_INITIALIZED) {
+        TRRET(MNTHR_SET_BACKEND + 1);
+    }
+    if (*spec != '\0' &&
+        strcmp(spec, "kevent") != 0 &&
+        strcmp(spec, "kqueue") != 0) {
+        TRRET(MNTHR_SET_BACKEND + 2);
+    }
+    return 0;
+}
+
+
+const char *
+mnthr_get_backend(void)
+{
+    if (!(mnthr_flags & CO_FLAG_INITIALIZED)) {
+        return NULL;
+    }
+    return "kevent";
+}
+
+
 void
 poller_mnthr_ctx_init(struct _mnthr_ctx *ctx)
 {
@@ -0,0 +1,280 @@
+/**
+ * CTRACE() logger.
+ *
+ * The second resolution part of the timestamp is formatted only when
+ * the second changes, instead of a localtime(3) and a strftime(3) per
+ * line.  Every call site of CTRACE() is rate limited to log_rate lines
+ * a second (mnthr_log_set_rate()), the suppressed ones are counted and
+ * reported along with the next line of the site that gets through.
+ *
+ * Lines are written to stderr synchronously until mnthr_log_start() is
+ * called.  After that they are appended to a buffer of the loop, and a
+ * flusher thread writes it out with mnthr_write_all(), while the lines
+ * logged meanwhile go to a second buffer.  Lines that do not fit are
+ * dropped and counted, so that a log storm never blocks the loop.  The
+ * flusher is woken up by the first line logged into an empty buffer
+ * from a running thread, and every LOG_FLUSH_USEC otherwise.
+ */
+#include <assert.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef HAVE_CONFIG_H
+#   include "config.h"
+#endif
+
+#ifdef DO_MEMDEBUG
+#include <mncommon/memdebug.h>
+MEMDEBUG_DECLARE(mnthr_log);
+#endif
+
+#include <mncommon/btrie.h>
+
+#include "mnthr_private.h"
+
+//#define TRACE_VERBOSE
+#include "diag.h"
+#include <mncommon/dumpm.h>
+
+#define LOG_BUF_SIZE (256 * 1024)
+#define LOG_LINE_MAX 1024
+#define LOG_FLUSH_USEC 100000
+#define LOG_RATE_DEFAULT 100
+
+typedef struct _log_buf {
+    size_t len;
+    char data[LOG_BUF_SIZE];
+} log_buf_t;
+
+static log_buf_t bufs[2];
+static log_buf_t *cur = &bufs[0];
+static int log_fd = STDERR_FILENO;
+static mnthr_ctx_t *flusher = NULL;
+static mnthr_signal_t log_signal;
+static bool log_closing = false;
+static unsigned log_rate = LOG_RATE_DEFAULT;
+static time_t stamp_sec = -1;
+static char stamp[32];
+
+
+/**
+ * Lines a second per call site, 0 - unlimited.
+ */
+void
+mnthr_log_set_rate(unsigned rate)
+{
+    log_rate = rate;
+}
+
+
+static void
+log_drain(void)
+{
+    int i;
+
+    for (i = 0; i < 2; ++i) {
+        log_buf_t *b;
+
+        /* the older one first */
+        b = i == 0 ? (cur == &bufs[0] ? &bufs[1] : &bufs[0]) : cur;
+        if (b->len != 0) {
+            (void)write(log_fd, b->data, b->len);
+            b->len = 0;
+        }
+    }
+}
+
+
+static void
+log_put(const char *s, size_t sz)
+{
+    bool was_empty;
+
+    ++mnthr_stats.log_lines;
+    if (flusher == NULL) {
+        (void)write(log_fd, s, sz);
+        return;
+    }
+    if (cur->len + sz > LOG_BUF_SIZE) {
+        ++mnthr_stats.log_dropped;
+        return;
+    }
+    was_empty = cur->len == 0;
+    memcpy(cur->data + cur->len, s, sz);
+    cur->len += sz;
+
+    /*
+     * Not from within the loop itself, that might be in the middle of
+     * rearranging the sleepq.
+     */
+    if (was_empty &&
+        me != NULL &&
+        me != flusher &&
+        me->co.state == CO_STATE_RESUMED) {
+        mnthr_signal_send(&log_signal);
+    }
+}
+
+
+void
+mnthr_log(mnthr_log_site_t *site,
+          const char *file,
+          int line,
+          const char *func,
+          const char *fmt,
+          ...)
+{
+    struct timespec ts;
+    char buf[LOG_LINE_MAX];
+    unsigned suppressed;
+    va_list ap;
+    size_t sz;
+    int n;
+
+    if (clock_gettime(CLOCK_REALTIME, &ts) != 0) {
+        FAIL("clock_gettime");
+    }
+
+    suppressed = 0;
+    if (log_rate != 0) {
+        if (site->sec != (uint64_t)ts.tv_sec) {
+            suppressed = site->suppressed;
+            site->sec = (uint64_t)ts.tv_sec;
+            site->n = 0;
+            site->suppressed = 0;
+        }
+        if (++site->n > log_rate) {
+            ++site->suppressed;
+            ++mnthr_stats.log_suppressed;
+            return;
+        }
+    }
+
+    if (ts.tv_sec != stamp_sec) {
+        struct tm tm;
+
+        (void)localtime_r(&ts.tv_sec, &tm);
+        (void)strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", &tm);
+        stamp_sec = ts.tv_sec;
+    }
+
+    if (suppressed != 0) {
+        n = snprintf(buf,
+                     sizeof(buf),
+                     "%s.%06ld [% 4d] %s:%d:%s() "
+                     "%u similar lines suppressed\n",
+                     stamp,
+                     (long)(ts.tv_nsec / 1000),
+                     mnthr_id(),
+                     file,
+                     line,
+                     func,
+                     suppressed);
+        log_put(buf, MIN((size_t)n, sizeof(buf) - 1));
+    }
+
+    n = snprintf(buf,
+                 sizeof(buf),
+                 "%s.%06ld [% 4d] %s:%d:%s() ",
+                 stamp,
+                 (long)(ts.tv_nsec / 1000),
+                 mnthr_id(),
+                 file,
+                 line,
+                 func);
+    sz = MIN((size_t)n, sizeof(buf) - 2);
+    va_start(ap, fmt);
+    n = vsnprintf(buf + sz, sizeof(buf) - sz - 1, fmt, ap);
+    va_end(ap);
+    if (n > 0) {
+        /* truncated lines keep their newline */
+        sz += MIN((size_t)n, sizeof(buf) - sz - 2);
+    }
+    buf[sz++] = '\n';
+    log_put(buf, sz);
+}
+
+
+static int
+log_flusher(UNUSED int argc, UNUSED void *argv[])
+{
+    while (true) {
+        log_buf_t *out;
+
+        if (cur->len == 0) {
+            int res;
+
+            if (log_closing) {
+                break;
+            }
+            res = mnthr_signal_subscribe_with_timeout_usec(&log_signal,
+                                                           LOG_FLUSH_USEC);
+            if (res != 0 && res != (int)MNTHR_WAIT_TIMEOUT) {
+                break;
+            }
+            continue;
+        }
+
+        out = cur;
+        cur = cur == &bufs[0] ? &bufs[1] : &bufs[0];
+        if (mnthr_write_all(log_fd, out->data, out->len) != 0) {
+            out->len = 0;
+            break;
+        }
+        out->len = 0;
+    }
+
+    mnthr_signal_fini(&log_signal);
+    flusher = NULL;
+    log_drain();
+    return 0;
+}
+
+
+/**
+ * Write the log to fd from a flusher thread.
+ */
+int
+mnthr_log_start(int fd)
+{
+    if (!(mnthr_flags & CO_FLAG_INITIALIZED)) {
+        TRRET(MNTHR_LOG_START + 1);
+    }
+    if (flusher != NULL) {
+        TRRET(MNTHR_LOG_START + 2);
+    }
+    log_fd = fd;
+    log_closing = false;
+    mnthr_signal_init(&log_signal, NULL);
+    flusher = mnthr_new("mnthr_log", log_flusher, 0);
+    mnthr_run(flusher);
+    return 0;
+}
+
+
+/**
+ * Flush the log, and stop the flusher thread.
+ */
+int
+mnthr_log_stop(void)
+{
+    if (flusher != NULL) {
+        log_closing = true;
+        mnthr_signal_send(&log_signal);
+        return mnthr_join(flusher);
+    }
+    return 0;
+}
+
+
+void
+log_fini(void)
+{
+    /* the flusher is gone along with the other threads */
+    flusher = NULL;
+    log_drain();
+    log_fd = STDERR_FILENO;
+}
@@ -0,0 +1,172 @@
+/**
+ * Shared memory metrics region.
+ *
+ * The runtime keeps its counters in the process private mnthr_stats.
+ * When a region is open, the loop copies them into it once per
+ * iteration under a sequence lock (see mnthr_metrics.h), so that
+ * external readers can sample them without any cooperation from the
+ * process.
+ */
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#ifdef HAVE_CONFIG_H
+#   include "config.h"
+#endif
+
+#ifdef DO_MEMDEBUG
+#include <mncommon/memdebug.h>
+MEMDEBUG_DECLARE(mnthr_metrics);
+#endif
+
+#include <mncommon/btrie.h>
+
+#include "mnthr_private.h"
+
+//#define TRACE_VERBOSE
+#include "diag.h"
+#include <mncommon/dumpm.h>
+
+
+mnthr_metrics_counters_t mnthr_stats;
+mnthr_metrics_t *mnthr_metrics = NULL;
+static int metrics_fd = -1;
+static char *metrics_path = NULL;
+
+
+/**
+ * Create and map the metrics region at path, or in an anonymous memory
+ * file if path is NULL.  Return the file descriptor of the region (it
+ * is reachable as /proc/<pid>/fd/<fd> in the latter case), or a
+ * negative number on error.
+ */
+int
+mnthr_metrics_open(const char *path)
+{
+    mnthr_metrics_t *m;
+    int fd;
+
+    if (mnthr_metrics != NULL) {
+        TRRET(MNTHR_METRICS_OPEN + 1);
+    }
+
+    if (path == NULL) {
+#ifdef HAVE_MEMFD_CREATE
+        if ((fd = memfd_create("mnthr-metrics", MFD_CLOEXEC)) == -1) {
+            TRRET(MNTHR_METRICS_OPEN + 2);
+        }
+#else
+        TRRET(MNTHR_METRICS_OPEN + 2);
+#endif
+    } else {
+        if ((fd = open(path,
+                       O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC,
+                       0644)) == -1) {
+            TRRET(MNTHR_METRICS_OPEN + 3);
+        }
+    }
+
+    if (ftruncate(fd, sizeof(mnthr_metrics_t)) != 0) {
+        goto err;
+    }
+
+    if ((m = mmap(NULL,
+                  sizeof(mnthr_metrics_t),
+                  PROT_READ | PROT_WRITE,
+                  MAP_SHARED,
+                  fd,
+                  0)) == MAP_FAILED) {
+        goto err;
+    }
+
+    m->version = MNTHR_METRICS_VERSION;
+    m->ncounters = MNTHR_METRICS_NCOUNTERS;
+    m->pid = (uint64_t)getpid();
+    m->seq = 0;
+    m->updated = 0;
+    m->c = mnthr_stats;
+    /* readers check magic last */
+    __atomic_store_n(&m->magic, MNTHR_METRICS_MAGIC, __ATOMIC_RELEASE);
+
+    if (path != NULL) {
+        metrics_path = strdup(path);
+    }
+    metrics_fd = fd;
+    mnthr_metrics = m;
+
+    return fd;
+
+err:
+    if (path != NULL) {
+        (void)unlink(path);
+    }
+    (void)close(fd);
+    TRRET(MNTHR_METRICS_OPEN + 4);
+}
+
+
+/**
+ * Unmap the metrics region, and remove its file if any.
+ */
+void
+mnthr_metrics_close(void)
+{
+    if (mnthr_metrics != NULL) {
+        (void)munmap(mnthr_metrics, sizeof(mnthr_metrics_t));
+        mnthr_metrics = NULL;
+    }
+    if (metrics_fd != -1) {
+        (void)close(metrics_fd);
+        metrics_fd = -1;
+    }
+    if (metrics_path != NULL) {
+        (void)unlink(metrics_path);
+        free(metrics_path);
+        metrics_path = NULL;
+    }
+}
+
+
+static void
+update_gauges(void)
+{
+    size_t nctxes, nfree;
+
+    ctxes_count(&nctxes, &nfree);
+    mnthr_stats.ctxes = nctxes - nfree;
+    mnthr_stats.free_ctxes = nfree;
+    mnthr_stats.sleepq_length = mnthr_get_sleepq_length();
+}
+
+
+/**
+ * Get a snapshot of the counters from within the process.
+ */
+void
+mnthr_metrics_get(mnthr_metrics_counters_t *c)
+{
+    update_gauges();
+    *c = mnthr_stats;
+}
+
+
+void
+metrics_publish(void)
+{
+    mnthr_metrics_t *m = mnthr_metrics;
+
+    assert(m != NULL);
+
+    update_gauges();
+
+    __atomic_store_n(&m->seq, m->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    m->updated = mnthr_get_now_nsec();
+    m->c = mnthr_stats;
+    __atomic_store_n(&m->seq, m->seq + 1, __ATOMIC_RELEASE);
+}
@@ -93,6 +93,7 @@ MEMDEBUG_DECLARE(mnthr);
 #include <mncommon/btrie.h>
 
 #include "mnthr_private.h"
+#include "mnthr_probes.h"
 
 #ifdef __clang__
 #pragma clang diagnostic ignored "-Wdeprecated-declarations"
@@ -122,6 +123,8 @@ static int co_id = 0;
 static mnarray_t ctxes;
 mnthr_ctx_t *me;
 
+static FILE *stackmap = NULL;
+
 static DTQUEUE(_mnthr_ctx, free_list);
 
 /*
@@ -261,6 +264,52 @@ mnthr_ctx_sizeof(void)
     return sizeof(mnthr_ctx_t);
 }
 
+
+/*
+ * Stack map.
+ *
+ * When open, a line "<stack> <size> <id> <name>" is appended to the
+ * stack map each time a thread is created or renamed, so that external
+ * profilers can attribute stack addresses to threads.  Stacks are reused
+ * by subsequent threads, the latest line for an address range wins.
+ */
+int
+mnthr_stackmap_open(const char *path)
+{
+    FILE *f;
+
+    if ((f = fopen(path, "a")) == NULL) {
+        return -1;
+    }
+    (void)setvbuf(f, NULL, _IOLBF, 0);
+    mnthr_stackmap_close();
+    stackmap = f;
+    return 0;
+}
+
+
+void
+mnthr_stackmap_close(void)
+{
+    if (stackmap != NULL) {
+        (void)fclose(stackmap);
+        stackmap = NULL;
+    }
+}
+
+
+static void
+stackmap_record(const mnthr_ctx_t *ctx)
+{
+    if (stackmap != NULL) {
+        fprintf(stackmap, "%lx %lx %lld %s\n",
+                (unsigned long)ctx->co.stack,
+                (unsigned long)ctx->co.uc.uc_stack.ss_size,
+                (long long)ctx->co.id,
+                CO_NAME(ctx));
+    }
+}
+
 static int
 dump_sleepq_node(mnbtrie_node_t *trn, UNUSED void *udata)
 {
@@ -412,7 +461,8 @@ sleepq_insert(mnthr_ctx_t *ctx)
 
         //TRACE("while inserting, found bucket:");
         //mnthr_dump(bucket_host);
-        if ((head = DTQUEUE_HEAD(&bucket_host->sleepq_bucket)) == NULL) {
+        if ((head = DTQUEUE_HEAD(&bucket_host->sleepq_bucket)) == NULL ||
+            SIM_SHUFFLE()) {
             DTQUEUE_ENQUEUE(&bucket_host->sleepq_bucket, sleepq_link, ctx);
         } else {
 
@@ -486,9 +536,19 @@ sleepq_append(mnthr_ctx_t *ctx)
     //}
     bucket_host = (mnthr_ctx_t *)(trn->value);
     if (bucket_host != NULL) {
+        mnthr_ctx_t *head;
+
         //TRACE("while appending, found bucket:");
         //mnthr_dump(bucket_host);
-        DTQUEUE_ENQUEUE(&bucket_host->sleepq_bucket, sleepq_link, ctx);
+        if (SIM_SHUFFLE() &&
+            (head = DTQUEUE_HEAD(&bucket_host->sleepq_bucket)) != NULL) {
+            DTQUEUE_INSERT_BEFORE(&bucket_host->sleepq_bucket,
+                                  sleepq_link,
+                                  head,
+                                  ctx);
+        } else {
+            DTQUEUE_ENQUEUE(&bucket_host->sleepq_bucket, sleepq_link, ctx);
+        }
 
         //TRACE("After adding to the bucket:");
         //mnthr_dump(bucket_host);
@@ -515,6 +575,7 @@ int
 mnthr_init(void)
 {
     UNUSED size_t sz;
+    const char *s;
 
     if (mnthr_flags & CO_FLAG_INITIALIZED) {
         return 0;
@@ -531,6 +592,7 @@ mnthr_init(void)
 #endif
 
     DTQUEUE_INIT(&free_list);
+    names_init();
 
     if (array_init(&ctxes, sizeof(mnthr_ctx_t *), 0,
                   (array_initializer_t)mnthr_ctx_init,
@@ -538,7 +600,30 @@ mnthr_init(void)
         FAIL("array_init");
     }
 
+    if ((s = getenv("MNTHR_SIM")) != NULL) {
+        (void)mnthr_sim_init(strtoull(s, NULL, 0));
+    }
+
+    if ((s = getenv("MNTHR_BACKEND")) != NULL) {
+        if (mnthr_set_backend(s) != 0) {
+            CTRACE("MNTHR_BACKEND: unsupported %s", s);
+        }
+    }
+
     poller_init();
+    groups_init();
+
+    if ((s = getenv("MNTHR_STACKMAP")) != NULL) {
+        if (mnthr_stackmap_open(s) != 0) {
+            perror("mnthr_stackmap_open");
+        }
+    }
+
+    if ((s = getenv("MNTHR_METRICS")) != NULL) {
+        if (mnthr_metrics_open(*s != '\0' ? s : NULL) < 0) {
+            perror("mnthr_metrics_open");
+        }
+    }
 
     main_uc.uc_link = NULL;
     main_uc.uc_stack.ss_sp = main_stack;
@@ -562,8 +647,18 @@ mnthr_fini(void)
     me = NULL;
     array_fini(&ctxes);
     DTQUEUE_FINI(&free_list);
+    arena_cache_flush();
+    bufpool_fini();
+    placement_fini();
+    names_fini();
     btrie_fini(&the_sleepq);
     poller_fini();
+    mnthr_stackmap_close();
+    mnthr_metrics_close();
+    profiler_fini();
+    (void)mnthr_preempt_stop();
+    log_fini();
+    sim_fini();
 
     PROFILE_REPORT_SEC();
     PROFILE_FINI_MODULE();
@@ -630,6 +725,9 @@ dump_ctx_traverser(mnthr_ctx_t **ctx, UNUSED void *udata)
     if (*ctx != NULL) {
         if ((*ctx)->co.id != -1) {
             mnthr_dump(*ctx);
+            if ((*ctx)->co.state & CO_STATE_RESUMABLE) {
+                mnthr_dump_backtrace(*ctx);
+            }
         }
     }
     return 0;
@@ -645,6 +743,42 @@ mnthr_dump_all_ctxes(void)
 }
 
 
+/*
+ * The number of ctxes allocated, and of those on the free list.
+ */
+void
+ctxes_count(size_t *nctxes, size_t *nfree)
+{
+    *nctxes = ARRAY_ELNUM(&ctxes);
+    *nfree = DTQUEUE_LENGTH(&free_list);
+}
+
+
+/*
+ * Call cb for each live ctx, stop if cb returns non-zero.
+ */
+int
+ctxes_traverse(int (*cb)(mnthr_ctx_t *, void *), void *udata)
+{
+    mnthr_ctx_t **pctx;
+    mnarray_iter_t it;
+
+    for (pctx = array_first(&ctxes, &it);
+         pctx != NULL;
+         pctx = array_next(&ctxes, &it)) {
+        int res;
+
+        if (*pctx == NULL || (*pctx)->co.id == -1) {
+            continue;
+        }
+        if ((res = cb(*pctx, udata)) != 0) {
+            return res;
+        }
+    }
+    return 0;
+}
+
+
 /*
  * mnthr_ctx management
  */
@@ -653,9 +787,7 @@ mnthr_ctx_init(mnthr_ctx_t **pctx)
 {
     mnthr_ctx_t *ctx;
 
-    if ((ctx = malloc(sizeof(mnthr_ctx_t))) == NULL) {
-        FAIL("malloc");
-    }
+    ctx = placement_ctx_alloc();
 
     /* co ucontext */
     ctx->co.stack = MAP_FAILED;
@@ -666,7 +798,7 @@ mnthr_ctx_init(mnthr_ctx_t **pctx)
 
     /* co other */
     ctx->co.id = -1;
-    *(ctx->co.name) = '\0';
+    ctx->co.nid = 0;
     ctx->co.f = NULL;
     ctx->co.argc = 0;
     ctx->co.argv = NULL;
@@ -689,6 +821,12 @@ mnthr_ctx_init(mnthr_ctx_t **pctx)
 
     DTQUEUE_ENTRY_INIT(free_link, ctx);
     STQUEUE_ENTRY_INIT(runq_link, ctx);
+    ctx->group = NULL;
+    ctx->arena = NULL;
+    ctx->parked_at = 0;
+    ctx->hibernating = false;
+    ctx->hibernated = NULL;
+    ctx->hibernated_sz = 0;
     poller_mnthr_ctx_init(ctx);
 
     *pctx = ctx;
@@ -714,7 +852,7 @@ static void
 co_fini_other(struct _co *co)
 {
     co->id = -1;
-    *co->name = '\0';
+    co->nid = 0;
     co->f = NULL;
     co->argc = 0;
     if (co->argv != NULL) {
@@ -749,6 +887,15 @@ mnthr_ctx_finalize(mnthr_ctx_t *ctx)
 
     ctx->sleepq_enqueue = sleepq_append;
 
+    group_set(ctx, NULL);
+    arena_fini(ctx);
+    hibernate_discard(ctx);
+    if (ctx->hibernating) {
+        ctx->hibernating = false;
+        --mnthr_stats.hibernated;
+    }
+    ctx->parked_at = 0;
+
     co_fini_other(&ctx->co);
 
     /* resume all from my waitq */
@@ -772,7 +919,7 @@ mnthr_ctx_fini(mnthr_ctx_t **pctx)
         co_fini_ucontext(&(*pctx)->co);
         mnthr_ctx_finalize(*pctx);
         (*pctx)->co.rc = 0;
-        free(*pctx);
+        placement_ctx_free(*pctx);
         *pctx = NULL;
     }
     return 0;
@@ -834,6 +981,7 @@ mnthr_gc(void)
     DTQUEUE(_mnthr_ctx, tmp_list);
 
     res = 0;
+    arena_cache_flush();
     DTQUEUE_INIT(&tmp_list);
     for (pctx0 = array_first(&ctxes, &it0);
          pctx0 != NULL;
@@ -908,24 +1056,18 @@ mnthr_gc(void)
     }                                                                          \
     assert(ctx->co.id == -1);                                                  \
     ctx->co.id = co_id++;                                                      \
-    if (name != NULL) {                                                        \
-        strncpy(ctx->co.name, name, sizeof(ctx->co.name) - 1);                 \
-        ctx->co.name[sizeof(ctx->co.name) - 1] = '\0';                         \
-    } else {                                                                   \
-        ctx->co.name[0] = '\0';                                                \
-    }                                                                          \
+    ctx->co.nid = name != NULL ? mnthr_name_intern(name) : 0;                  \
+    ++name_stats[ctx->co.nid].spawns;                                          \
     if (_getcontext(&ctx->co.uc) != 0) {                                       \
         TR(MNTHR_CTX_NEW + 1);                                                \
         ctx = NULL;                                                            \
         goto vnew_body_end;                                                    \
     }                                                                          \
     if (ctx->co.stack == MAP_FAILED) {                                         \
-        if ((ctx->co.stack = mmap(NULL,                                        \
-                                  stacksize,                                   \
-                                  PROT_READ|PROT_WRITE,                        \
-                                  MAP_PRIVATE|MAP_ANON,                        \
-                                  -1,                                          \
-                                  0)) == MAP_FAILED) {                         \
+        if ((ctx->co.stack = placement_mmap(                                   \
+                    stacksize,                                                 \
+                    (placement_flags & MNTHR_PLACE_HUGE_STACKS) ?              \
+                        PLACEMENT_THP : 0)) == MAP_FAILED) {                   \
             TR(_MNTHR_NEW + 2);                                               \
             ctx = NULL;                                                        \
             goto vnew_body_end;                                                \
@@ -948,6 +1090,10 @@ mnthr_gc(void)
         }                                                                      \
     }                                                                          \
     makecontext(&ctx->co.uc, (void(*)(void))f, 2, ctx->co.argc, ctx->co.argv); \
+    MNTHR_PROBE2(spawn, ctx->co.id, CO_NAME(ctx));                              \
+    ++mnthr_stats.spawns;                                                      \
+    group_set(ctx, me != NULL ? me->group : NULL);                             \
+    stackmap_record(ctx);                                                      \
 vnew_body_end:                                                                 \
 
 
@@ -1005,7 +1151,7 @@ mnthr_dump(const mnthr_ctx_t *ctx)
 
     TRACEC("mnthr %p/%s id=%lld f=%p ssz=%ld st=%s rc=%s exp=%016lx\n",
            ctx,
-           ctx->co.name,
+           CO_NAME(ctx),
            (long long)ctx->co.id,
            ctx->co.f,
            (long)ssz,
@@ -1024,7 +1170,7 @@ mnthr_dump(const mnthr_ctx_t *ctx)
 
             TRACEC(" +mnthr %p/%s id=%lld f=%p st=%s rc=%s exp=%016lx\n",
                    tmp,
-                   tmp->co.name,
+                   CO_NAME(tmp),
                    (long long)tmp->co.id,
                    tmp->co.f,
                    CO_STATE_STR(tmp->co.state),
@@ -1043,12 +1189,17 @@ mnthr_set_name(mnthr_ctx_t *ctx,
                      ...)
 {
     va_list ap;
+    char name[MNTHR_NAME_MAX];
     int res;
 
     va_start(ap, fmt);
-    res = vsnprintf(ctx->co.name, sizeof(ctx->co.name), fmt, ap);
+    res = vsnprintf(name, sizeof(name), fmt, ap);
     va_end(ap);
-    return res < (int)(sizeof(ctx->co.name)) ? 0 : 1;
+    ctx->co.nid = mnthr_name_intern(name);
+    stackmap_record(ctx);
+    /* truncated, or not interned */
+    return (res < (int)sizeof(name) &&
+            (ctx->co.nid != 0 || *name == '\0')) ? 0 : 1;
 }
 
 
@@ -1147,6 +1298,8 @@ yield(void)
     //mnthr_dump(me);
 #endif
 
+    MNTHR_PROBE3(yield, me->co.id, CO_NAME(me), me->co.state);
+
     PROFILE_STOP(mnthr_user_p);
     PROFILE_START(mnthr_swap_p);
     res = swapcontext(&me->co.uc, &main_uc);
@@ -1387,12 +1540,36 @@ mnthr_run(mnthr_ctx_t *ctx)
 }
 
 
+/*
+ * Only the spawns are gated: mnthr_new() and mnthr_new_sig() never
+ * fail, and the library starts its own threads with them.
+ */
+static bool
+spawn_admitted(void)
+{
+    if ((admission_policy & MNTHR_ADMIT_FAIL_SPAWN) && mnthr_overloaded()) {
+        ++mnthr_stats.admission_rejects;
+        errno = EAGAIN;
+        return false;
+    }
+    return true;
+}
+
+
+/**
+ * Under the MNTHR_ADMIT_FAIL_SPAWN policy, return NULL with errno set
+ * to EAGAIN while the loop is overloaded.
+ */
 mnthr_ctx_t *
 mnthr_spawn(const char *name, mnthr_cofunc_t f, int argc, ...)
 {
     va_list ap;
     mnthr_ctx_t *ctx = NULL;
 
+    if (!spawn_admitted()) {
+        return NULL;
+    }
+
     va_start(ap, argc);
     VNEW_BODY(mnthr_ctx_pop_free);
     va_end(ap);
@@ -1404,12 +1581,19 @@ mnthr_spawn(const char *name, mnthr_cofunc_t f, int argc, ...)
 }
 
 
+/**
+ * As mnthr_spawn().
+ */
 mnthr_ctx_t *
 mnthr_spawn_sig(const char *name, mnthr_cofunc_t f, int argc, ...)
 {
     va_list ap;
     mnthr_ctx_t *ctx = NULL;
 
+    if (!spawn_admitted()) {
+        return NULL;
+    }
+
     va_start(ap, argc);
     VNEW_BODY(mnthr_ctx_new);
     va_end(ap);
@@ -1782,6 +1966,11 @@ mnthr_accept_all(int fd, mnthr_socket_t **buf, off_t *offset)
 
     assert(me != NULL);
 
+    if ((admission_policy & MNTHR_ADMIT_PAUSE_ACCEPT) &&
+        admission_pause() != 0) {
+        TRRET(MNTHR_ACCEPT_ALL + 3);
+    }
+
     if ((navail = mnthr_get_rbuflen(fd)) <= 0) {
         TRRET(MNTHR_ACCEPT_ALL + 1);
     }
@@ -1828,6 +2017,11 @@ mnthr_accept_all2(int fd, mnthr_socket_t **buf, off_t *offset)
 
     assert(me != NULL);
 
+    if ((admission_policy & MNTHR_ADMIT_PAUSE_ACCEPT) &&
+        admission_pause() != 0) {
+        TRRET(MNTHR_ACCEPT_ALL + 3);
+    }
+
     if (mnthr_wait_for_read(fd) != 0) {
         TRRET(MNTHR_ACCEPT_ALL + 1);
     }
@@ -1892,6 +2086,7 @@ mnthr_read_all(int fd, char **buf, off_t *offset)
         perror("read");
         TRRET(MNTHR_READ_ALL + 3);
     }
+    mnthr_stats.bytes_read += nread;
 
     if (nread < navail) {
         //TRACE("nread=%ld navail=%ld", nread, navail);
@@ -1906,6 +2101,46 @@ mnthr_read_all(int fd, char **buf, off_t *offset)
 }
 
 
+/**
+ * Wait for data on fd, and read it into a buffer borrowed from the
+ * buffer pool just for that data.  The buffer is then owned by the
+ * caller, who returns it with mnthr_buf_put().  Whatever does not fit
+ * in the largest buffer class is left for the next call.
+ */
+int
+mnthr_read_buf(int fd, mnthr_buf_t **pbuf)
+{
+    ssize_t navail;
+    ssize_t nread;
+    mnthr_buf_t *buf;
+
+    assert(me != NULL);
+
+    if ((navail = mnthr_get_rbuflen(fd)) <= 0) {
+        TRRET(MNTHR_READ_BUF + 1);
+    }
+
+    buf = mnthr_buf_get(navail);
+
+    if ((nread = read(fd, buf->data, MIN((size_t)navail, buf->size))) == -1) {
+        perror("read");
+        mnthr_buf_put(buf);
+        TRRET(MNTHR_READ_BUF + 2);
+    }
+    mnthr_stats.bytes_read += nread;
+
+    if (nread == 0) {
+        mnthr_buf_put(buf);
+        TRRET(MNTHR_READ_BUF + 3);
+    }
+
+    buf->len = nread;
+    *pbuf = buf;
+
+    return 0;
+}
+
+
 /**
  * Perform a single read from fd into buf.
  * Return the number of bytes read or -1 in case of error.
@@ -1928,6 +2163,7 @@ mnthr_read_allb(int fd, char *buf, ssize_t sz)
         perror("read");
         return -1;
     }
+    mnthr_stats.bytes_read += nread;
 
     if (nread < sz) {
         //TRACE("nread=%ld sz=%ld", nread, sz);
@@ -1966,6 +2202,7 @@ mnthr_read_allb_et(int fd, char *buf, ssize_t sz)
             }
         }
         totread += nread;
+        mnthr_stats.bytes_read += nread;
         if (nread < nleft) {
             break;
         }
@@ -1994,6 +2231,7 @@ mnthr_recv_allb(int fd, char *buf, ssize_t sz, int flags)
         perror("recv");
         return -1;
     }
+    mnthr_stats.bytes_read += nread;
 
     if (nread < sz) {
         //TRACE("nread=%ld sz=%ld", nread, sz);
@@ -2032,6 +2270,7 @@ mnthr_recvfrom_allb(int fd,
         perror("recvfrom");
         return -1;
     }
+    mnthr_stats.bytes_read += nrecv;
 
     if (nrecv < sz) {
         //TRACE("nrecv=%ld sz=%ld", nrecv, sz);
@@ -2066,6 +2305,7 @@ mnthr_write_all(int fd, const char *buf, size_t len)
             TRRET(MNTHR_WRITE_ALL + 2);
         }
         remaining -= nwritten;
+        mnthr_stats.bytes_written += nwritten;
     }
     return 0;
 }
@@ -2096,6 +2336,7 @@ mnthr_write_all_et(int fd, const char *buf, size_t len)
         }
 
         remaining -= nwritten;
+        mnthr_stats.bytes_written += nwritten;
     }
     return 0;
 }
@@ -2122,6 +2363,7 @@ mnthr_send_all(int fd, const char *buf, size_t len, int flags)
             TRRET(MNTHR_WRITE_ALL + 2);
         }
         remaining -= nwritten;
+        mnthr_stats.bytes_written += nwritten;
     }
     return 0;
 }
@@ -2156,6 +2398,7 @@ mnthr_sendto_all(int fd,
             TRRET(MNTHR_SENDTO_ALL + 2);
         }
         remaining -= nwritten;
+        mnthr_stats.bytes_written += nwritten;
     }
     return 0;
 }
@@ -2310,9 +2553,8 @@ mnthr_signal_subscribe_with_timeout(mnthr_signal_t *signal,
     signal->owner = me;
     me->co.state = CO_STATE_SIGNAL_SUBSCRIBE;
     res = sleepmsec(msec);
-    if (me->expire_ticks == MNTHR_SLEEP_UNDEFINED) {
-        /* I had been sleeping, but was resumed by signal_send() ... */
-    } else {
+    if (res == 0 && signal->owner == me) {
+        /* neither delivered nor interrupted, see signal_deliver() */
         res = MNTHR_WAIT_TIMEOUT;
     }
     signal->owner = NULL;
@@ -2320,6 +2562,40 @@ mnthr_signal_subscribe_with_timeout(mnthr_signal_t *signal,
 }
 
 
+int
+mnthr_signal_subscribe_with_timeout_usec(mnthr_signal_t *signal,
+                                          uint64_t usec)
+{
+    int res;
+
+    signal->owner = me;
+    me->co.state = CO_STATE_SIGNAL_SUBSCRIBE;
+    res = sleepusec(usec);
+    if (res == 0 && signal->owner == me) {
+        res = MNTHR_WAIT_TIMEOUT;
+    }
+    signal->owner = NULL;
+    return res;
+}
+
+
+/*
+ * The owner is let go on delivery, so that a subscriber woken up with
+ * its owner still in place can tell it timed out.  Both wakeups look
+ * the same to it otherwise.
+ */
+static mnthr_ctx_t *
+signal_deliver(mnthr_signal_t *signal)
+{
+    mnthr_ctx_t *ctx;
+
+    ctx = signal->owner;
+    signal->owner = NULL;
+    set_resume(ctx);
+    return ctx;
+}
+
+
 void
 mnthr_signal_send(mnthr_signal_t *signal)
 {
@@ -2327,7 +2603,7 @@ mnthr_signal_send(mnthr_signal_t *signal)
     if (signal->owner != NULL) {
 
         if (signal->owner->co.state == CO_STATE_SIGNAL_SUBSCRIBE) {
-            set_resume(signal->owner);
+            (void)signal_deliver(signal);
             return;
 
         } else {
@@ -2347,7 +2623,7 @@ mnthr_signal_error(mnthr_signal_t *signal, int rc)
     if (signal->owner != NULL) {
         if (signal->owner->co.state == CO_STATE_SIGNAL_SUBSCRIBE) {
             signal->owner->co.rc = rc;
-            set_resume(signal->owner);
+            (void)signal_deliver(signal);
         }
     }
 }
@@ -2358,10 +2634,12 @@ mnthr_signal_error_and_join(mnthr_signal_t *signal, int rc)
 {
     if (signal->owner != NULL) {
         if (signal->owner->co.state == CO_STATE_SIGNAL_SUBSCRIBE) {
+            mnthr_ctx_t *ctx;
+
             signal->owner->co.rc = rc;
-            set_resume(signal->owner);
+            ctx = signal_deliver(signal);
             me->co.state = CO_STATE_JOIN_INTERRUPTED;
-            return join_waitq(&signal->owner->waitq);
+            return join_waitq(&ctx->waitq);
         }
     }
     return 0;
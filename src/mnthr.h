@@ -13,10 +13,13 @@
 #include <mndiag.h>
 
 #include <mncommon/dtqueue.h>
+#include <mncommon/stqueue.h>
 #include <mncommon/dumpm.h>
 #include <mncommon/util.h>
 #include <mncommon/bytestream.h>
 
+#include "mnthr_metrics.h"
+
 
 #ifdef __cplusplus
 extern "C" {
@@ -24,20 +27,34 @@ extern "C" {
 
 void mndiag_mnthr_str(int, char *, size_t);
 
+/*
+ * Logger, see log.c.  Every CTRACE() is a call site of its own, rate
+ * limited separately.
+ */
+typedef struct _mnthr_log_site {
+    uint64_t sec;
+    unsigned n;
+    unsigned suppressed;
+} mnthr_log_site_t;
+PRINTFLIKE(5, 6) void mnthr_log(mnthr_log_site_t *,
+                                const char *,
+                                int,
+                                const char *,
+                                const char *,
+                                ...);
+void mnthr_log_set_rate(unsigned);
+int mnthr_log_start(int);
+int mnthr_log_stop(void);
+
+/* the leading "%s" keeps a bare CTRACE() a valid format */
 #define CTRACE(s, ...)                                         \
     do {                                                       \
-        struct timeval _mnthr_ts;                             \
-        gettimeofday(&_mnthr_ts, NULL);                       \
-        struct tm *_mnthr_tm = localtime(&_mnthr_ts.tv_sec); \
-        char _mnthr_ss[64];                                   \
-        strftime(_mnthr_ss,                                   \
-                 sizeof(_mnthr_ss),                           \
-                 "%Y-%m-%d %H:%M:%S",                          \
-                 _mnthr_tm);                                  \
-        TRACE("%s.%06ld [% 4d] " s,                            \
-              _mnthr_ss,                                      \
-              (long)_mnthr_ts.tv_usec,                        \
-              mnthr_id(), ##__VA_ARGS__);                     \
+        static mnthr_log_site_t _mnthr_site;                  \
+        mnthr_log(&_mnthr_site,                               \
+                  __FILE__,                                    \
+                  __LINE__,                                    \
+                  __func__,                                    \
+                  "%s" s, "", ##__VA_ARGS__);                  \
     } while (0)                                                \
 
 
@@ -115,6 +132,22 @@ int mnthr_init(void);
 int mnthr_fini(void);
 int mnthr_loop(void);
 
+/*
+ * The poller backend, to be chosen before mnthr_init().  The
+ * MNTHR_BACKEND environment variable takes precedence.
+ */
+int mnthr_set_backend(const char *);
+const char *mnthr_get_backend(void);
+
+/*
+ * Driving the loop from a foreign event loop: run mnthr_loop_once()
+ * when mnthr_get_poll_fd() is readable, or mnthr_next_deadline() is
+ * due.
+ */
+int mnthr_loop_once(uint64_t);
+int mnthr_get_poll_fd(void);
+uint64_t mnthr_next_deadline(void);
+
 void mnthr_shutdown(void);
 bool mnthr_shutting_down(void);
 size_t mnthr_compact_sleepq(size_t);
@@ -122,11 +155,26 @@ size_t mnthr_get_sleepq_length(void);
 size_t mnthr_get_sleepq_volume(void);
 void mnthr_dump_all_ctxes(void);
 void mnthr_dump_sleepq(void);
+void mnthr_dump_blocked_sites(size_t);
+void mnthr_set_stall_threshold(uint64_t);
 size_t mnthr_gc(void);
 size_t mnthr_ctx_sizeof(void);
 size_t mnthr_set_stacksize(size_t);
+int mnthr_stackmap_open(const char *);
+void mnthr_stackmap_close(void);
+int mnthr_profiler_start(unsigned, size_t);
+int mnthr_profiler_stop(void);
+int mnthr_profiler_write_folded(const char *);
+int mnthr_metrics_open(const char *);
+void mnthr_metrics_close(void);
+void mnthr_metrics_get(mnthr_metrics_counters_t *);
+int mnthr_sim_init(uint64_t);
+bool mnthr_sim_enabled(void);
+int mnthr_sim_socketpair(int[2]);
 
 int mnthr_dump(const mnthr_ctx_t *);
+int mnthr_backtrace(const mnthr_ctx_t *, void **, int);
+void mnthr_dump_backtrace(const mnthr_ctx_t *);
 mnthr_ctx_t *mnthr_new(const char *, mnthr_cofunc_t, int, ...);
 #define MNTHR_NEW(name, f, ...)    \
     mnthr_new(name, f, MNASZ(__VA_ARGS__), ##__VA_ARGS__)
@@ -138,6 +186,29 @@ mnthr_ctx_t *mnthr_spawn_sig(const char *, mnthr_cofunc_t, int, ...);
 #define MNTHR_SPAWN_SIG(name, f, ...)  \
     mnthr_spawn_sig(name, f, MNASZ(__VA_ARGS__), ##__VA_ARGS__)
 PRINTFLIKE(2, 3) int mnthr_set_name(mnthr_ctx_t *, const char *, ...);
+const char *mnthr_get_name(const mnthr_ctx_t *);
+
+/*
+ * Interned thread names, and statistics per name, see names.c.
+ */
+typedef struct _mnthr_name_stats {
+    uint64_t spawns;
+    uint64_t exits;
+    uint64_t switches;
+    uint64_t io_waits;
+    uint64_t sleeps;
+    uint64_t sync_waits;
+    /* with mnthr_set_name_stats(true) */
+    uint64_t run_nsec;
+    uint64_t stack_hwm;
+} mnthr_name_stats_t;
+typedef int (*mnthr_name_stats_cb_t)(const char *,
+                                     const mnthr_name_stats_t *,
+                                     void *);
+int mnthr_name_intern(const char *);
+const char *mnthr_name_str(int);
+void mnthr_set_name_stats(bool);
+int mnthr_name_stats_traverse(mnthr_name_stats_cb_t, void *);
 mnthr_ctx_t *mnthr_me(void);
 int mnthr_id(void);
 
@@ -156,6 +227,9 @@ int mnthr_id(void);
 #define MNTHR_CO_RC_POLLER \
     MNDIAG_PUBLIC_CODE(MNDIAG_LIBRARY_MNTHR, 130, 5)
 
+#define MNTHR_CO_RC_PREEMPTED \
+    MNDIAG_PUBLIC_CODE(MNDIAG_LIBRARY_MNTHR, 130, 6)
+
 #define MNTHR_CO_RC_STR(rc) (                                         \
      (rc) == 0 ? "OK" :                                                \
      (rc) == (int)MNTHR_CO_RC_EXITED ? "EXITED" :                     \
@@ -163,6 +237,7 @@ int mnthr_id(void);
      (rc) == (int)MNTHR_CO_RC_TIMEDOUT ? "TIMEDOUT" :                 \
      (rc) == (int)MNTHR_CO_RC_SIMULTANEOUS ? "SIMULTANEOUS" :         \
      (rc) == (int)MNTHR_CO_RC_POLLER ? "POLLER" :                     \
+     (rc) == (int)MNTHR_CO_RC_PREEMPTED ? "PREEMPTED" :               \
      "UD"                                                              \
  )                                                                     \
 
@@ -190,6 +265,194 @@ MNTHR_CPOINT int mnthr_sleep_usec(uint64_t);
 MNTHR_CPOINT int mnthr_sleep_ticks(uint64_t);
 MNTHR_CPOINT int mnthr_yield(void);
 MNTHR_CPOINT int mnthr_giveup(void);
+
+/*
+ * Cooperative preemption.  mnthr_maybe_yield() is meant for long CPU
+ * bound loops: it only looks at the clock every
+ * MNTHR_SLICE_CHECK_INTERVAL calls, and yields once the current slice
+ * has run for longer than the budget set by mnthr_set_slice_budget().
+ */
+#define MNTHR_SLICE_CHECK_INTERVAL 64
+extern int mnthr_slice_countdown;
+void mnthr_set_slice_budget(uint64_t);
+MNTHR_CPOINT int mnthr_maybe_yield_slow(void);
+
+/*
+ * Timer signal preemption of threads that never reach
+ * mnthr_maybe_yield(), see mnthr_preempt_start().
+ */
+#define MNTHR_PREEMPT_YIELD 0
+#define MNTHR_PREEMPT_INTERRUPT 1
+int mnthr_preempt_start(uint64_t, int);
+int mnthr_preempt_stop(void);
+
+/*
+ * Scheduling groups (tenants).  Threads inherit the group of their
+ * spawner, CPU time is accounted per group, and in the fair mode
+ * (mnthr_set_fair_sched()) runnable threads are picked by the smallest
+ * weighted CPU time of their group.  A NULL group is the default one.
+ */
+typedef struct _mnthr_group mnthr_group_t;
+typedef struct _mnthr_group_stats {
+    uint64_t cpu_nsec;
+    uint64_t slices;
+    /* not maintained for the default group */
+    uint64_t nthreads;
+    /* runnable threads put off to the next loop iteration */
+    uint64_t deferred;
+} mnthr_group_stats_t;
+#define MNTHR_GROUP_WEIGHT_DEFAULT 100
+mnthr_group_t *mnthr_group_new(const char *, unsigned);
+void mnthr_group_destroy(mnthr_group_t *);
+void mnthr_group_set_weight(mnthr_group_t *, unsigned);
+const char *mnthr_group_name(const mnthr_group_t *);
+void mnthr_group_get_stats(const mnthr_group_t *, mnthr_group_stats_t *);
+void mnthr_set_group(mnthr_ctx_t *, mnthr_group_t *);
+mnthr_group_t *mnthr_get_group(mnthr_ctx_t *);
+void mnthr_set_fair_sched(uint64_t);
+
+/*
+ * Admission control.  The loop is overloaded when its smoothed lag
+ * (mnthr_get_loop_lag(), nsec) or the number of live threads is over the
+ * limit set by mnthr_set_admission(), and then new work is held off
+ * according to the policy.
+ */
+#define MNTHR_ADMIT_PAUSE_ACCEPT 0x01
+#define MNTHR_ADMIT_FAIL_SPAWN 0x02
+void mnthr_set_admission(uint64_t, size_t, unsigned);
+uint64_t mnthr_get_loop_lag(void);
+bool mnthr_overloaded(void);
+
+/*
+ * Worker pools.  A job is meant to be embedded in the caller's
+ * structure, and must stay valid until it is done.  It can be waited
+ * for with mnthr_job_wait(), and resubmitted after mnthr_job_init().
+ */
+typedef struct _mnthr_job mnthr_job_t;
+typedef int (*mnthr_job_func_t)(mnthr_job_t *);
+struct _mnthr_job {
+    STQUEUE_ENTRY(_mnthr_job, link);
+    mnthr_job_func_t fn;
+    void *udata;
+    uint64_t submitted;
+    int rc;
+    bool done;
+    mnthr_cond_t cond;
+};
+void mnthr_job_init(mnthr_job_t *, mnthr_job_func_t, void *);
+void mnthr_job_fini(mnthr_job_t *);
+bool mnthr_job_done(const mnthr_job_t *);
+MNTHR_CPOINT int mnthr_job_wait(mnthr_job_t *);
+
+typedef struct _mnthr_pool mnthr_pool_t;
+typedef struct _mnthr_pool_stats {
+    uint64_t submitted;
+    uint64_t completed;
+    uint64_t queue_depth;
+    uint64_t queue_depth_max;
+    uint64_t nworkers;
+    uint64_t spawned;
+    uint64_t retired;
+    /* nsec from submit to start */
+    uint64_t wait_nsec;
+    uint64_t wait_nsec_max;
+    /* nsec from submit to completion */
+    uint64_t latency_nsec;
+    uint64_t latency_nsec_max;
+} mnthr_pool_stats_t;
+mnthr_pool_t *mnthr_pool_new(const char *, unsigned, unsigned, uint64_t);
+int mnthr_pool_submit(mnthr_pool_t *, mnthr_job_t *);
+int mnthr_pool_submit_batch(mnthr_pool_t *, mnthr_job_t *[], size_t);
+void mnthr_pool_get_stats(const mnthr_pool_t *, mnthr_pool_stats_t *);
+MNTHR_CPOINT int mnthr_pool_destroy(mnthr_pool_t *);
+
+/*
+ * Micro-batching.  A submitter fills in the item's in, and parks until
+ * the handler has set its out and rc.  A non-zero handler's return
+ * value is the rc of every item in the batch.
+ */
+typedef struct _mnthr_batch_item {
+    DTQUEUE_ENTRY(_mnthr_batch_item, link);
+    void *in;
+    void *out;
+    int rc;
+    bool done;
+    mnthr_cond_t cond;
+} mnthr_batch_item_t;
+typedef int (*mnthr_batch_func_t)(mnthr_batch_item_t *[], size_t, void *);
+typedef struct _mnthr_batcher mnthr_batcher_t;
+typedef struct _mnthr_batcher_stats {
+    uint64_t batches;
+    uint64_t items;
+    uint64_t full_flushes;
+    uint64_t timer_flushes;
+    uint64_t cancelled;
+} mnthr_batcher_stats_t;
+mnthr_batcher_t *mnthr_batcher_new(const char *,
+                                   size_t,
+                                   uint64_t,
+                                   mnthr_batch_func_t,
+                                   void *);
+MNTHR_CPOINT int mnthr_batcher_submit(mnthr_batcher_t *, mnthr_batch_item_t *);
+void mnthr_batcher_get_stats(const mnthr_batcher_t *, mnthr_batcher_stats_t *);
+MNTHR_CPOINT int mnthr_batcher_destroy(mnthr_batcher_t *);
+
+/*
+ * Per thread arena.  Everything allocated with mnthr_alloc() is freed
+ * at once when the thread exits, or by mnthr_arena_reset(), or back to
+ * a mark by mnthr_arena_release().
+ */
+typedef struct _mnthr_arena_mark {
+    struct _mnthr_arena_chunk *chunk;
+    size_t used;
+} mnthr_arena_mark_t;
+void *mnthr_alloc(size_t);
+void *mnthr_alloc0(size_t);
+char *mnthr_strdup(const char *);
+mnthr_arena_mark_t mnthr_arena_mark(void);
+void mnthr_arena_release(mnthr_arena_mark_t);
+void mnthr_arena_reset(void);
+
+/*
+ * I/O buffer pool, see mnthr_read_buf().
+ */
+typedef struct _mnthr_buf {
+    char *data;
+    size_t size;
+    size_t len;
+    struct _mnthr_buf *next;
+    int cls;
+} mnthr_buf_t;
+#define MNTHR_BUFPOOL_HUGEPAGES 0x01
+void mnthr_bufpool_set_flags(unsigned);
+mnthr_buf_t *mnthr_buf_get(size_t);
+void mnthr_buf_put(mnthr_buf_t *);
+
+/*
+ * Give back the stack memory of threads parked for longer than msec,
+ * see hibernate.c.
+ */
+#define MNTHR_HIBERNATE_TRIM 0
+#define MNTHR_HIBERNATE_COPY 1
+int mnthr_set_hibernation(uint64_t, int);
+
+/*
+ * Placement of ctxes and stacks allocated from now on, see placement.c.
+ */
+#define MNTHR_PLACE_HUGE_CTXES 0x01
+#define MNTHR_PLACE_HUGE_STACKS 0x02
+#define MNTHR_PLACE_NUMA_LOCAL 0x04
+void mnthr_set_placement(unsigned);
+
+static inline int
+mnthr_maybe_yield(void)
+{
+    if (--mnthr_slice_countdown > 0) {
+        return 0;
+    }
+    return mnthr_maybe_yield_slow();
+}
+
 long double mnthr_ticks2sec(uint64_t);
 long double mnthr_ticksdiff2sec(int64_t);
 uint64_t mnthr_msec2ticks(uint64_t);
@@ -213,6 +476,7 @@ MNTHR_CPOINT int mnthr_wait_for_events(int, int *);
 MNTHR_CPOINT int mnthr_accept_all(int, mnthr_socket_t **, off_t *);
 MNTHR_CPOINT int mnthr_accept_all2(int, mnthr_socket_t **, off_t *);
 MNTHR_CPOINT int mnthr_read_all(int, char **, off_t *);
+MNTHR_CPOINT int mnthr_read_buf(int, mnthr_buf_t **);
 MNTHR_CPOINT ssize_t mnthr_read_allb(int, char *, ssize_t);
 MNTHR_CPOINT ssize_t mnthr_read_allb_et(int, char *, ssize_t);
 MNTHR_CPOINT ssize_t mnthr_recv_allb(int, char *, ssize_t, int);
@@ -268,6 +532,8 @@ mnthr_ctx_t *mnthr_signal_get_owner(mnthr_signal_t *);
 MNTHR_CPOINT int mnthr_signal_subscribe(mnthr_signal_t *);
 MNTHR_CPOINT int mnthr_signal_subscribe_with_timeout(mnthr_signal_t *,
                                                       uint64_t);
+MNTHR_CPOINT int mnthr_signal_subscribe_with_timeout_usec(mnthr_signal_t *,
+                                                           uint64_t);
 void mnthr_signal_send(mnthr_signal_t *);
 void mnthr_signal_error(mnthr_signal_t *, int);
 MNTHR_CPOINT int mnthr_signal_error_and_join(mnthr_signal_t *, int);
@@ -337,6 +603,12 @@ MNTHR_CPOINT int mnthr_wait_for(uint64_t, const char *, mnthr_cofunc_t, int, ...
 #define MNTHR_WAIT_FOR(timeout, name, f, ...)  \
     mnthr_wait_for(timeout, name, f, MNASZ(__VA_ARGS__), ##__VA_ARGS__)
 MNTHR_CPOINT int mnthr_peek(mnthr_ctx_t *, uint64_t);
+MNTHR_CPOINT int mnthr_race(mnthr_cofunc_t[],
+                            void *,
+                            int,
+                            uint64_t,
+                            uint64_t,
+                            int *);
 
 MNTHR_CPOINT ssize_t mnthr_bytestream_read_more(mnbytestream_t *, void *, ssize_t);
 MNTHR_CPOINT ssize_t mnthr_bytestream_read_more_et(mnbytestream_t *, void *, ssize_t);
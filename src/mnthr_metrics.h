@@ -0,0 +1,119 @@
+#ifndef MNTHR_METRICS_H
+#define MNTHR_METRICS_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Layout of the metrics region published by mnthr_metrics_open().
+ *
+ * The region is updated by the loop once per iteration under a
+ * sequence lock: seq is odd while an update is in progress.  Counters
+ * are only ever appended to MNTHR_METRICS_COUNTERS, so that readers
+ * built against an older layout keep working: they read
+ * MIN(ncounters, their own number of counters).  An incompatible change
+ * bumps MNTHR_METRICS_VERSION.
+ */
+#define MNTHR_METRICS_MAGIC 0x6d6e7468726d7472ULL /* "mnthrmtr" */
+#define MNTHR_METRICS_VERSION 1
+
+#define MNTHR_METRICS_COUNTERS(X)      \
+    X(spawns)                          \
+    X(exits)                           \
+    X(switches)                        \
+    X(ctxes)                           \
+    X(free_ctxes)                      \
+    X(sleepq_length)                   \
+    X(poller_wakeups)                  \
+    X(poller_events)                   \
+    X(bytes_read)                      \
+    X(bytes_written)                   \
+    X(poller_iterations)               \
+    X(poller_empty_wakeups)            \
+    X(poller_events_max)               \
+    X(poller_reg_add)                  \
+    X(poller_reg_del)                  \
+    X(poller_ioctls)                   \
+    X(poller_timer_updates)            \
+    X(slice_yields)                    \
+    X(preemptions)                     \
+    X(loop_lag_nsec)                   \
+    X(admission_pauses)                \
+    X(admission_rejects)               \
+    X(arena_chunk_allocs)              \
+    X(arena_chunk_reuses)              \
+    X(bufpool_slab_bytes)              \
+    X(bufpool_borrowed)                \
+    X(hibernations)                    \
+    X(hibernated)                      \
+    X(hibernated_bytes)                \
+    X(hibernate_released_bytes)        \
+    X(ctx_slab_bytes)                  \
+    X(log_lines)                       \
+    X(log_suppressed)                  \
+    X(log_dropped)
+
+typedef struct _mnthr_metrics_counters {
+#define MNTHR_METRICS_FIELD(n) uint64_t n;
+    MNTHR_METRICS_COUNTERS(MNTHR_METRICS_FIELD)
+#undef MNTHR_METRICS_FIELD
+} mnthr_metrics_counters_t;
+
+#define MNTHR_METRICS_NCOUNTERS \
+    (sizeof(mnthr_metrics_counters_t) / sizeof(uint64_t))
+
+typedef struct _mnthr_metrics {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t ncounters;
+    uint64_t pid;
+    uint64_t seq;
+    /* mnthr_get_now_nsec() of the last update */
+    uint64_t updated;
+    mnthr_metrics_counters_t c;
+} mnthr_metrics_t;
+
+
+/**
+ * Take a consistent snapshot of the counters.  Return 0 on success, or
+ * -1 if the region is not a compatible metrics region.
+ */
+static inline int
+mnthr_metrics_read(const mnthr_metrics_t *m, mnthr_metrics_counters_t *c)
+{
+    uint64_t seq0, seq1;
+    uint32_t i, n;
+
+    if (m->magic != MNTHR_METRICS_MAGIC ||
+        m->version != MNTHR_METRICS_VERSION) {
+        return -1;
+    }
+
+    n = m->ncounters < MNTHR_METRICS_NCOUNTERS ?
+        m->ncounters : MNTHR_METRICS_NCOUNTERS;
+
+    do {
+        while ((seq0 = __atomic_load_n(&m->seq, __ATOMIC_ACQUIRE)) & 1) {
+        }
+        for (i = 0; i < n; ++i) {
+            ((uint64_t *)c)[i] = ((const volatile uint64_t *)&m->c)[i];
+        }
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        seq1 = __atomic_load_n(&m->seq, __ATOMIC_RELAXED);
+    } while (seq0 != seq1);
+
+    for (; i < MNTHR_METRICS_NCOUNTERS; ++i) {
+        ((uint64_t *)c)[i] = 0;
+    }
+
+    return 0;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
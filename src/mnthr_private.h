@@ -5,6 +5,7 @@
 #   include "config.h"
 #endif
 
+#include <stdbool.h>
 #include <stdint.h> /* UINTMAX_MAX */
 
 #include <netinet/in.h>
@@ -33,6 +34,8 @@
 #include <mncommon/rbt.h>
 #include <mncommon/util.h>
 
+#include "mnthr_metrics.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -72,7 +75,8 @@ struct _mnthr_ctx {
         ucontext_t uc;
         char *stack;
         int64_t id;
-        char name[8];
+        /* interned name id, see names.c */
+        int nid;
         int (*f)(int, void *[]);
         void **argv;
         /* weakref */
@@ -155,7 +159,8 @@ struct _mnthr_ctx {
          *  - mnthr_sleep()
          *  - mnthr_set_interrupt_and_join_with_timeout() + library codes
          *      MNTHR_JOIN_FAILURE, MNTHR_WAIT_TIMEOUT
-         *  - mnthr_signal_subscribe_with_timeout() + library codes
+         *  - mnthr_signal_subscribe_with_timeout(),
+         *    mnthr_signal_subscribe_with_timeout_usec() + library codes
          *      MNTHR_WAIT_TIMEOUT
          *  - mnthr_wait_for() + library code MNTHR_WAIT_TIMEOUT
          *
@@ -217,10 +222,30 @@ struct _mnthr_ctx {
     DTQUEUE_ENTRY(_mnthr_ctx, free_link);
 
     /*
-     * Membership of this ctx in runq.
+     * Membership of this ctx in runq, or in its group's runq in the
+     * fair mode.
      */
     STQUEUE_ENTRY(_mnthr_ctx, runq_link);
 
+    /*
+     * Scheduling group, NULL for the default one.
+     */
+    struct _mnthr_group *group;
+
+    /*
+     * Arena chunks, the current one first, see arena.c.
+     */
+    struct _mnthr_arena_chunk *arena;
+
+    /*
+     * When it was last switched out, and its stack hibernation state,
+     * see hibernate.c.
+     */
+    uint64_t parked_at;
+    bool hibernating;
+    void *hibernated;
+    size_t hibernated_sz;
+
     /*
      * event lookup in kevents0,
      * specifically for mnthr_clear_event()
@@ -286,8 +311,32 @@ struct _mnthr_profile {
 
 #define MNTHR_DEFAULT_WBUFLEN (1024*1024)
 
+/* longest thread name mnthr_set_name() makes */
+#define MNTHR_NAME_MAX 64
+
+/*
+ * Saved machine context accessors: program counter, frame pointer and
+ * stack pointer of a ctx parked in swapcontext().
+ */
+#if defined(__linux__) && defined(__x86_64__)
+#   define MNTHR_UC_PC(uc) ((uintptr_t)(uc)->uc_mcontext.gregs[REG_RIP])
+#   define MNTHR_UC_FP(uc) ((uintptr_t)(uc)->uc_mcontext.gregs[REG_RBP])
+#   define MNTHR_UC_SP(uc) ((uintptr_t)(uc)->uc_mcontext.gregs[REG_RSP])
+#elif defined(__linux__) && defined(__aarch64__)
+#   define MNTHR_UC_PC(uc) ((uintptr_t)(uc)->uc_mcontext.pc)
+#   define MNTHR_UC_FP(uc) ((uintptr_t)(uc)->uc_mcontext.regs[29])
+#   define MNTHR_UC_SP(uc) ((uintptr_t)(uc)->uc_mcontext.sp)
+#elif defined(__FreeBSD__) && defined(__amd64__)
+#   define MNTHR_UC_PC(uc) ((uintptr_t)(uc)->uc_mcontext.mc_rip)
+#   define MNTHR_UC_FP(uc) ((uintptr_t)(uc)->uc_mcontext.mc_rbp)
+#   define MNTHR_UC_SP(uc) ((uintptr_t)(uc)->uc_mcontext.mc_rsp)
+#endif
+
+#define MNTHR_BACKTRACE_DEPTH 32
+
 #define CO_FLAG_INITIALIZED 0x01
 #define CO_FLAG_SHUTDOWN 0x02
+#define CO_FLAG_SIMULATION 0x04
 extern int mnthr_flags;
 extern struct _mnthr_ctx *me;
 extern ucontext_t main_uc;
@@ -298,6 +347,71 @@ void push_free_ctx(struct _mnthr_ctx *);
 void sleepq_remove(struct _mnthr_ctx *);
 void set_resume_fast(struct _mnthr_ctx *);
 void mnthr_ctx_finalize(struct _mnthr_ctx *);
+int ctxes_traverse(int (*)(struct _mnthr_ctx *, void *), void *);
+
+int mnthr_fp_walk(uintptr_t, uintptr_t, uintptr_t, uintptr_t, void **, int);
+void profiler_fini(void);
+void ctxes_count(size_t *, size_t *);
+
+/* virtual clock origin in the simulation mode */
+#define MNTHR_SIM_EPOCH (1000000000000ul)
+#define SIM_SHUFFLE() \
+    ((mnthr_flags & CO_FLAG_SIMULATION) && sim_shuffle())
+bool sim_shuffle(void);
+void sim_polled(bool);
+bool sim_advance(uint64_t *);
+void sim_fini(void);
+
+extern struct _mnthr_ctx * volatile preempt_ctx;
+void preempt_check(struct _mnthr_ctx *);
+
+struct _mnthr_group;
+extern uint64_t fair_batch_nsec;
+void groups_init(void);
+void group_set(struct _mnthr_ctx *, struct _mnthr_group *);
+/* the group of the thread running, NULL for the default one */
+extern struct _mnthr_group *slice_group;
+void group_account(struct _mnthr_group *, uint64_t);
+void group_enqueue_bucket(struct _mnthr_ctx *, uint64_t);
+void group_run(void);
+uint64_t monotonic_nsec(void);
+
+extern unsigned admission_policy;
+void loop_lag_update(uint64_t);
+int admission_pause(void);
+uint64_t poller_ticks2nsec(uint64_t);
+bool poller_changes_pending(void);
+
+void arena_fini(struct _mnthr_ctx *);
+void arena_cache_flush(void);
+void bufpool_fini(void);
+
+extern uint64_t hibernate_idle_nsec;
+void hibernate_sweep(void);
+void hibernate_wakeup(struct _mnthr_ctx *);
+void hibernate_discard(struct _mnthr_ctx *);
+
+#define PLACEMENT_HUGETLB 0x01
+#define PLACEMENT_THP 0x02
+extern unsigned placement_flags;
+void *placement_mmap(size_t, unsigned);
+struct _mnthr_ctx *placement_ctx_alloc(void);
+void placement_ctx_free(struct _mnthr_ctx *);
+void placement_fini(void);
+
+extern char **name_strs;
+struct _mnthr_name_stats;
+extern struct _mnthr_name_stats *name_stats;
+extern bool name_stats_timing;
+#define CO_NAME(ctx) (name_strs[(ctx)->co.nid])
+void names_init(void);
+void names_fini(void);
+
+void log_fini(void);
+
+extern mnthr_metrics_counters_t mnthr_stats;
+extern mnthr_metrics_t *mnthr_metrics;
+void metrics_publish(void);
 
 uint64_t poller_usec2ticks_absolute(uint64_t);
 uint64_t poller_msec2ticks_absolute(uint64_t);
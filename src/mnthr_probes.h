@@ -0,0 +1,29 @@
+#ifndef MNTHR_PROBES_H
+#define MNTHR_PROBES_H
+
+/*
+ * Static user-level (USDT) probes of the "mnthr" provider.
+ *
+ *  spawn(id, name)             a thread was created
+ *  resume(id, name)            the scheduler is switching to a thread
+ *  yield(id, name, state)      a thread is switching back to the
+ *                              scheduler
+ *  exit(id, name, rc)          a thread has returned
+ *  io_wait(id, fd, filter)     a thread is going to wait for I/O
+ *  timer_fire(id, name, late)  a sleep has expired, late is the
+ *                              lateness in ticks
+ *
+ * Without <sys/sdt.h> they compile to nothing.  With it, every probe is
+ * a single nop until attached to.
+ */
+
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+#   define MNTHR_PROBE2(name, a, b) DTRACE_PROBE2(mnthr, name, a, b)
+#   define MNTHR_PROBE3(name, a, b, c) DTRACE_PROBE3(mnthr, name, a, b, c)
+#else
+#   define MNTHR_PROBE2(name, a, b)
+#   define MNTHR_PROBE3(name, a, b, c)
+#endif
+
+#endif
@@ -0,0 +1,223 @@
+/**
+ * Interned thread names and per name statistics.
+ *
+ * A thread name is interned once into the table of the loop, and the
+ * ctx only holds its small integer id (co.nid).  Per name statistics
+ * are kept in name_stats[], indexed by the same id, so that accounting
+ * on the switch path is an array access.  Id 0 is the empty name.
+ *
+ * Spawns, exits, switches and waits are always counted.  The run time
+ * and the stack high water mark take a clock read and a look at the
+ * saved stack pointer on every switch, and are only collected after
+ * mnthr_set_name_stats(true).  The stack high water mark is the deepest
+ * point a thread was ever switched out at, not a true peak.
+ *
+ * The table is capped at NAMES_MAX names, to stay bounded when names are
+ * made up of per request data.  Names past the cap are not kept, and
+ * are accounted for under the empty name.
+ */
+#include <assert.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_CONFIG_H
+#   include "config.h"
+#endif
+
+#ifdef DO_MEMDEBUG
+#include <mncommon/memdebug.h>
+MEMDEBUG_DECLARE(mnthr_names);
+#endif
+
+#include <mncommon/btrie.h>
+#include <mncommon/fasthash.h>
+#include <mncommon/hash.h>
+
+#include "mnthr_private.h"
+
+//#define TRACE_VERBOSE
+#include "diag.h"
+#include <mncommon/dumpm.h>
+
+#define NAMES_MAX 65536
+
+typedef struct _name_item {
+    uint64_t hash;
+    const char *name;
+    int nid;
+} name_item_t;
+
+static mnhash_t names;
+char **name_strs = NULL;
+mnthr_name_stats_t *name_stats = NULL;
+static size_t names_elnum = 0;
+static size_t names_sz = 0;
+bool name_stats_timing = false;
+
+
+static uint64_t
+name_item_hash(name_item_t *it)
+{
+    if (it->hash == 0) {
+        it->hash = fasthash(0,
+                            (const unsigned char *)it->name,
+                            strlen(it->name));
+    }
+    return it->hash;
+}
+
+
+static int
+name_item_cmp(name_item_t *a, name_item_t *b)
+{
+    uint64_t ha, hb;
+
+    ha = name_item_hash(a);
+    hb = name_item_hash(b);
+    if (ha != hb) {
+        return MNCMP(ha, hb);
+    }
+    return strcmp(a->name, b->name);
+}
+
+
+static int
+name_item_fini(name_item_t *it, UNUSED void *v)
+{
+    free(it);
+    return 0;
+}
+
+
+static int
+names_add(const char *name)
+{
+    name_item_t *it;
+    int nid;
+
+    if (names_elnum == names_sz) {
+        names_sz = names_sz != 0 ? names_sz * 2 : 64;
+        if ((name_strs = realloc(name_strs,
+                                 names_sz * sizeof(char *))) == NULL) {
+            FAIL("realloc");
+        }
+        if ((name_stats = realloc(name_stats,
+                                  names_sz *
+                                  sizeof(mnthr_name_stats_t))) == NULL) {
+            FAIL("realloc");
+        }
+    }
+    nid = (int)names_elnum++;
+    if ((name_strs[nid] = strdup(name)) == NULL) {
+        FAIL("strdup");
+    }
+    memset(&name_stats[nid], 0, sizeof(mnthr_name_stats_t));
+
+    if ((it = malloc(sizeof(name_item_t))) == NULL) {
+        FAIL("malloc");
+    }
+    it->hash = 0;
+    it->name = name_strs[nid];
+    it->nid = nid;
+    hash_set_item(&names, it, NULL);
+    return nid;
+}
+
+
+/**
+ * Return the id of name, interning it if seen for the first time.
+ */
+int
+mnthr_name_intern(const char *name)
+{
+    mnhash_item_t *hit;
+    name_item_t probe;
+
+    if (*name == '\0') {
+        return 0;
+    }
+    probe.hash = 0;
+    probe.name = name;
+    if ((hit = hash_get_item(&names, &probe)) != NULL) {
+        return ((name_item_t *)hit->key)->nid;
+    }
+    if (names_elnum >= NAMES_MAX) {
+        return 0;
+    }
+    return names_add(name);
+}
+
+
+const char *
+mnthr_name_str(int nid)
+{
+    assert(nid >= 0 && (size_t)nid < names_elnum);
+    return name_strs[nid];
+}
+
+
+const char *
+mnthr_get_name(const mnthr_ctx_t *ctx)
+{
+    return CO_NAME(ctx);
+}
+
+
+/**
+ * Collect the run time and the stack high water mark per name too.
+ */
+void
+mnthr_set_name_stats(bool timing)
+{
+    name_stats_timing = timing;
+}
+
+
+/**
+ * Call cb for every name with its statistics, until it returns
+ * non-zero, which is then returned.
+ */
+int
+mnthr_name_stats_traverse(mnthr_name_stats_cb_t cb, void *udata)
+{
+    size_t i;
+    int res;
+
+    for (i = 0; i < names_elnum; ++i) {
+        if ((res = cb(name_strs[i], &name_stats[i], udata)) != 0) {
+            return res;
+        }
+    }
+    return 0;
+}
+
+
+void
+names_init(void)
+{
+    hash_init(&names,
+              4093,
+              (hash_hashfn_t)name_item_hash,
+              (hash_item_comparator_t)name_item_cmp,
+              (hash_item_finalizer_t)name_item_fini);
+    (void)names_add("");
+}
+
+
+void
+names_fini(void)
+{
+    size_t i;
+
+    hash_fini(&names);
+    for (i = 0; i < names_elnum; ++i) {
+        free(name_strs[i]);
+    }
+    free(name_strs);
+    name_strs = NULL;
+    free(name_stats);
+    name_stats = NULL;
+    names_elnum = 0;
+    names_sz = 0;
+}
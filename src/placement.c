@@ -0,0 +1,269 @@
+/**
+ * Memory placement of ctxes and stacks.
+ *
+ * By default every mnthr_ctx_t is malloc(3)'ed, and every stack is a
+ * mapping of its own.  mnthr_set_placement() changes that for the
+ * ctxes and stacks allocated afterwards:
+ *
+ *  - MNTHR_PLACE_HUGE_CTXES: ctxes are carved out of PLACEMENT_SLAB_SIZE
+ *    slabs backed by huge pages (MAP_HUGETLB, or MADV_HUGEPAGE when
+ *    none are reserved), cache line aligned, so that walking many of
+ *    them takes few TLB entries.  Slabs are kept until mnthr_fini().
+ *
+ *  - MNTHR_PLACE_HUGE_STACKS: stacks are advised to be backed by
+ *    transparent huge pages.  As the guard page of a stack cannot be
+ *    part of a huge page, this only pays off with stacks of a huge page
+ *    or more, see mnthr_set_stacksize().
+ *
+ *  - MNTHR_PLACE_NUMA_LOCAL: the slabs, the stacks and the bufpool.c
+ *    slabs prefer the NUMA node of the CPU mnthr_set_placement() was
+ *    called on, which is expected to be the one the loop is pinned to.
+ *    Linux only.
+ */
+#include <assert.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#ifdef HAVE_CONFIG_H
+#   include "config.h"
+#endif
+
+#ifdef HAVE_LINUX_MEMPOLICY_H
+#   include <linux/mempolicy.h>
+#   include <sys/syscall.h>
+#endif
+
+#ifdef DO_MEMDEBUG
+#include <mncommon/memdebug.h>
+MEMDEBUG_DECLARE(mnthr_placement);
+#endif
+
+#include <mncommon/btrie.h>
+
+#include "mnthr_private.h"
+
+//#define TRACE_VERBOSE
+#include "diag.h"
+#include <mncommon/dumpm.h>
+
+#define PLACEMENT_HUGE_SIZE (2 * 1024 * 1024)
+#define PLACEMENT_SLAB_SIZE PLACEMENT_HUGE_SIZE
+#define PLACEMENT_CTX_ALIGN 64
+#define PLACEMENT_CTX_SIZE                     \
+    ((sizeof(mnthr_ctx_t) + PLACEMENT_CTX_ALIGN - 1) & \
+     ~((size_t)PLACEMENT_CTX_ALIGN - 1))
+
+struct placement_slab {
+    struct placement_slab *next;
+    void *mem;
+};
+
+/* a free slot of a slab */
+struct placement_slot {
+    struct placement_slot *next;
+};
+
+unsigned placement_flags = 0;
+static int numa_node = -1;
+static struct placement_slab *slabs = NULL;
+static struct placement_slot *free_slots = NULL;
+
+
+void
+mnthr_set_placement(unsigned flags)
+{
+    placement_flags = flags;
+    numa_node = -1;
+#if defined(HAVE_LINUX_MEMPOLICY_H) && defined(SYS_getcpu)
+    if (flags & MNTHR_PLACE_NUMA_LOCAL) {
+        unsigned cpu, node;
+
+        if (syscall(SYS_getcpu, &cpu, &node, NULL) == 0 &&
+            node < sizeof(unsigned long) * 8) {
+            numa_node = (int)node;
+        }
+    }
+#endif
+}
+
+
+static void
+placement_bind(UNUSED void *mem, UNUSED size_t sz)
+{
+#if defined(HAVE_LINUX_MEMPOLICY_H) && defined(SYS_mbind)
+    if (numa_node >= 0) {
+        unsigned long mask;
+
+        mask = 1ul << numa_node;
+        /* a preference, not to fail on a full node */
+        (void)syscall(SYS_mbind,
+                      mem,
+                      sz,
+                      MPOL_PREFERRED,
+                      &mask,
+                      sizeof(mask) * 8,
+                      0);
+    }
+#endif
+}
+
+
+/**
+ * Like mmap(2) of sz anonymous bytes, with an optional huge page
+ * backing, and bound to the NUMA node of the loop if so configured.
+ * MAP_FAILED on failure.
+ */
+void *
+placement_mmap(size_t sz, unsigned flags)
+{
+    void *mem;
+
+    mem = MAP_FAILED;
+#ifdef MAP_HUGETLB
+    if ((flags & PLACEMENT_HUGETLB) && sz % PLACEMENT_HUGE_SIZE == 0) {
+        mem = mmap(NULL,
+                   sz,
+                   PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANON | MAP_HUGETLB,
+                   -1,
+                   0);
+    }
+#endif
+    if (mem == MAP_FAILED) {
+        if ((flags & (PLACEMENT_HUGETLB | PLACEMENT_THP)) &&
+            sz >= PLACEMENT_HUGE_SIZE) {
+            uintptr_t addr, aligned;
+
+            /*
+             * Huge pages need aligned memory: map a huge page more, and
+             * trim it off on both sides.
+             */
+            if ((mem = mmap(NULL,
+                            sz + PLACEMENT_HUGE_SIZE,
+                            PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANON,
+                            -1,
+                            0)) == MAP_FAILED) {
+                return MAP_FAILED;
+            }
+            addr = (uintptr_t)mem;
+            aligned = (addr + PLACEMENT_HUGE_SIZE - 1) &
+                ~((uintptr_t)PLACEMENT_HUGE_SIZE - 1);
+            if (aligned > addr) {
+                (void)munmap(mem, aligned - addr);
+            }
+            if (aligned + sz < addr + sz + PLACEMENT_HUGE_SIZE) {
+                (void)munmap((void *)(aligned + sz),
+                             addr + PLACEMENT_HUGE_SIZE - aligned);
+            }
+            mem = (void *)aligned;
+        } else {
+            if ((mem = mmap(NULL,
+                            sz,
+                            PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANON,
+                            -1,
+                            0)) == MAP_FAILED) {
+                return MAP_FAILED;
+            }
+        }
+#ifdef MADV_HUGEPAGE
+        if (flags & (PLACEMENT_HUGETLB | PLACEMENT_THP)) {
+            (void)madvise(mem, sz, MADV_HUGEPAGE);
+        }
+#endif
+    }
+    placement_bind(mem, sz);
+    return mem;
+}
+
+
+static void
+placement_grow(void)
+{
+    struct placement_slab *slab;
+    size_t i, n;
+
+    if ((slab = malloc(sizeof(struct placement_slab))) == NULL) {
+        FAIL("malloc");
+    }
+    if ((slab->mem = placement_mmap(PLACEMENT_SLAB_SIZE,
+                                    PLACEMENT_HUGETLB)) == MAP_FAILED) {
+        FAIL("placement_mmap");
+    }
+    slab->next = slabs;
+    slabs = slab;
+    mnthr_stats.ctx_slab_bytes += PLACEMENT_SLAB_SIZE;
+
+    /* in the address order */
+    n = PLACEMENT_SLAB_SIZE / PLACEMENT_CTX_SIZE;
+    for (i = n; i > 0; --i) {
+        struct placement_slot *slot;
+
+        slot = (struct placement_slot *)
+            ((char *)slab->mem + (i - 1) * PLACEMENT_CTX_SIZE);
+        slot->next = free_slots;
+        free_slots = slot;
+    }
+}
+
+
+mnthr_ctx_t *
+placement_ctx_alloc(void)
+{
+    struct placement_slot *slot;
+    mnthr_ctx_t *ctx;
+
+    if (!(placement_flags & MNTHR_PLACE_HUGE_CTXES)) {
+        if ((ctx = malloc(sizeof(mnthr_ctx_t))) == NULL) {
+            FAIL("malloc");
+        }
+        return ctx;
+    }
+    if (free_slots == NULL) {
+        placement_grow();
+    }
+    slot = free_slots;
+    free_slots = slot->next;
+    return (mnthr_ctx_t *)slot;
+}
+
+
+void
+placement_ctx_free(mnthr_ctx_t *ctx)
+{
+    struct placement_slab *slab;
+
+    /* the flags may have changed since it was allocated */
+    for (slab = slabs; slab != NULL; slab = slab->next) {
+        if ((char *)ctx >= (char *)slab->mem &&
+            (char *)ctx < (char *)slab->mem + PLACEMENT_SLAB_SIZE) {
+            struct placement_slot *slot;
+
+            slot = (struct placement_slot *)ctx;
+            slot->next = free_slots;
+            free_slots = slot;
+            return;
+        }
+    }
+    free(ctx);
+}
+
+
+/**
+ * Called after all ctxes have been freed.
+ */
+void
+placement_fini(void)
+{
+    struct placement_slab *slab;
+
+    while ((slab = slabs) != NULL) {
+        slabs = slab->next;
+        (void)munmap(slab->mem, PLACEMENT_SLAB_SIZE);
+        free(slab);
+    }
+    free_slots = NULL;
+    mnthr_stats.ctx_slab_bytes = 0;
+}
@@ -1,5 +1,8 @@
 #include <assert.h>
 #include <errno.h>
+#include <inttypes.h>
+#include <time.h>
+#include <sys/mman.h> /* MAP_FAILED */
 
 #define NO_PROFILE
 #include <mncommon/profile.h>
@@ -15,6 +18,7 @@ MEMDEBUG_DECLARE(mnthr_poller);
 #include <mncommon/btrie.h>
 
 #include "mnthr_private.h"
+#include "mnthr_probes.h"
 
 //#define TRACE_VERBOSE
 //#define TRRET_DEBUG
@@ -30,11 +34,144 @@ extern const profile_t *mnthr_swap_p;
 extern const profile_t *mnthr_sched0_p;
 extern const profile_t *mnthr_sched1_p;
 
+/*
+ * Threads running longer than this in a single slice are reported as
+ * stalls.  0 - disabled.
+ */
+static uint64_t stall_threshold_nsec = 0;
+
+
+uint64_t
+monotonic_nsec(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0) {
+        FAIL("clock_gettime");
+    }
+    return ts.tv_nsec + ts.tv_sec * 1000000000;
+}
+
+
+void
+mnthr_set_stall_threshold(uint64_t msec)
+{
+    stall_threshold_nsec = msec * 1000000;
+}
+
+
+/*
+ * Slice budget for mnthr_maybe_yield(), 0 - never yield.  The slice is
+ * timed from its first clock check, so that resuming a thread costs
+ * nothing extra.
+ */
+static uint64_t slice_budget_nsec = 10000000;
+static uint64_t slice_check_start = 0;
+int mnthr_slice_countdown = MNTHR_SLICE_CHECK_INTERVAL;
+/* the previous poller_sift_sleepq(), for the loop lag */
+static uint64_t last_sift_ticks = 0;
+
+
+void
+mnthr_set_slice_budget(uint64_t usec)
+{
+    slice_budget_nsec = usec * 1000;
+}
+
+
+int
+mnthr_maybe_yield_slow(void)
+{
+    uint64_t now;
+
+    mnthr_slice_countdown = MNTHR_SLICE_CHECK_INTERVAL;
+
+    if (me == NULL) {
+        return 0;
+    }
+
+    if (preempt_ctx == me) {
+        /* a runaway, see preempt.c */
+        return mnthr_yield();
+    }
+
+    if (slice_budget_nsec == 0) {
+        return 0;
+    }
+
+    if (mnthr_flags & CO_FLAG_SIMULATION) {
+        /*
+         * the virtual clock stands still while threads run, count the
+         * checks instead to stay deterministic
+         */
+        ++mnthr_stats.slice_yields;
+        return mnthr_yield();
+    }
+
+    now = monotonic_nsec();
+    if (slice_check_start == 0) {
+        slice_check_start = now;
+        return 0;
+    }
+    if (now - slice_check_start < slice_budget_nsec) {
+        return 0;
+    }
+
+    ++mnthr_stats.slice_yields;
+    return mnthr_yield();
+}
+
+
+static void
+report_stall(mnthr_ctx_t *ctx, uint64_t elapsed)
+{
+    CTRACE("stall: thread ran for %"PRIu64" msec", elapsed / 1000000);
+    mnthr_dump(ctx);
+    if (ctx->co.state & CO_STATE_RESUMABLE) {
+        /* where it yielded after the stall */
+        mnthr_dump_backtrace(ctx);
+    }
+}
+
+
+static void
+name_account_wait(mnthr_ctx_t *ctx, int nid)
+{
+    mnthr_name_stats_t *ns;
+
+    ns = &name_stats[nid];
+    if (ctx->co.state & (CO_STATE_READ |
+                         CO_STATE_WRITE |
+                         CO_STATE_OTHER_POLLER)) {
+        ++ns->io_waits;
+    } else if (ctx->co.state == CO_STATE_SLEEP) {
+        ++ns->sleeps;
+    } else {
+        ++ns->sync_waits;
+    }
+
+#ifdef MNTHR_UC_SP
+    if (name_stats_timing && ctx->co.stack != MAP_FAILED) {
+        uint64_t depth;
+
+        depth = (uintptr_t)ctx->co.stack +
+                ctx->co.uc.uc_stack.ss_size -
+                MNTHR_UC_SP(&ctx->co.uc);
+        if (depth > ns->stack_hwm) {
+            ns->stack_hwm = depth;
+        }
+    }
+#endif
+}
+
 
 int
 poller_resume(mnthr_ctx_t *ctx)
 {
     int res;
+    uint64_t slice_start = 0;
+    mnthr_group_t *group;
+    int nid;
 
     /*
      * Can only be the result of yield or start, ie, the state cannot be
@@ -57,12 +194,53 @@ poller_resume(mnthr_ctx_t *ctx)
     //mnthr_dump(ctx);
 #endif
 
+    MNTHR_PROBE2(resume, ctx->co.id, CO_NAME(ctx));
+    ++mnthr_stats.switches;
+
+    /* the name may change while it runs, see names.c */
+    nid = ctx->co.nid;
+    ++name_stats[nid].switches;
+
+    /*
+     * ctx->group is reset if it exits, and the group is gone if it gets
+     * destroyed during the slice, see mnthr_group_destroy().
+     */
+    group = ctx->group;
+    slice_group = group;
+    if (stall_threshold_nsec != 0 ||
+        group != NULL ||
+        fair_batch_nsec != 0 ||
+        name_stats_timing) {
+        slice_start = monotonic_nsec();
+    }
+    mnthr_slice_countdown = MNTHR_SLICE_CHECK_INTERVAL;
+    slice_check_start = 0;
+
+    if (ctx->hibernating) {
+        hibernate_wakeup(ctx);
+    }
+
     PROFILE_STOP(mnthr_sched0_p);
     PROFILE_START(mnthr_swap_p);
     res = swapcontext(&main_uc, &me->co.uc);
     PROFILE_STOP(mnthr_swap_p);
     PROFILE_START(mnthr_sched0_p);
 
+    if (hibernate_idle_nsec != 0 && ctx->co.id != -1) {
+        ctx->parked_at = monotonic_nsec();
+    }
+
+    if (slice_start != 0) {
+        uint64_t elapsed;
+
+        elapsed = monotonic_nsec() - slice_start;
+        group_account(slice_group, elapsed);
+        name_stats[nid].run_nsec += elapsed;
+        if (stall_threshold_nsec != 0 && elapsed > stall_threshold_nsec) {
+            report_stall(ctx, elapsed);
+        }
+    }
+
 #ifdef TRACE_VERBOSE
     CTRACE("back from resume <<<");
     //mnthr_dump(me);
@@ -80,7 +258,12 @@ poller_resume(mnthr_ctx_t *ctx)
     assert(me == ctx);
     me = NULL;
 
+    if (preempt_ctx != NULL) {
+        preempt_check(ctx);
+    }
+
     if (ctx->co.state & CO_STATE_RESUMABLE) {
+        name_account_wait(ctx, nid);
         return ctx->co.rc;
 
     } else if (ctx->co.state == CO_STATE_RESUMED) {
@@ -91,6 +274,9 @@ poller_resume(mnthr_ctx_t *ctx)
         CTRACE("Assuming exited (dead) ...");
         //mnthr_dump(ctx);
 #endif
+        MNTHR_PROBE3(exit, ctx->co.id, CO_NAME(ctx), ctx->co.rc);
+        ++mnthr_stats.exits;
+        ++name_stats[nid].exits;
         sleepq_remove(ctx);
         push_free_ctx(ctx);
         //TRRET(RESUME + 2);
@@ -117,13 +303,14 @@ poller_sift_sleepq(void)
     STQUEUE(_mnthr_ctx, runq);
     mnbtrie_node_t *trn;
     mnthr_ctx_t *ctx;
-    uint64_t now;
+    uint64_t now, lag;
 
     /* run expired threads */
 
     STQUEUE_INIT(&runq);
 
     now = mnthr_get_now_ticks();
+    lag = 0;
 
     for (trn = BTRIE_MIN(&the_sleepq);
          trn != NULL;
@@ -138,11 +325,22 @@ poller_sift_sleepq(void)
             //    mnthr_dump(ctx);
             //}
 
-            STQUEUE_ENQUEUE(&runq, runq_link, ctx);
             //sleepq_remove(ctx);
             trn->value = NULL;
             btrie_remove_node(&the_sleepq, trn);
             trn = NULL;
+            /* how long it has been runnable, see admission.c */
+            if (ctx->expire_ticks > MNTHR_SLEEP_RESUME_NOW) {
+                lag = MAX(lag, now - ctx->expire_ticks);
+            } else if (last_sift_ticks != 0) {
+                lag = MAX(lag, now - last_sift_ticks);
+            }
+            if (fair_batch_nsec != 0) {
+                /* see group.c */
+                group_enqueue_bucket(ctx, now);
+                continue;
+            }
+            STQUEUE_ENQUEUE(&runq, runq_link, ctx);
 #ifdef TRACE_VERBOSE
             CTRACE(FBGREEN("Put in runq:"));
             mnthr_dump(ctx);
@@ -152,6 +350,17 @@ poller_sift_sleepq(void)
         }
     }
 
+    loop_lag_update(poller_ticks2nsec(lag));
+    last_sift_ticks = now;
+
+    if (hibernate_idle_nsec != 0) {
+        hibernate_sweep();
+    }
+
+    if (fair_batch_nsec != 0) {
+        group_run();
+    }
+
     while ((ctx = STQUEUE_HEAD(&runq)) != NULL) {
         mnthr_ctx_t *bctx;
         mnthr_waitq_t sleepq_bucket_tmp;
@@ -163,6 +372,12 @@ poller_sift_sleepq(void)
         mnthr_dump(ctx);
         CTRACE(FBGREEN("<<<"));
 #endif
+        if (ctx->expire_ticks > MNTHR_SLEEP_RESUME_NOW) {
+            MNTHR_PROBE3(timer_fire,
+                         ctx->co.id,
+                         CO_NAME(ctx),
+                         now - ctx->expire_ticks);
+        }
         ctx->expire_ticks = MNTHR_SLEEP_UNDEFINED;
 
         if (!(ctx->co.state & CO_STATES_RESUMABLE_EXTERNALLY)) {
@@ -202,6 +417,12 @@ poller_sift_sleepq(void)
             mnthr_dump(bctx);
             CTRACE(FBGREEN("<<<"));
 #endif
+            if (bctx->expire_ticks > MNTHR_SLEEP_RESUME_NOW) {
+                MNTHR_PROBE3(timer_fire,
+                             bctx->co.id,
+                             CO_NAME(bctx),
+                             now - bctx->expire_ticks);
+            }
             bctx->expire_ticks = MNTHR_SLEEP_UNDEFINED;
 
             if (!(bctx->co.state & CO_STATES_RESUMABLE_EXTERNALLY)) {
@@ -232,3 +453,31 @@ poller_sift_sleepq(void)
     }
 }
 
+
+
+/**
+ * When mnthr_loop_once() is next due, on the mnthr_get_now_nsec()
+ * clock: 0 - right away, UINT64_MAX - only on events on
+ * mnthr_get_poll_fd().
+ */
+uint64_t
+mnthr_next_deadline(void)
+{
+    mnbtrie_node_t *node;
+    mnthr_ctx_t *ctx;
+    uint64_t now;
+
+    if (poller_changes_pending()) {
+        return 0;
+    }
+    if ((node = BTRIE_MIN(&the_sleepq)) == NULL) {
+        return UINT64_MAX;
+    }
+    ctx = node->value;
+    assert(ctx != NULL);
+    now = mnthr_get_now_ticks();
+    if (ctx->expire_ticks <= now || (mnthr_flags & CO_FLAG_SIMULATION)) {
+        return 0;
+    }
+    return mnthr_get_now_nsec() + poller_ticks2nsec(ctx->expire_ticks - now);
+}
@@ -0,0 +1,352 @@
+/**
+ * Worker pools.
+ *
+ * A pool runs jobs from an intrusive FIFO queue on a bounded number of
+ * long-lived worker threads, so that a burst of small jobs costs a
+ * queue link per job rather than a ctx and a stack.  Idle workers park
+ * on their own signal, and submitting a job wakes up the first of them.
+ *
+ * With nmax greater than nmin the pool scales: a new worker is started
+ * whenever a job has waited in the queue for longer than the pool's
+ * wait threshold, and a worker in excess of nmin retires after
+ * POOL_IDLE_MSEC without work.
+ */
+#include <assert.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_CONFIG_H
+#   include "config.h"
+#endif
+
+#ifdef DO_MEMDEBUG
+#include <mncommon/memdebug.h>
+MEMDEBUG_DECLARE(mnthr_pool);
+#endif
+
+#include <mncommon/btrie.h>
+
+#include "mnthr_private.h"
+
+//#define TRACE_VERBOSE
+#include "diag.h"
+#include <mncommon/dumpm.h>
+
+#define POOL_IDLE_MSEC 1000
+
+struct _pool_worker {
+    mnthr_signal_t signal;
+    DTQUEUE_ENTRY(_pool_worker, link);
+};
+
+struct _mnthr_pool {
+    char name[32];
+    unsigned nmin;
+    unsigned nmax;
+    uint64_t grow_wait_nsec;
+    bool closing;
+    STQUEUE(_mnthr_job, jobs);
+    DTQUEUE(_pool_worker, idle);
+    mnthr_cond_t drained;
+    mnthr_pool_stats_t stats;
+};
+
+
+void
+mnthr_job_init(mnthr_job_t *job, mnthr_job_func_t fn, void *udata)
+{
+    STQUEUE_ENTRY_INIT(link, job);
+    job->fn = fn;
+    job->udata = udata;
+    job->submitted = 0;
+    job->rc = 0;
+    job->done = false;
+    mnthr_cond_init(&job->cond);
+}
+
+
+void
+mnthr_job_fini(mnthr_job_t *job)
+{
+    mnthr_cond_fini(&job->cond);
+}
+
+
+bool
+mnthr_job_done(const mnthr_job_t *job)
+{
+    return job->done;
+}
+
+
+/**
+ * Wait for the job to complete, and return what its function returned.
+ */
+int
+mnthr_job_wait(mnthr_job_t *job)
+{
+    while (!job->done) {
+        int res;
+
+        if ((res = mnthr_cond_wait(&job->cond)) != 0) {
+            return res;
+        }
+    }
+    return job->rc;
+}
+
+
+static int pool_worker(int, void *[]);
+
+
+static void
+pool_grow(mnthr_pool_t *pool)
+{
+    mnthr_ctx_t *ctx;
+
+    /* not subject to admission control, the pool is the bound */
+    ctx = mnthr_new(pool->name, pool_worker, 1, pool);
+    ++pool->stats.nworkers;
+    ++pool->stats.spawned;
+    mnthr_run(ctx);
+}
+
+
+static void
+pool_maybe_grow(mnthr_pool_t *pool, uint64_t wait)
+{
+    if (pool->grow_wait_nsec != 0 &&
+        wait > pool->grow_wait_nsec &&
+        pool->stats.nworkers < pool->nmax &&
+        DTQUEUE_EMPTY(&pool->idle)) {
+        pool_grow(pool);
+    }
+}
+
+
+static void
+pool_run_job(mnthr_pool_t *pool, mnthr_job_t *job)
+{
+    uint64_t start, wait, latency;
+
+    start = mnthr_get_now_nsec_precise();
+    wait = start - job->submitted;
+    pool->stats.wait_nsec += wait;
+    pool->stats.wait_nsec_max = MAX(pool->stats.wait_nsec_max, wait);
+    pool_maybe_grow(pool, wait);
+
+    job->rc = job->fn(job);
+
+    latency = mnthr_get_now_nsec_precise() - job->submitted;
+    pool->stats.latency_nsec += latency;
+    pool->stats.latency_nsec_max = MAX(pool->stats.latency_nsec_max,
+                                       latency);
+    ++pool->stats.completed;
+
+    job->done = true;
+    mnthr_cond_signal_all(&job->cond);
+}
+
+
+static int
+pool_worker(UNUSED int argc, void *argv[])
+{
+    mnthr_pool_t *pool;
+    struct _pool_worker w;
+
+    assert(argc == 1);
+    pool = argv[0];
+    mnthr_signal_init(&w.signal, mnthr_me());
+    DTQUEUE_ENTRY_INIT(link, &w);
+
+    while (true) {
+        mnthr_job_t *job;
+        int res;
+
+        if ((job = STQUEUE_HEAD(&pool->jobs)) != NULL) {
+            STQUEUE_DEQUEUE(&pool->jobs, link);
+            STQUEUE_ENTRY_FINI(link, job);
+            pool->stats.queue_depth = STQUEUE_LENGTH(&pool->jobs);
+            pool_run_job(pool, job);
+            continue;
+        }
+
+        if (pool->closing) {
+            break;
+        }
+
+        DTQUEUE_ENQUEUE(&pool->idle, link, &w);
+        if (pool->stats.nworkers > pool->nmin) {
+            res = mnthr_signal_subscribe_with_timeout(&w.signal,
+                                                      POOL_IDLE_MSEC);
+        } else {
+            res = mnthr_signal_subscribe(&w.signal);
+        }
+        if (!DTQUEUE_ORPHAN(&pool->idle, link, &w)) {
+            DTQUEUE_REMOVE(&pool->idle, link, &w);
+            DTQUEUE_ENTRY_FINI(link, &w);
+        }
+
+        if (res == (int)MNTHR_WAIT_TIMEOUT) {
+            if (STQUEUE_EMPTY(&pool->jobs) &&
+                pool->stats.nworkers > pool->nmin) {
+                ++pool->stats.retired;
+                break;
+            }
+        } else if (res != 0) {
+            break;
+        }
+    }
+
+    mnthr_signal_fini(&w.signal);
+    --pool->stats.nworkers;
+    mnthr_cond_signal_all(&pool->drained);
+    return 0;
+}
+
+
+/**
+ * Create a pool of nmin workers, allowed to grow up to nmax workers
+ * when a job has waited for longer than wait_usec.
+ */
+mnthr_pool_t *
+mnthr_pool_new(const char *name,
+               unsigned nmin,
+               unsigned nmax,
+               uint64_t wait_usec)
+{
+    mnthr_pool_t *pool;
+    unsigned i;
+
+    if ((pool = malloc(sizeof(mnthr_pool_t))) == NULL) {
+        FAIL("malloc");
+    }
+    strncpy(pool->name, name != NULL ? name : "pool", sizeof(pool->name) - 1);
+    pool->name[sizeof(pool->name) - 1] = '\0';
+    pool->nmax = MAX(nmax, 1);
+    pool->nmin = MIN(nmin, pool->nmax);
+    pool->grow_wait_nsec = pool->nmax > pool->nmin ? wait_usec * 1000 : 0;
+    pool->closing = false;
+    STQUEUE_INIT(&pool->jobs);
+    DTQUEUE_INIT(&pool->idle);
+    mnthr_cond_init(&pool->drained);
+    memset(&pool->stats, 0, sizeof(pool->stats));
+
+    for (i = 0; i < pool->nmin; ++i) {
+        pool_grow(pool);
+    }
+    return pool;
+}
+
+
+static void
+pool_enqueue(mnthr_pool_t *pool, mnthr_job_t *job, uint64_t now)
+{
+    assert(!job->done);
+    job->submitted = now;
+    STQUEUE_ENQUEUE(&pool->jobs, link, job);
+    ++pool->stats.submitted;
+}
+
+
+static void
+pool_kick(mnthr_pool_t *pool, size_t njobs)
+{
+    struct _pool_worker *w;
+
+    while (njobs > 0 && (w = DTQUEUE_HEAD(&pool->idle)) != NULL) {
+        DTQUEUE_DEQUEUE(&pool->idle, link);
+        DTQUEUE_ENTRY_FINI(link, w);
+        mnthr_signal_send(&w->signal);
+        --njobs;
+    }
+
+    if (njobs > 0) {
+        mnthr_job_t *head;
+
+        if (pool->stats.nworkers == 0) {
+            /* scaled down to zero */
+            pool_grow(pool);
+        } else if ((head = STQUEUE_HEAD(&pool->jobs)) != NULL) {
+            pool_maybe_grow(pool,
+                            mnthr_get_now_nsec_precise() - head->submitted);
+        }
+    }
+
+    pool->stats.queue_depth = STQUEUE_LENGTH(&pool->jobs);
+    pool->stats.queue_depth_max = MAX(pool->stats.queue_depth_max,
+                                      pool->stats.queue_depth);
+}
+
+
+int
+mnthr_pool_submit(mnthr_pool_t *pool, mnthr_job_t *job)
+{
+    if (pool->closing) {
+        TRRET(MNTHR_POOL_SUBMIT + 1);
+    }
+    pool_enqueue(pool, job, mnthr_get_now_nsec_precise());
+    pool_kick(pool, 1);
+    return 0;
+}
+
+
+/**
+ * Submit n jobs at once, with a single clock read, waking up to n idle
+ * workers.
+ */
+int
+mnthr_pool_submit_batch(mnthr_pool_t *pool, mnthr_job_t *jobs[], size_t n)
+{
+    uint64_t now;
+    size_t i;
+
+    if (pool->closing) {
+        TRRET(MNTHR_POOL_SUBMIT + 1);
+    }
+    now = mnthr_get_now_nsec_precise();
+    for (i = 0; i < n; ++i) {
+        pool_enqueue(pool, jobs[i], now);
+    }
+    pool_kick(pool, n);
+    return 0;
+}
+
+
+void
+mnthr_pool_get_stats(const mnthr_pool_t *pool, mnthr_pool_stats_t *stats)
+{
+    *stats = pool->stats;
+}
+
+
+/**
+ * Stop accepting jobs, let the workers drain the queue and exit, and
+ * free the pool.  If the wait is interrupted, the pool is left closed,
+ * but not freed, and mnthr_pool_destroy() should be called again.
+ */
+int
+mnthr_pool_destroy(mnthr_pool_t *pool)
+{
+    struct _pool_worker *w;
+
+    pool->closing = true;
+    for (w = DTQUEUE_HEAD(&pool->idle);
+         w != NULL;
+         w = DTQUEUE_NEXT(link, w)) {
+        mnthr_signal_send(&w->signal);
+    }
+
+    while (pool->stats.nworkers > 0) {
+        int res;
+
+        if ((res = mnthr_cond_wait(&pool->drained)) != 0) {
+            return res;
+        }
+    }
+
+    mnthr_cond_fini(&pool->drained);
+    free(pool);
+    return 0;
+}
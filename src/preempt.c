@@ -0,0 +1,154 @@
+/**
+ * Timer signal preemption.
+ *
+ * A SIGVTALRM tick (setitimer(2) ITIMER_VIRTUAL, so only CPU time
+ * counts) checks whether the same thread has been running since the
+ * previous tick.  If so, the handler marks it as a runaway, and zeroes
+ * the mnthr_maybe_yield() countdown.  Nothing is switched from within
+ * the handler, the switch happens at the next safe point:
+ *
+ *  - MNTHR_PREEMPT_YIELD: the thread yields at its next
+ *    mnthr_maybe_yield(), regardless of the slice budget;
+ *
+ *  - MNTHR_PREEMPT_INTERRUPT: in addition, once the thread is back in
+ *    the scheduler, it is interrupted, so that the CPOINT it is parked
+ *    in returns MNTHR_CO_RC_PREEMPTED.
+ *
+ * The loop latency is then bounded by one to two ticks, plus the time
+ * to the next safe point.
+ */
+#include <assert.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/time.h>
+
+#ifdef HAVE_CONFIG_H
+#   include "config.h"
+#endif
+
+#ifdef DO_MEMDEBUG
+#include <mncommon/memdebug.h>
+MEMDEBUG_DECLARE(mnthr_preempt);
+#endif
+
+#include <mncommon/btrie.h>
+
+#include "mnthr_private.h"
+
+//#define TRACE_VERBOSE
+#include "diag.h"
+#include <mncommon/dumpm.h>
+
+
+mnthr_ctx_t * volatile preempt_ctx = NULL;
+static int preempt_policy = MNTHR_PREEMPT_YIELD;
+static volatile sig_atomic_t preempting = 0;
+static uint64_t last_switches = 0;
+static struct sigaction old_sa;
+
+
+static void
+sigvtalrm_handler(UNUSED int sig)
+{
+    mnthr_ctx_t *ctx;
+    uint64_t switches;
+
+    ctx = me;
+    switches = mnthr_stats.switches;
+
+    if (ctx != NULL && switches == last_switches && preempt_ctx == NULL) {
+        preempt_ctx = ctx;
+        mnthr_slice_countdown = 0;
+    }
+    last_switches = switches;
+}
+
+
+/**
+ * Preempt threads running for longer than usec of CPU time.
+ */
+int
+mnthr_preempt_start(uint64_t usec, int policy)
+{
+    struct sigaction sa;
+    struct itimerval itv;
+
+    if (preempting) {
+        TRRET(MNTHR_PREEMPT_START + 1);
+    }
+
+    if (usec == 0 ||
+        (policy != MNTHR_PREEMPT_YIELD &&
+         policy != MNTHR_PREEMPT_INTERRUPT)) {
+        TRRET(MNTHR_PREEMPT_START + 2);
+    }
+
+    if (mnthr_flags & CO_FLAG_SIMULATION) {
+        /* timer signals would break the replay */
+        TRRET(MNTHR_PREEMPT_START + 3);
+    }
+
+    preempt_policy = policy;
+    preempt_ctx = NULL;
+    last_switches = mnthr_stats.switches;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = sigvtalrm_handler;
+    sa.sa_flags = SA_RESTART;
+    (void)sigemptyset(&sa.sa_mask);
+    if (sigaction(SIGVTALRM, &sa, &old_sa) != 0) {
+        TRRET(MNTHR_PREEMPT_START + 4);
+    }
+
+    preempting = 1;
+
+    itv.it_interval.tv_sec = usec / 1000000;
+    itv.it_interval.tv_usec = usec % 1000000;
+    itv.it_value = itv.it_interval;
+    if (setitimer(ITIMER_VIRTUAL, &itv, NULL) != 0) {
+        preempting = 0;
+        (void)sigaction(SIGVTALRM, &old_sa, NULL);
+        TRRET(MNTHR_PREEMPT_START + 5);
+    }
+
+    return 0;
+}
+
+
+int
+mnthr_preempt_stop(void)
+{
+    struct itimerval itv;
+
+    if (!preempting) {
+        return 0;
+    }
+
+    memset(&itv, 0, sizeof(itv));
+    (void)setitimer(ITIMER_VIRTUAL, &itv, NULL);
+    preempting = 0;
+    (void)sigaction(SIGVTALRM, &old_sa, NULL);
+    preempt_ctx = NULL;
+
+    return 0;
+}
+
+
+/**
+ * Called by the scheduler when ctx is back from its slice.
+ */
+void
+preempt_check(mnthr_ctx_t *ctx)
+{
+    if (preempt_ctx != ctx) {
+        return;
+    }
+    preempt_ctx = NULL;
+    ++mnthr_stats.preemptions;
+    if (preempt_policy == MNTHR_PREEMPT_INTERRUPT &&
+        (ctx->co.state & CO_STATE_RESUMABLE)) {
+        mnthr_set_interrupt(ctx);
+        ctx->co.rc = MNTHR_CO_RC_PREEMPTED;
+    }
+}
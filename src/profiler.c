@@ -0,0 +1,318 @@
+/**
+ * Sampling profiler.
+ *
+ * On every SIGPROF tick (setitimer(2) ITIMER_PROF) the handler records
+ * the id and name of the running thread along with a short frame
+ * pointer backtrace into a preallocated buffer.  The buffer is written
+ * only by the signal handler, and read only with SIGPROF blocked, so it
+ * needs no locks.  Samples taken outside of any thread are attributed
+ * to the pseudo-thread "[mnthr]".
+ *
+ * Samples are aggregated in the folded stacks format understood by
+ * flamegraph.pl and most profile viewers:
+ *
+ *  name;outermost;...;innermost count
+ */
+#include <assert.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+
+#ifdef HAVE_CONFIG_H
+#   include "config.h"
+#endif
+
+#ifdef HAVE_DLFCN_H
+#include <dlfcn.h>
+#endif
+
+#ifdef DO_MEMDEBUG
+#include <mncommon/memdebug.h>
+MEMDEBUG_DECLARE(mnthr_profiler);
+#endif
+
+#include <mncommon/btrie.h>
+
+#include "mnthr_private.h"
+
+//#define TRACE_VERBOSE
+#include "diag.h"
+#include <mncommon/dumpm.h>
+
+
+#define MNTHR_PROFILER_DEPTH 16
+
+typedef struct _mnthr_sample {
+    int64_t id;
+    int nid;
+    int nframes;
+    void *frames[MNTHR_PROFILER_DEPTH];
+} mnthr_sample_t;
+
+
+static mnthr_sample_t *samples = NULL;
+static size_t samples_sz = 0;
+static volatile size_t samples_elnum = 0;
+static volatile size_t samples_dropped = 0;
+static volatile sig_atomic_t profiling = 0;
+static struct sigaction old_sa;
+
+
+static void
+sigprof_handler(UNUSED int sig, UNUSED siginfo_t *info, void *uap)
+{
+    mnthr_sample_t *s;
+    mnthr_ctx_t *ctx;
+    int saved_errno;
+
+    if (!profiling) {
+        return;
+    }
+
+    if (samples_elnum >= samples_sz) {
+        ++samples_dropped;
+        return;
+    }
+
+    saved_errno = errno;
+
+    s = &samples[samples_elnum];
+    ctx = me;
+    if (ctx != NULL) {
+        s->id = ctx->co.id;
+        s->nid = ctx->co.nid;
+    } else {
+        s->id = -1;
+        s->nid = 0;
+    }
+
+    s->nframes = 0;
+#ifdef MNTHR_UC_PC
+    {
+        ucontext_t *uc = uap;
+
+        if (ctx != NULL && ctx->co.stack != MAP_FAILED) {
+            uintptr_t lo, hi;
+
+            lo = (uintptr_t)ctx->co.stack + PAGE_SIZE;
+            hi = (uintptr_t)ctx->co.stack + ctx->co.uc.uc_stack.ss_size;
+            /*
+             * The frame chain is only followed while the sampled stack
+             * pointer is within the thread's stack, it may be not
+             * during a context switch.
+             */
+            if (MNTHR_UC_SP(uc) >= lo && MNTHR_UC_SP(uc) < hi) {
+                s->nframes = mnthr_fp_walk(MNTHR_UC_PC(uc),
+                                           MNTHR_UC_FP(uc),
+                                           MNTHR_UC_SP(uc),
+                                           hi,
+                                           s->frames,
+                                           countof(s->frames));
+            }
+        }
+        if (s->nframes == 0) {
+            /* the scheduler stack bounds are unknown, only take pc */
+            s->frames[0] = (void *)MNTHR_UC_PC(uc);
+            s->nframes = 1;
+        }
+    }
+#else
+    (void)uap;
+#endif
+
+    ++samples_elnum;
+
+    errno = saved_errno;
+}
+
+
+/**
+ * Start sampling hz times per second of CPU time, keep up to nsamples
+ * samples.  Samples of a previous run are discarded.
+ */
+int
+mnthr_profiler_start(unsigned hz, size_t nsamples)
+{
+    struct sigaction sa;
+    struct itimerval itv;
+    mnthr_sample_t *tmp;
+
+    if (profiling) {
+        TRRET(MNTHR_PROFILER_START + 1);
+    }
+
+    if (hz == 0 || hz > 1000000 || nsamples == 0) {
+        TRRET(MNTHR_PROFILER_START + 2);
+    }
+
+    if ((tmp = realloc(samples, nsamples * sizeof(mnthr_sample_t))) == NULL) {
+        FAIL("realloc");
+    }
+    samples = tmp;
+    samples_sz = nsamples;
+    samples_elnum = 0;
+    samples_dropped = 0;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_sigaction = sigprof_handler;
+    sa.sa_flags = SA_SIGINFO | SA_RESTART;
+    (void)sigemptyset(&sa.sa_mask);
+    if (sigaction(SIGPROF, &sa, &old_sa) != 0) {
+        TRRET(MNTHR_PROFILER_START + 3);
+    }
+
+    profiling = 1;
+
+    itv.it_interval.tv_sec = 1 / hz;
+    itv.it_interval.tv_usec = (1000000 / hz) % 1000000;
+    itv.it_value = itv.it_interval;
+    if (setitimer(ITIMER_PROF, &itv, NULL) != 0) {
+        profiling = 0;
+        (void)sigaction(SIGPROF, &old_sa, NULL);
+        TRRET(MNTHR_PROFILER_START + 4);
+    }
+
+    return 0;
+}
+
+
+/**
+ * Stop sampling.  The collected samples are kept until the next
+ * mnthr_profiler_start().
+ */
+int
+mnthr_profiler_stop(void)
+{
+    struct itimerval itv;
+
+    if (!profiling) {
+        return 0;
+    }
+
+    memset(&itv, 0, sizeof(itv));
+    (void)setitimer(ITIMER_PROF, &itv, NULL);
+    profiling = 0;
+    (void)sigaction(SIGPROF, &old_sa, NULL);
+
+    return 0;
+}
+
+
+void
+profiler_fini(void)
+{
+    (void)mnthr_profiler_stop();
+    free(samples);
+    samples = NULL;
+    samples_sz = 0;
+    samples_elnum = 0;
+}
+
+
+static void
+print_frame(FILE *f, void *pc)
+{
+#ifdef HAVE_DLFCN_H
+    Dl_info info;
+
+    if (dladdr(pc, &info) != 0 && info.dli_sname != NULL) {
+        (void)fprintf(f, ";%s", info.dli_sname);
+        return;
+    }
+#endif
+    (void)fprintf(f, ";%p", pc);
+}
+
+
+static int
+sample_cmp(const void *a, const void *b)
+{
+    const mnthr_sample_t *sa = a, *sb = b;
+    int diff;
+    int i;
+
+    /* the loop itself apart from unnamed threads */
+    if ((diff = MNCMP(sa->id == -1, sb->id == -1)) != 0) {
+        return diff;
+    }
+    if ((diff = MNCMP(sa->nid, sb->nid)) != 0) {
+        return diff;
+    }
+    if ((diff = MNCMP(sa->nframes, sb->nframes)) != 0) {
+        return diff;
+    }
+    for (i = 0; i < sa->nframes; ++i) {
+        if (sa->frames[i] != sb->frames[i]) {
+            return MNCMP((uintptr_t)sa->frames[i],
+                         (uintptr_t)sb->frames[i]);
+        }
+    }
+    return 0;
+}
+
+
+/**
+ * Write the collected samples aggregated by thread name and stack in
+ * the folded format to path ("-" stands for stdout).  Return the number
+ * of samples written, or a negative number on error.
+ */
+int
+mnthr_profiler_write_folded(const char *path)
+{
+    FILE *f;
+    sigset_t set, oset;
+    size_t i, j, n;
+
+    (void)sigemptyset(&set);
+    (void)sigaddset(&set, SIGPROF);
+    (void)sigprocmask(SIG_BLOCK, &set, &oset);
+
+    n = samples_elnum;
+    qsort(samples, n, sizeof(mnthr_sample_t), sample_cmp);
+
+    if (strcmp(path, "-") == 0) {
+        f = stdout;
+    } else if ((f = fopen(path, "w")) == NULL) {
+        (void)sigprocmask(SIG_SETMASK, &oset, NULL);
+        TRRET(MNTHR_PROFILER_WRITE_FOLDED + 1);
+    }
+
+    for (i = 0; i < n; i = j) {
+        int k;
+
+        for (j = i + 1;
+             j < n && sample_cmp(&samples[i], &samples[j]) == 0;
+             ++j) {
+        }
+
+        (void)fprintf(f, "%s",
+                      samples[i].id == -1 ? "[mnthr]" :
+                      samples[i].nid != 0 ?
+                          mnthr_name_str(samples[i].nid) : "-");
+        for (k = samples[i].nframes - 1; k >= 0; --k) {
+            print_frame(f, samples[i].frames[k]);
+        }
+        (void)fprintf(f, " %zu\n", j - i);
+    }
+
+    if (samples_dropped != 0) {
+        CTRACE("%zu samples dropped, consider a larger buffer",
+               (size_t)samples_dropped);
+    }
+
+    if (f == stdout) {
+        (void)fflush(f);
+    } else {
+        (void)fclose(f);
+    }
+
+    (void)sigprocmask(SIG_SETMASK, &oset, NULL);
+
+    return (int)n;
+}
@@ -0,0 +1,199 @@
+/**
+ * First-of-N racing and hedged requests.
+ *
+ * mnthr_race() runs attempts of the same request, and returns as soon
+ * as one of them succeeds (returns 0).  The attempts are spawned
+ * lazily: the first one right away, every next one when the previous
+ * ones have all failed, or when hedge_usec have passed since the last
+ * one was spawned.  Once there is a winner, the timeout expires, or
+ * the caller is interrupted, the attempts still running are all
+ * interrupted first, and then joined, so that nothing outlives the
+ * call.
+ */
+#include <assert.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#ifdef HAVE_CONFIG_H
+#   include "config.h"
+#endif
+
+#ifdef DO_MEMDEBUG
+#include <mncommon/memdebug.h>
+MEMDEBUG_DECLARE(mnthr_race);
+#endif
+
+#include <mncommon/btrie.h>
+
+#include "mnthr_private.h"
+
+//#define TRACE_VERBOSE
+#include "diag.h"
+#include <mncommon/dumpm.h>
+
+
+struct race {
+    mnthr_cofunc_t *fns;
+    void *udata;
+    mnthr_ctx_t **attempts;
+    int nspawned;
+    int nfailed;
+    int winner;
+    int rc;
+    bool finished;
+    mnthr_signal_t signal;
+};
+
+
+static int
+race_attempt(UNUSED int argc, void *argv[])
+{
+    struct race *r;
+    intptr_t i;
+    void *args[2];
+    int rc;
+
+    assert(argc == 2);
+    r = argv[0];
+    i = (intptr_t)argv[1];
+
+    if (r->finished) {
+        /* cancelled before it could start */
+        r->attempts[i] = NULL;
+        return MNTHR_CO_RC_USER_INTERRUPTED;
+    }
+
+    args[0] = r->udata;
+    args[1] = (void *)i;
+    rc = r->fns[i](2, args);
+
+    r->attempts[i] = NULL;
+    if (!r->finished) {
+        if (rc == 0) {
+            if (r->winner == -1) {
+                r->winner = i;
+            }
+        } else {
+            ++r->nfailed;
+            r->rc = rc;
+        }
+        mnthr_signal_send(&r->signal);
+    }
+    return rc;
+}
+
+
+static void
+race_spawn(struct race *r)
+{
+    mnthr_ctx_t *ctx;
+    intptr_t i;
+
+    i = r->nspawned++;
+    ctx = mnthr_new("race", race_attempt, 2, r, (void *)i);
+    r->attempts[i] = ctx;
+    mnthr_run(ctx);
+}
+
+
+/**
+ * Race up to n attempts, fns[i] is called with argc 2, and argv udata
+ * and i.  Return 0 with the index of the first successful attempt in
+ * *winner, the rc of the last attempt if they all have failed, or
+ * MNTHR_WAIT_TIMEOUT after timeout_usec (0 - no timeout).  A
+ * hedge_usec of 0 spawns all the attempts at once.
+ */
+int
+mnthr_race(mnthr_cofunc_t fns[],
+           void *udata,
+           int n,
+           uint64_t hedge_usec,
+           uint64_t timeout_usec,
+           int *winner)
+{
+    struct race r;
+    uint64_t now, deadline, last_spawn;
+    int res;
+    int i;
+
+    assert(me != NULL);
+    assert(n > 0);
+
+    r.fns = fns;
+    r.udata = udata;
+    if ((r.attempts = malloc(n * sizeof(mnthr_ctx_t *))) == NULL) {
+        FAIL("malloc");
+    }
+    r.nspawned = 0;
+    r.nfailed = 0;
+    r.winner = -1;
+    r.rc = 0;
+    r.finished = false;
+    mnthr_signal_init(&r.signal, NULL);
+
+    now = mnthr_get_now_nsec();
+    deadline = timeout_usec != 0 ? now + timeout_usec * 1000 : UINT64_MAX;
+    last_spawn = now;
+    race_spawn(&r);
+
+    while (true) {
+        uint64_t wake;
+
+        if (r.winner != -1) {
+            res = 0;
+            break;
+        }
+        if (r.nfailed == n) {
+            res = r.rc;
+            break;
+        }
+
+        now = mnthr_get_now_nsec();
+        if (now >= deadline) {
+            res = MNTHR_WAIT_TIMEOUT;
+            break;
+        }
+
+        wake = deadline;
+        if (r.nspawned < n) {
+            if (r.nfailed == r.nspawned ||
+                now >= last_spawn + hedge_usec * 1000) {
+                last_spawn = now;
+                race_spawn(&r);
+                continue;
+            }
+            wake = MIN(wake, last_spawn + hedge_usec * 1000);
+        }
+
+        if (wake == UINT64_MAX) {
+            res = mnthr_signal_subscribe(&r.signal);
+        } else {
+            res = mnthr_signal_subscribe_with_timeout_usec(
+                    &r.signal, (wake - now) / 1000 + 1);
+        }
+        if (res != 0 && res != (int)MNTHR_WAIT_TIMEOUT) {
+            /* the caller is interrupted */
+            break;
+        }
+    }
+
+    /* cancel the rest in one batch */
+    r.finished = true;
+    for (i = 0; i < r.nspawned; ++i) {
+        if (r.attempts[i] != NULL) {
+            mnthr_set_interrupt(r.attempts[i]);
+        }
+    }
+    for (i = 0; i < r.nspawned; ++i) {
+        if (r.attempts[i] != NULL) {
+            (void)mnthr_join(r.attempts[i]);
+        }
+    }
+
+    mnthr_signal_fini(&r.signal);
+    free(r.attempts);
+    if (res == 0 && winner != NULL) {
+        *winner = r.winner;
+    }
+    return res;
+}
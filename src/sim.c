@@ -0,0 +1,165 @@
+/**
+ * Deterministic simulation mode.
+ *
+ * The clock is virtual: it starts at MNTHR_SIM_EPOCH and only moves
+ * when the loop has polled and found nothing to do, and nothing has run
+ * since.  Then it jumps straight to the earliest sleepq deadline.  The
+ * pollers never block while there are sleeping threads, so hour long
+ * timeouts pass in as much real time as it takes to run the code in
+ * between.
+ *
+ * Threads falling on the same deadline (including those resumed "now")
+ * are queued in an order perturbed by a PRNG: the same seed replays the
+ * same interleaving, other seeds explore other ones.  Seed 0 keeps the
+ * natural order.
+ *
+ * I/O is expected to go over mnthr_sim_socketpair() pairs: they are
+ * kernel memory only, and a write is visible to the peer's poller
+ * immediately, so they behave the same on every run.
+ */
+#include <assert.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#ifdef HAVE_CONFIG_H
+#   include "config.h"
+#endif
+
+#ifdef DO_MEMDEBUG
+#include <mncommon/memdebug.h>
+MEMDEBUG_DECLARE(mnthr_sim);
+#endif
+
+#include <mncommon/btrie.h>
+
+#include "mnthr_private.h"
+
+//#define TRACE_VERBOSE
+#include "diag.h"
+#include <mncommon/dumpm.h>
+
+
+static uint64_t sim_state;
+static bool sim_idle = false;
+static uint64_t sim_switches = 0;
+
+
+/**
+ * Turn the simulation mode on.  Must be called before mnthr_init(), and
+ * again before each subsequent mnthr_init() to replay from the start.
+ */
+int
+mnthr_sim_init(uint64_t seed)
+{
+    if (mnthr_flags & CO_FLAG_INITIALIZED) {
+        TRRET(MNTHR_SIM_INIT + 1);
+    }
+    mnthr_flags |= CO_FLAG_SIMULATION;
+    /* xorshift does not leave 0 */
+    sim_state = seed;
+    sim_idle = false;
+    sim_switches = 0;
+    return 0;
+}
+
+
+bool
+mnthr_sim_enabled(void)
+{
+    return (bool)(mnthr_flags & CO_FLAG_SIMULATION);
+}
+
+
+/**
+ * A connected pair of non-blocking stream sockets for simulated I/O.
+ */
+int
+mnthr_sim_socketpair(int fds[2])
+{
+    int i;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+        TRRET(MNTHR_SIM_SOCKETPAIR + 1);
+    }
+    for (i = 0; i < 2; ++i) {
+        if (fcntl(fds[i], F_SETFL, O_NONBLOCK) != 0 ||
+            fcntl(fds[i], F_SETFD, FD_CLOEXEC) != 0) {
+            (void)close(fds[0]);
+            (void)close(fds[1]);
+            TRRET(MNTHR_SIM_SOCKETPAIR + 2);
+        }
+    }
+    return 0;
+}
+
+
+/**
+ * Whether to queue a thread ahead of the others on the same deadline.
+ */
+bool
+sim_shuffle(void)
+{
+    if (sim_state == 0) {
+        return false;
+    }
+    sim_state ^= sim_state << 13;
+    sim_state ^= sim_state >> 7;
+    sim_state ^= sim_state << 17;
+    return (bool)(sim_state & 1);
+}
+
+
+/**
+ * Called by the poller after each poll.
+ */
+void
+sim_polled(bool idle)
+{
+    sim_idle = idle;
+    sim_switches = mnthr_stats.switches;
+}
+
+
+/**
+ * If the loop is idle, move *now past the earliest sleepq deadline and
+ * return true.
+ */
+bool
+sim_advance(uint64_t *now)
+{
+    mnbtrie_node_t *trn;
+    mnthr_ctx_t *ctx;
+
+    if (!sim_idle || sim_switches != mnthr_stats.switches) {
+        return false;
+    }
+    if ((trn = BTRIE_MIN(&the_sleepq)) == NULL) {
+        return false;
+    }
+    ctx = trn->value;
+    assert(ctx != NULL);
+    if (ctx->expire_ticks < *now ||
+        ctx->expire_ticks == MNTHR_SLEEP_FOREVER) {
+        return false;
+    }
+    /* poller_sift_sleepq() takes those strictly before now */
+    *now = ctx->expire_ticks + 1;
+    sim_idle = false;
+    return true;
+}
+
+
+/**
+ * Called by mnthr_fini(): the next mnthr_init() runs on the real clock
+ * unless mnthr_sim_init() is called again.
+ */
+void
+sim_fini(void)
+{
+    mnthr_flags &= ~CO_FLAG_SIMULATION;
+    sim_state = 0;
+    sim_idle = false;
+    sim_switches = 0;
+}
@@ -0,0 +1,135 @@
+#include <assert.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <time.h>
+
+#include <mncommon/util.h>
+#include <mncommon/dumpm.h>
+
+#include <mnthr.h>
+
+#define NHOGS 4
+
+static bool done;
+
+
+static uint64_t
+now_nsec(void)
+{
+    struct timespec ts;
+
+    /* the loop's clock stands still while a thread runs */
+    (void)clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+static void
+spin(uint64_t usec)
+{
+    uint64_t end;
+    volatile uint64_t x = 0;
+
+    end = now_nsec() + usec * 1000;
+    while (now_nsec() < end) {
+        int i;
+
+        for (i = 0; i < 100; ++i) {
+            x += i;
+        }
+    }
+}
+
+
+static int
+hog(UNUSED int argc, UNUSED void *argv[])
+{
+    while (!done) {
+        spin(5000);
+        (void)mnthr_yield();
+    }
+    return 0;
+}
+
+
+static int
+idler(UNUSED int argc, UNUSED void *argv[])
+{
+    while (!done) {
+        (void)mnthr_sleep(10);
+    }
+    return 0;
+}
+
+
+static int
+run(UNUSED int argc, UNUSED void *argv[])
+{
+    mnthr_ctx_t *hogs[NHOGS];
+    UNUSED mnthr_ctx_t *ctx;
+    mnthr_metrics_counters_t c;
+    int i;
+
+    /* lag */
+    mnthr_set_admission(5000, 0, MNTHR_ADMIT_FAIL_SPAWN);
+    assert(!mnthr_overloaded());
+    for (i = 0; i < NHOGS; ++i) {
+        hogs[i] = mnthr_spawn("hog", hog, 0);
+        assert(hogs[i] != NULL);
+    }
+    (void)mnthr_sleep(200);
+    CTRACE("loop lag under load %"PRIu64" usec", mnthr_get_loop_lag() / 1000);
+    assert(mnthr_overloaded());
+    errno = 0;
+    ctx = mnthr_spawn("hog", hog, 0);
+    assert(ctx == NULL);
+    assert(errno == EAGAIN);
+    ctx = mnthr_spawn_sig("hog", hog, 0);
+    assert(ctx == NULL);
+
+    done = true;
+    for (i = 0; i < NHOGS; ++i) {
+        (void)mnthr_join(hogs[i]);
+    }
+    while (mnthr_overloaded()) {
+        (void)mnthr_sleep(1);
+    }
+    CTRACE("loop lag recovered %"PRIu64" usec", mnthr_get_loop_lag() / 1000);
+    done = false;
+
+    /* live threads */
+    mnthr_set_admission(0, 10, MNTHR_ADMIT_FAIL_SPAWN);
+    for (i = 0; i < 20; ++i) {
+        if (mnthr_spawn("idler", idler, 0) == NULL) {
+            break;
+        }
+    }
+    /* run itself counts, and so may the hogs not reclaimed yet */
+    assert(i < 10);
+
+    mnthr_metrics_get(&c);
+    CTRACE("admission rejects %"PRIu64, c.admission_rejects);
+    assert(c.admission_rejects == 3);
+
+    mnthr_set_admission(0, 0, 0);
+    done = true;
+
+    mnthr_shutdown();
+    return 0;
+}
+
+
+int
+main(void)
+{
+    if (mnthr_init() != 0) {
+        perror("mnthr_init");
+        return 1;
+    }
+    (void)mnthr_spawn("run", run, 0);
+    (void)mnthr_loop();
+    (void)mnthr_fini();
+    return 0;
+}
@@ -0,0 +1,105 @@
+#include <assert.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <mncommon/util.h>
+#include <mncommon/dumpm.h>
+
+#include <mnthr.h>
+
+#define NALLOCS 10000
+
+
+static int
+handler(UNUSED int argc, UNUSED void *argv[])
+{
+    UNUSED char *ptrs[16];
+    UNUSED char *s;
+    int i;
+
+    for (i = 0; i < NALLOCS; ++i) {
+        char *p;
+        size_t sz;
+
+        sz = 1 + i % 200;
+        p = mnthr_alloc(sz);
+        assert(((uintptr_t)p & 15) == 0);
+        memset(p, 0xa5, sz);
+        if (i < 16) {
+            ptrs[i] = p;
+        }
+        if (i % 100 == 0) {
+            (void)mnthr_yield();
+        }
+    }
+    /* neighbours are intact */
+    for (i = 0; i < 16; ++i) {
+        assert((unsigned char)ptrs[i][0] == 0xa5);
+    }
+
+    /* larger than a chunk */
+    s = mnthr_alloc0(1024 * 1024);
+    assert(s[1024 * 1024 - 1] == 0);
+
+    s = mnthr_strdup("test");
+    assert(strcmp(s, "test") == 0);
+    return 0;
+}
+
+
+static int
+run(UNUSED int argc, UNUSED void *argv[])
+{
+    mnthr_metrics_counters_t c0, c1;
+    mnthr_arena_mark_t mark;
+    mnthr_ctx_t *ctx;
+    char *p;
+    UNUSED char *q, *r;
+    int i;
+
+    /* mark and release */
+    p = mnthr_alloc(64);
+    mark = mnthr_arena_mark();
+    q = mnthr_alloc(64);
+    mnthr_arena_release(mark);
+    r = mnthr_alloc(64);
+    assert(r == q);
+    mnthr_arena_reset();
+    (void)p;
+
+    ctx = mnthr_spawn("handler", handler, 0);
+    (void)mnthr_join(ctx);
+    mnthr_metrics_get(&c0);
+
+    /* chunks come back from the free list */
+    for (i = 0; i < 10; ++i) {
+        ctx = mnthr_spawn("handler", handler, 0);
+        (void)mnthr_join(ctx);
+    }
+    mnthr_metrics_get(&c1);
+    CTRACE("chunk allocs %"PRIu64" reuses %"PRIu64,
+           c1.arena_chunk_allocs,
+           c1.arena_chunk_reuses);
+    /* only the large ones are malloc'ed again */
+    assert(c1.arena_chunk_allocs - c0.arena_chunk_allocs == 10);
+    assert(c1.arena_chunk_reuses > c0.arena_chunk_reuses);
+
+    mnthr_shutdown();
+    return 0;
+}
+
+
+int
+main(void)
+{
+    if (mnthr_init() != 0) {
+        perror("mnthr_init");
+        return 1;
+    }
+    (void)mnthr_spawn("run", run, 0);
+    (void)mnthr_loop();
+    (void)mnthr_fini();
+    return 0;
+}
@@ -0,0 +1,57 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <mncommon/util.h>
+#include <mncommon/dumpm.h>
+
+#include <mnthr.h>
+
+static bool slept = false;
+
+
+static int
+sleeper(UNUSED int argc, UNUSED void *argv[])
+{
+    (void)mnthr_sleep(10);
+    slept = true;
+    return 0;
+}
+
+
+int
+main(void)
+{
+    UNUSED int res;
+
+    res = mnthr_set_backend("nonsense");
+    assert(res != 0);
+    res = mnthr_set_backend("");
+    assert(res == 0);
+    assert(mnthr_get_backend() == NULL);
+
+    /* the one of the environment otherwise */
+    if (getenv("MNTHR_BACKEND") == NULL) {
+        if (mnthr_set_backend("epoll,poll") != 0 &&
+            mnthr_set_backend("kevent") != 0) {
+            res = mnthr_set_backend("");
+            assert(res == 0);
+        }
+    }
+
+    if (mnthr_init() != 0) {
+        perror("mnthr_init");
+        return 1;
+    }
+    res = mnthr_set_backend("");
+    assert(res != 0);
+    assert(mnthr_get_backend() != NULL);
+    CTRACE("backend %s", mnthr_get_backend());
+
+    (void)mnthr_spawn("sleeper", sleeper, 0);
+    (void)mnthr_loop();
+    assert(slept);
+    (void)mnthr_fini();
+    return 0;
+}
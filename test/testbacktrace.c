@@ -0,0 +1,113 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <mncommon/util.h>
+#include <mncommon/dumpm.h>
+
+#include <mnthr.h>
+
+/* more than the code of sleeper() takes */
+#define SLEEPER_SIZE 256
+
+static mnthr_cond_t cond;
+
+
+static int
+sleeper(UNUSED int argc, UNUSED void *argv[])
+{
+    (void)mnthr_sleep(10000);
+    return 0;
+}
+
+
+static int
+waiter(UNUSED int argc, UNUSED void *argv[])
+{
+    (void)mnthr_cond_wait(&cond);
+    return 0;
+}
+
+
+static int
+dumper(UNUSED int argc, void *argv[])
+{
+    int i, n;
+    mnthr_ctx_t *s;
+    void *frames[16];
+    UNUSED bool found;
+
+    s = argv[0];
+
+    (void)mnthr_sleep(100);
+
+    mnthr_dump_all_ctxes();
+    mnthr_dump_blocked_sites(10);
+
+    n = mnthr_backtrace(s, frames, countof(frames));
+    CTRACE("sleeper backtrace depth %d", n);
+    assert(n > 0);
+
+    /*
+     * The return address of its mnthr_sleep() call lies within
+     * sleeper().  Frames past the library are only reached if it keeps
+     * its frame pointers, as it does in the debug build.
+     */
+    found = false;
+    for (i = 0; i < n; ++i) {
+        if ((uintptr_t)frames[i] > (uintptr_t)sleeper &&
+            (uintptr_t)frames[i] < (uintptr_t)sleeper + SLEEPER_SIZE) {
+            found = true;
+        }
+    }
+    assert(found);
+
+    /* not parked */
+    n = mnthr_backtrace(mnthr_me(), frames, countof(frames));
+    assert(n == 0);
+
+    mnthr_cond_signal_all(&cond);
+    mnthr_shutdown();
+    return 0;
+}
+
+
+static void
+test0(void)
+{
+    int i;
+    mnthr_ctx_t *s = NULL;
+
+    if (mnthr_init() != 0) {
+        perror("mnthr_init");
+        return;
+    }
+
+    mnthr_cond_init(&cond);
+    mnthr_set_stall_threshold(1000);
+
+    for (i = 0; i < 10; ++i) {
+        s = mnthr_spawn("sleeper", sleeper, 0);
+    }
+    for (i = 0; i < 5; ++i) {
+        (void)mnthr_spawn("waiter", waiter, 0);
+    }
+    (void)mnthr_spawn("dumper", dumper, 1, s);
+
+    mnthr_loop();
+
+    mnthr_cond_fini(&cond);
+
+    if (mnthr_fini() != 0) {
+        perror("mnthr_fini");
+        return;
+    }
+}
+
+
+int
+main(UNUSED int argc, UNUSED char *argv[])
+{
+    test0();
+    return 0;
+}
@@ -0,0 +1,110 @@
+#include <assert.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#include <mncommon/util.h>
+#include <mncommon/dumpm.h>
+
+#include <mnthr.h>
+
+#define NCLIENTS 100
+#define BATCH 16
+
+static mnthr_batcher_t *batcher;
+static size_t max_batch;
+
+
+static int
+multiget(mnthr_batch_item_t *items[], size_t n, UNUSED void *udata)
+{
+    size_t i;
+
+    assert(n > 0 && n <= BATCH);
+    max_batch = MAX(max_batch, n);
+    /* one upstream round trip for the whole batch */
+    (void)mnthr_sleep(1);
+    for (i = 0; i < n; ++i) {
+        items[i]->out = (void *)((uintptr_t)items[i]->in * 2);
+    }
+    return 0;
+}
+
+
+static int
+client(UNUSED int argc, void *argv[])
+{
+    mnthr_batch_item_t item;
+    uintptr_t key;
+    UNUSED int res;
+
+    key = (uintptr_t)argv[0];
+    item.in = (void *)key;
+    res = mnthr_batcher_submit(batcher, &item);
+    assert(res == 0);
+    assert((uintptr_t)item.out == key * 2);
+    return 0;
+}
+
+
+static int
+run(UNUSED int argc, UNUSED void *argv[])
+{
+    mnthr_ctx_t *clients[NCLIENTS];
+    mnthr_batcher_stats_t st;
+    mnthr_batch_item_t item;
+    UNUSED uint64_t t0;
+    uintptr_t i;
+    UNUSED int res;
+
+    batcher = mnthr_batcher_new("multiget", BATCH, 5000, multiget, NULL);
+
+    /* a burst coalesces into full batches */
+    for (i = 0; i < NCLIENTS; ++i) {
+        clients[i] = MNTHR_SPAWN("client", client, (void *)i);
+    }
+    for (i = 0; i < NCLIENTS; ++i) {
+        (void)mnthr_join(clients[i]);
+    }
+    mnthr_batcher_get_stats(batcher, &st);
+    CTRACE("batches %"PRIu64" items %"PRIu64" full %"PRIu64" timer %"PRIu64
+           " max batch %zd",
+           st.batches,
+           st.items,
+           st.full_flushes,
+           st.timer_flushes,
+           max_batch);
+    assert(st.items == NCLIENTS);
+    assert(max_batch == BATCH);
+    assert(st.batches < NCLIENTS / 4);
+
+    /* a lone item goes out when the timer fires */
+    t0 = mnthr_get_now_nsec_precise();
+    item.in = (void *)(uintptr_t)21;
+    res = mnthr_batcher_submit(batcher, &item);
+    assert(res == 0);
+    assert((uintptr_t)item.out == 42);
+    assert(mnthr_get_now_nsec_precise() - t0 >= 4000000);
+    mnthr_batcher_get_stats(batcher, &st);
+    assert(st.timer_flushes > 0);
+
+    res = mnthr_batcher_destroy(batcher);
+    assert(res == 0);
+
+    mnthr_shutdown();
+    return 0;
+}
+
+
+int
+main(void)
+{
+    if (mnthr_init() != 0) {
+        perror("mnthr_init");
+        return 1;
+    }
+    (void)mnthr_spawn("run", run, 0);
+    (void)mnthr_loop();
+    (void)mnthr_fini();
+    return 0;
+}
@@ -0,0 +1,120 @@
+#include <assert.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <mncommon/util.h>
+#include <mncommon/dumpm.h>
+
+#include <mnthr.h>
+
+#define NCONN 100
+
+static int fds[NCONN][2];
+static mnthr_buf_t *bufs[NCONN];
+
+
+static int
+reader(UNUSED int argc, void *argv[])
+{
+    intptr_t i = (intptr_t)argv[0];
+
+    return mnthr_read_buf(fds[i][0], &bufs[i]);
+}
+
+
+static void
+nonblocking_pair(int sv[2])
+{
+    int j;
+    UNUSED int res;
+
+    res = socketpair(AF_UNIX, SOCK_STREAM, 0, sv);
+    assert(res == 0);
+    for (j = 0; j < 2; ++j) {
+        res = fcntl(sv[j], F_SETFL, O_NONBLOCK);
+        assert(res == 0);
+    }
+}
+
+
+static int
+run(UNUSED int argc, UNUSED void *argv[])
+{
+    mnthr_ctx_t *readers[NCONN];
+    mnthr_metrics_counters_t c;
+    static char big[300 * 1024];
+    mnthr_buf_t *buf;
+    intptr_t i;
+    UNUSED ssize_t n;
+    UNUSED int res;
+
+    for (i = 0; i < NCONN; ++i) {
+        nonblocking_pair(fds[i]);
+        readers[i] = MNTHR_SPAWN("reader", reader, (void *)i);
+    }
+
+    /* idle connections hold no buffers */
+    (void)mnthr_sleep(10);
+    mnthr_metrics_get(&c);
+    assert(c.bufpool_borrowed == 0 && c.bufpool_slab_bytes == 0);
+
+    for (i = 0; i < NCONN; ++i) {
+        n = write(fds[i][1], "hello", 5);
+        assert(n == 5);
+    }
+    for (i = 0; i < NCONN; ++i) {
+        (void)mnthr_join(readers[i]);
+        assert(bufs[i] != NULL);
+        assert(bufs[i]->len == 5);
+        assert(memcmp(bufs[i]->data, "hello", 5) == 0);
+    }
+    mnthr_metrics_get(&c);
+    CTRACE("borrowed %"PRIu64" slab bytes %"PRIu64,
+           c.bufpool_borrowed,
+           c.bufpool_slab_bytes);
+    assert(c.bufpool_borrowed == NCONN);
+    for (i = 0; i < NCONN; ++i) {
+        mnthr_buf_put(bufs[i]);
+    }
+
+    /* more than the largest class */
+    memset(big, 'x', sizeof(big));
+    n = write(fds[0][1], big, sizeof(big));
+    assert(n > 0);
+    res = mnthr_read_buf(fds[0][0], &buf);
+    assert(res == 0);
+    CTRACE("read %zd of %zd", buf->len, buf->size);
+    assert(buf->len > 0 && buf->len <= buf->size);
+    assert(buf->data[buf->len - 1] == 'x');
+    mnthr_buf_put(buf);
+
+    mnthr_metrics_get(&c);
+    assert(c.bufpool_borrowed == 0);
+
+    for (i = 0; i < NCONN; ++i) {
+        (void)close(fds[i][0]);
+        (void)close(fds[i][1]);
+    }
+
+    mnthr_shutdown();
+    return 0;
+}
+
+
+int
+main(void)
+{
+    if (mnthr_init() != 0) {
+        perror("mnthr_init");
+        return 1;
+    }
+    (void)mnthr_spawn("run", run, 0);
+    (void)mnthr_loop();
+    (void)mnthr_fini();
+    return 0;
+}
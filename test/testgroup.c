@@ -0,0 +1,149 @@
+#include <assert.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <time.h>
+
+#include <mncommon/util.h>
+#include <mncommon/dumpm.h>
+
+#include <mnthr.h>
+
+#define NWORKERS 20
+
+static bool done;
+
+
+static uint64_t
+now_nsec(void)
+{
+    struct timespec ts;
+
+    /* the loop's clock stands still while a thread runs */
+    (void)clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+static void
+spin(uint64_t usec)
+{
+    uint64_t end;
+    volatile uint64_t x = 0;
+
+    end = now_nsec() + usec * 1000;
+    while (now_nsec() < end) {
+        int i;
+
+        for (i = 0; i < 100; ++i) {
+            x += i;
+        }
+    }
+}
+
+
+static int
+worker(UNUSED int argc, UNUSED void *argv[])
+{
+    while (!done) {
+        spin(100);
+        (void)mnthr_yield();
+    }
+    return 0;
+}
+
+
+static int
+tenant(UNUSED int argc, UNUSED void *argv[])
+{
+    int i;
+
+    /* workers inherit the group */
+    for (i = 0; i < NWORKERS; ++i) {
+        UNUSED mnthr_ctx_t *ctx;
+
+        ctx = mnthr_spawn("worker", worker, 0);
+        assert(mnthr_get_group(ctx) == mnthr_get_group(mnthr_me()));
+    }
+    return 0;
+}
+
+
+static int
+destroyer(UNUSED int argc, void *argv[])
+{
+    /* the slice it runs in is charged to a group that is gone */
+    mnthr_group_destroy(argv[0]);
+    return 0;
+}
+
+
+static int
+run(UNUSED int argc, UNUSED void *argv[])
+{
+    mnthr_group_t *heavy, *light;
+    mnthr_group_stats_t hs, ls;
+    mnthr_ctx_t *ctx;
+    UNUSED double ratio;
+
+    heavy = mnthr_group_new("heavy", 300);
+    light = mnthr_group_new("light", MNTHR_GROUP_WEIGHT_DEFAULT);
+    mnthr_set_fair_sched(1000);
+
+    ctx = mnthr_new("tenant", tenant, 0);
+    mnthr_set_group(ctx, heavy);
+    mnthr_run(ctx);
+    ctx = mnthr_new("tenant", tenant, 0);
+    mnthr_set_group(ctx, light);
+    mnthr_run(ctx);
+
+    (void)mnthr_sleep(500);
+    done = true;
+    (void)mnthr_sleep(100);
+
+    mnthr_group_get_stats(heavy, &hs);
+    mnthr_group_get_stats(light, &ls);
+    CTRACE("%s: %"PRIu64" usec in %"PRIu64" slices, %"PRIu64" deferred",
+           mnthr_group_name(heavy),
+           hs.cpu_nsec / 1000,
+           hs.slices,
+           hs.deferred);
+    CTRACE("%s: %"PRIu64" usec in %"PRIu64" slices, %"PRIu64" deferred",
+           mnthr_group_name(light),
+           ls.cpu_nsec / 1000,
+           ls.slices,
+           ls.deferred);
+    assert(hs.nthreads == 0 && ls.nthreads == 0);
+    assert(ls.cpu_nsec > 0);
+    ratio = (double)hs.cpu_nsec / (double)ls.cpu_nsec;
+    /* weights are 3:1, leave room for a noisy machine */
+    assert(ratio > 1.5 && ratio < 6.0);
+
+    mnthr_set_fair_sched(0);
+    mnthr_group_destroy(heavy);
+    mnthr_group_destroy(light);
+
+    /* a group destroyed by its own thread */
+    heavy = mnthr_group_new("self", MNTHR_GROUP_WEIGHT_DEFAULT);
+    ctx = mnthr_new("destroyer", destroyer, 1, heavy);
+    mnthr_set_group(ctx, heavy);
+    mnthr_run(ctx);
+    (void)mnthr_join(ctx);
+
+    mnthr_shutdown();
+    return 0;
+}
+
+
+int
+main(void)
+{
+    if (mnthr_init() != 0) {
+        perror("mnthr_init");
+        return 1;
+    }
+    (void)mnthr_spawn("run", run, 0);
+    (void)mnthr_loop();
+    (void)mnthr_fini();
+    return 0;
+}
@@ -0,0 +1,179 @@
+#include <assert.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <mncommon/util.h>
+#include <mncommon/dumpm.h>
+
+#include <mnthr.h>
+
+#define NSLEEPERS 100
+#define NSUBMITTERS 10
+
+static int nchecked = 0;
+static mnthr_batcher_t *batcher;
+
+
+static int
+deep(int depth)
+{
+    char buf[4096];
+
+    memset(buf, depth, sizeof(buf));
+    if (depth > 0) {
+        return buf[0] + deep(depth - 1);
+    }
+    return buf[sizeof(buf) - 1];
+}
+
+
+static int
+sleeper(UNUSED int argc, void *argv[])
+{
+    intptr_t i = (intptr_t)argv[0];
+    char local[256];
+
+    /* touch deep stack, then park on a shallow one */
+    (void)deep(4);
+    memset(local, (int)i, sizeof(local));
+    (void)mnthr_sleep(1000);
+    assert(local[0] == (char)i && local[sizeof(local) - 1] == (char)i);
+    ++nchecked;
+    return 0;
+}
+
+
+static void
+test(int policy)
+{
+    mnthr_ctx_t *ctxes[NSLEEPERS];
+    mnthr_metrics_counters_t c0, c1;
+    intptr_t i;
+    UNUSED int res;
+
+    res = mnthr_set_hibernation(200, policy);
+    assert(res == 0);
+    mnthr_metrics_get(&c0);
+    nchecked = 0;
+
+    for (i = 0; i < NSLEEPERS; ++i) {
+        ctxes[i] = MNTHR_SPAWN("sleeper", sleeper, (void *)i);
+    }
+    (void)mnthr_sleep(700);
+
+    mnthr_metrics_get(&c1);
+    CTRACE("policy %d hibernated %"PRIu64" released %"PRIu64
+           " heap %"PRIu64,
+           policy,
+           c1.hibernated,
+           c1.hibernate_released_bytes - c0.hibernate_released_bytes,
+           c1.hibernated_bytes);
+    assert(c1.hibernations - c0.hibernations >= NSLEEPERS);
+    assert(c1.hibernate_released_bytes > c0.hibernate_released_bytes);
+    if (policy == MNTHR_HIBERNATE_COPY) {
+        assert(c1.hibernated_bytes > 0);
+    }
+
+    for (i = 0; i < NSLEEPERS; ++i) {
+        (void)mnthr_join(ctxes[i]);
+    }
+    assert(nchecked == NSLEEPERS);
+
+    mnthr_metrics_get(&c1);
+    assert(c1.hibernated_bytes == 0);
+    res = mnthr_set_hibernation(0, MNTHR_HIBERNATE_TRIM);
+    assert(res == 0);
+}
+
+
+static int
+double_it(mnthr_batch_item_t *items[], size_t n, UNUSED void *udata)
+{
+    size_t i;
+
+    for (i = 0; i < n; ++i) {
+        items[i]->out = (void *)((uintptr_t)items[i]->in * 2);
+    }
+    return 0;
+}
+
+
+static int
+submitter(UNUSED int argc, void *argv[])
+{
+    mnthr_batch_item_t item;
+    UNUSED int res;
+
+    item.in = argv[0];
+    res = mnthr_batcher_submit(batcher, &item);
+    assert(res == 0);
+    assert((uintptr_t)item.out == (uintptr_t)argv[0] * 2);
+    ++nchecked;
+    return 0;
+}
+
+
+/*
+ * Batch items are on the stacks of their submitters, and the flusher
+ * writes into them: those stacks must not be copied away.
+ */
+static void
+test_batcher(void)
+{
+    mnthr_ctx_t *ctxes[NSUBMITTERS];
+    mnthr_metrics_counters_t c0, c1;
+    intptr_t i;
+    UNUSED int res;
+
+    res = mnthr_set_hibernation(200, MNTHR_HIBERNATE_COPY);
+    assert(res == 0);
+    batcher = mnthr_batcher_new("hibernated", 2 * NSUBMITTERS, 700000,
+                                double_it, NULL);
+    mnthr_metrics_get(&c0);
+    nchecked = 0;
+
+    for (i = 0; i < NSUBMITTERS; ++i) {
+        ctxes[i] = MNTHR_SPAWN("submitter", submitter, (void *)i);
+    }
+    for (i = 0; i < NSUBMITTERS; ++i) {
+        (void)mnthr_join(ctxes[i]);
+    }
+    mnthr_metrics_get(&c1);
+    CTRACE("submitters hibernated %"PRIu64,
+           c1.hibernations - c0.hibernations);
+    assert(c1.hibernations - c0.hibernations >= NSUBMITTERS);
+    assert(nchecked == NSUBMITTERS);
+
+    res = mnthr_batcher_destroy(batcher);
+    assert(res == 0);
+    res = mnthr_set_hibernation(0, MNTHR_HIBERNATE_TRIM);
+    assert(res == 0);
+}
+
+
+static int
+run(UNUSED int argc, UNUSED void *argv[])
+{
+    test(MNTHR_HIBERNATE_TRIM);
+    test(MNTHR_HIBERNATE_COPY);
+    test_batcher();
+
+    mnthr_shutdown();
+    return 0;
+}
+
+
+int
+main(void)
+{
+    if (mnthr_init() != 0) {
+        perror("mnthr_init");
+        return 1;
+    }
+    (void)mnthr_spawn("run", run, 0);
+    (void)mnthr_loop();
+    (void)mnthr_fini();
+    return 0;
+}
@@ -0,0 +1,107 @@
+#include <assert.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <mncommon/util.h>
+#include <mncommon/dumpm.h>
+
+#include <mnthr.h>
+
+#define NLINES 10000
+
+static int fds[2];
+static size_t nread = 0;
+static size_t nnewlines = 0;
+
+
+static int
+reader(UNUSED int argc, UNUSED void *argv[])
+{
+    char buf[4096];
+
+    while (true) {
+        ssize_t n, i;
+
+        if ((n = mnthr_read_allb(fds[0], buf, sizeof(buf))) <= 0) {
+            break;
+        }
+        for (i = 0; i < n; ++i) {
+            if (buf[i] == '\n') {
+                ++nnewlines;
+            }
+        }
+        nread += n;
+    }
+    return 0;
+}
+
+
+static int
+run(UNUSED int argc, UNUSED void *argv[])
+{
+    mnthr_metrics_counters_t c0, c1;
+    mnthr_ctx_t *ctx;
+    int i;
+    UNUSED int res;
+
+    res = pipe(fds);
+    assert(res == 0);
+    res = fcntl(fds[0], F_SETFL, O_NONBLOCK);
+    assert(res == 0);
+    res = fcntl(fds[1], F_SETFL, O_NONBLOCK);
+    assert(res == 0);
+    ctx = mnthr_spawn("reader", reader, 0);
+
+    res = mnthr_log_start(fds[1]);
+    assert(res == 0);
+    res = mnthr_log_start(fds[1]);
+    assert(res != 0);
+    mnthr_metrics_get(&c0);
+
+    /* a storm from a single call site */
+    for (i = 0; i < NLINES; ++i) {
+        CTRACE("storm %d", i);
+    }
+    /* and a quiet one */
+    CTRACE("quiet");
+    (void)mnthr_sleep(200);
+
+    mnthr_metrics_get(&c1);
+    /* the storm may straddle a second */
+    assert(c1.log_lines - c0.log_lines <= 2 * 100 + 2);
+    assert(c1.log_suppressed - c0.log_suppressed >= NLINES - 2 * 100);
+    assert(nnewlines == c1.log_lines - c0.log_lines);
+
+    res = mnthr_log_stop();
+    assert(res == 0);
+    (void)close(fds[1]);
+    (void)mnthr_join(ctx);
+    (void)close(fds[0]);
+
+    /* synchronous again */
+    CTRACE("lines %"PRIu64" suppressed %"PRIu64" read %zu",
+           c1.log_lines - c0.log_lines,
+           c1.log_suppressed - c0.log_suppressed,
+           nread);
+
+    mnthr_shutdown();
+    return 0;
+}
+
+
+int
+main(void)
+{
+    if (mnthr_init() != 0) {
+        perror("mnthr_init");
+        return 1;
+    }
+    (void)mnthr_spawn("run", run, 0);
+    (void)mnthr_loop();
+    (void)mnthr_fini();
+    return 0;
+}
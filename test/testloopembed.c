@@ -0,0 +1,126 @@
+#include <assert.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <mncommon/util.h>
+#include <mncommon/dumpm.h>
+
+#include <mnthr.h>
+
+static int fds[2];
+static bool slept = false;
+static bool got = false;
+
+
+static int
+sleeper(UNUSED int argc, UNUSED void *argv[])
+{
+    (void)mnthr_sleep(100);
+    slept = true;
+    return 0;
+}
+
+
+static int
+reader(UNUSED int argc, UNUSED void *argv[])
+{
+    char c;
+
+    if (mnthr_read_allb(fds[0], &c, 1) == 1) {
+        assert(c == 'x');
+        got = true;
+    }
+    return 0;
+}
+
+
+static int
+writer(UNUSED int argc, UNUSED void *argv[])
+{
+    UNUSED ssize_t n;
+
+    (void)mnthr_sleep(50);
+    n = write(fds[1], "x", 1);
+    assert(n == 1);
+    return 0;
+}
+
+
+/*
+ * A foreign loop made of poll(2) alone.
+ */
+static void
+foreign_loop(int pfd)
+{
+    int i;
+
+    for (i = 0; i < 1000 && !(slept && got); ++i) {
+        struct pollfd p;
+        uint64_t deadline, now;
+        int timeout;
+        UNUSED int res;
+
+        deadline = mnthr_next_deadline();
+        now = mnthr_get_now_nsec_precise();
+        if (deadline == UINT64_MAX) {
+            timeout = -1;
+        } else if (deadline <= now) {
+            timeout = 0;
+        } else {
+            /* rounded up, not to spin before it is due */
+            timeout = (int)((deadline - now + 999999) / 1000000);
+        }
+
+        p.fd = pfd;
+        p.events = POLLIN;
+        p.revents = 0;
+        res = poll(&p, 1, timeout);
+        assert(res >= 0);
+
+        res = mnthr_loop_once(0);
+        assert(res == 0);
+    }
+}
+
+
+int
+main(void)
+{
+    int pfd;
+
+    if (mnthr_init() != 0) {
+        perror("mnthr_init");
+        return 1;
+    }
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+        perror("socketpair");
+        return 1;
+    }
+
+    /* before the loop first runs */
+    if ((pfd = mnthr_get_poll_fd()) < 0) {
+        (void)mnthr_fini();
+        return 0;
+    }
+
+    (void)mnthr_spawn("sleeper", sleeper, 0);
+    (void)mnthr_spawn("reader", reader, 0);
+    (void)mnthr_spawn("writer", writer, 0);
+
+    foreign_loop(pfd);
+    assert(slept);
+    assert(got);
+
+    mnthr_shutdown();
+    while (mnthr_loop_once(0) == 0) {
+    }
+
+    (void)close(fds[0]);
+    (void)close(fds[1]);
+    (void)mnthr_fini();
+    return 0;
+}
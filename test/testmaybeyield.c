@@ -0,0 +1,104 @@
+#include <assert.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <time.h>
+
+#include <mncommon/util.h>
+#include <mncommon/dumpm.h>
+
+#include <mnthr.h>
+
+static bool done;
+static uint64_t max_lateness;
+static uint64_t nspins;
+
+
+static uint64_t
+now_nsec(void)
+{
+    struct timespec ts;
+
+    /* the loop's clock stands still while a thread runs */
+    (void)clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+static int
+spinner(UNUSED int argc, UNUSED void *argv[])
+{
+    uint64_t end;
+    volatile uint64_t x = 0;
+
+    end = now_nsec() + 300000000;
+    while (now_nsec() < end) {
+        int i;
+
+        for (i = 0; i < 1000; ++i) {
+            x += i;
+        }
+        ++nspins;
+        if (mnthr_maybe_yield() != 0) {
+            break;
+        }
+    }
+    done = true;
+    return 0;
+}
+
+
+static int
+ticker(UNUSED int argc, UNUSED void *argv[])
+{
+    while (!done) {
+        uint64_t t0, lateness;
+
+        t0 = mnthr_get_now_nsec_precise();
+        (void)mnthr_sleep(1);
+        lateness = mnthr_get_now_nsec_precise() - t0 - 1000000;
+        max_lateness = MAX(max_lateness, lateness);
+    }
+    return 0;
+}
+
+
+static int
+run(UNUSED int argc, UNUSED void *argv[])
+{
+    mnthr_ctx_t *s, *t;
+    mnthr_metrics_counters_t c;
+
+    mnthr_set_slice_budget(2000);
+    t = mnthr_spawn("ticker", ticker, 0);
+    s = mnthr_spawn("spinner", spinner, 0);
+    (void)mnthr_join(s);
+    (void)mnthr_join(t);
+
+    mnthr_metrics_get(&c);
+    CTRACE("spins %"PRIu64" slice yields %"PRIu64" max lateness %"PRIu64
+           " usec",
+           nspins,
+           c.slice_yields,
+           max_lateness / 1000);
+    assert(c.slice_yields > 0);
+    /* a 2 msec budget, leave plenty of room for a busy machine */
+    assert(max_lateness < 50000000);
+
+    mnthr_shutdown();
+    return 0;
+}
+
+
+int
+main(void)
+{
+    if (mnthr_init() != 0) {
+        perror("mnthr_init");
+        return 1;
+    }
+    (void)mnthr_spawn("run", run, 0);
+    (void)mnthr_loop();
+    (void)mnthr_fini();
+    return 0;
+}
@@ -0,0 +1,115 @@
+#include <assert.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <mncommon/util.h>
+#include <mncommon/dumpm.h>
+
+#include <mnthr.h>
+#include <mnthr_metrics.h>
+
+#define REGION "testmetrics.region"
+
+static const mnthr_metrics_t *m;
+
+
+static int
+worker(UNUSED int argc, UNUSED void *argv[])
+{
+    (void)mnthr_sleep(10);
+    return 0;
+}
+
+
+static int
+reader(UNUSED int argc, UNUSED void *argv[])
+{
+    int i;
+    UNUSED int res;
+    mnthr_metrics_counters_t c;
+
+    for (i = 0; i < 10; ++i) {
+        (void)mnthr_spawn("worker", worker, 0);
+    }
+
+    (void)mnthr_sleep(100);
+
+    res = mnthr_metrics_read(m, &c);
+    assert(res == 0);
+    CTRACE("spawns %ld exits %ld switches %ld wakeups %ld events %ld",
+           (long)c.spawns,
+           (long)c.exits,
+           (long)c.switches,
+           (long)c.poller_wakeups,
+           (long)c.poller_events);
+    assert(c.spawns >= 11);
+    assert(c.exits >= 10);
+    assert(c.switches >= c.exits);
+    assert(c.poller_wakeups > 0);
+    assert(c.poller_iterations >= c.poller_wakeups);
+    assert(c.poller_events_max > 0);
+
+    mnthr_metrics_get(&c);
+    CTRACE("iterations %ld empty %ld reg +%ld -%ld ioctls %ld timer %ld",
+           (long)c.poller_iterations,
+           (long)c.poller_empty_wakeups,
+           (long)c.poller_reg_add,
+           (long)c.poller_reg_del,
+           (long)c.poller_ioctls,
+           (long)c.poller_timer_updates);
+    assert(c.poller_timer_updates > 0);
+
+    return 0;
+}
+
+
+static void
+test0(void)
+{
+    int fd;
+    UNUSED int res;
+
+    if (mnthr_init() != 0) {
+        perror("mnthr_init");
+        return;
+    }
+
+    fd = mnthr_metrics_open(REGION);
+    assert(fd >= 0);
+    /* already open */
+    res = mnthr_metrics_open(REGION);
+    assert(res < 0);
+
+    if ((m = mmap(NULL,
+                  sizeof(mnthr_metrics_t),
+                  PROT_READ,
+                  MAP_SHARED,
+                  fd,
+                  0)) == MAP_FAILED) {
+        perror("mmap");
+        return;
+    }
+
+    (void)mnthr_spawn("reader", reader, 0);
+    mnthr_loop();
+
+    (void)munmap((void *)m, sizeof(mnthr_metrics_t));
+
+    if (mnthr_fini() != 0) {
+        perror("mnthr_fini");
+        return;
+    }
+    /* removed on close */
+    assert(access(REGION, F_OK) != 0);
+}
+
+
+int
+main(UNUSED int argc, UNUSED char *argv[])
+{
+    test0();
+    return 0;
+}
@@ -0,0 +1,110 @@
+#include <assert.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <mncommon/util.h>
+#include <mncommon/dumpm.h>
+
+#include <mnthr.h>
+
+#define NCONNS 10
+
+
+static int
+conn(UNUSED int argc, UNUSED void *argv[])
+{
+    (void)mnthr_sleep(10);
+    (void)mnthr_yield();
+    return 0;
+}
+
+
+static int
+dump_stats(const char *name, const mnthr_name_stats_t *ns, UNUSED void *udata)
+{
+    CTRACE("%-16s spawns %"PRIu64" exits %"PRIu64" switches %"PRIu64
+           " io %"PRIu64" sleeps %"PRIu64" sync %"PRIu64
+           " run %"PRIu64"ns stack %"PRIu64,
+           *name != '\0' ? name : "-",
+           ns->spawns,
+           ns->exits,
+           ns->switches,
+           ns->io_waits,
+           ns->sleeps,
+           ns->sync_waits,
+           ns->run_nsec,
+           ns->stack_hwm);
+    return 0;
+}
+
+
+static int
+find_stats(const char *name, const mnthr_name_stats_t *ns, void *udata)
+{
+    if (strcmp(name, "upstream_conn") == 0) {
+        *(const mnthr_name_stats_t **)udata = ns;
+        return 1;
+    }
+    return 0;
+}
+
+
+static int
+run(UNUSED int argc, UNUSED void *argv[])
+{
+    mnthr_ctx_t *ctxes[NCONNS];
+    const mnthr_name_stats_t *ns = NULL;
+    int i;
+    UNUSED int nid, res;
+
+    mnthr_set_name_stats(true);
+
+    /* longer than the old eight bytes, and not colliding */
+    nid = mnthr_name_intern("upstream_conn");
+    assert(nid != 0);
+    res = mnthr_name_intern("upstream_conn");
+    assert(res == nid);
+    res = mnthr_name_intern("upstream_connx");
+    assert(res != nid);
+    assert(strcmp(mnthr_name_str(nid), "upstream_conn") == 0);
+    res = mnthr_name_intern("");
+    assert(res == 0);
+
+    for (i = 0; i < NCONNS; ++i) {
+        ctxes[i] = mnthr_spawn("upstream_conn", conn, 0);
+        assert(strcmp(mnthr_get_name(ctxes[i]), "upstream_conn") == 0);
+    }
+    res = mnthr_set_name(ctxes[0], "upstream_%s", "conn");
+    assert(res == 0);
+    for (i = 0; i < NCONNS; ++i) {
+        (void)mnthr_join(ctxes[i]);
+    }
+
+    (void)mnthr_name_stats_traverse(dump_stats, NULL);
+    res = mnthr_name_stats_traverse(find_stats, &ns);
+    assert(res == 1);
+    assert(ns->spawns == NCONNS);
+    assert(ns->exits == NCONNS);
+    assert(ns->sleeps >= NCONNS);
+    assert(ns->switches >= 3 * NCONNS);
+    assert(ns->stack_hwm > 0);
+
+    mnthr_shutdown();
+    return 0;
+}
+
+
+int
+main(void)
+{
+    if (mnthr_init() != 0) {
+        perror("mnthr_init");
+        return 1;
+    }
+    (void)mnthr_spawn("run", run, 0);
+    (void)mnthr_loop();
+    (void)mnthr_fini();
+    return 0;
+}
@@ -0,0 +1,74 @@
+#include <assert.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <mncommon/util.h>
+#include <mncommon/dumpm.h>
+
+#include <mnthr.h>
+
+#define NTHREADS 1000
+
+static int nrun = 0;
+
+
+static int
+worker(UNUSED int argc, void *argv[])
+{
+    intptr_t i = (intptr_t)argv[0];
+    char buf[1024];
+
+    memset(buf, (int)i, sizeof(buf));
+    (void)mnthr_sleep(10);
+    assert(buf[sizeof(buf) - 1] == (char)i);
+    ++nrun;
+    return 0;
+}
+
+
+static int
+run(UNUSED int argc, UNUSED void *argv[])
+{
+    mnthr_ctx_t *ctxes[NTHREADS];
+    mnthr_metrics_counters_t c;
+    intptr_t i;
+
+    for (i = 0; i < NTHREADS; ++i) {
+        ctxes[i] = MNTHR_SPAWN("worker", worker, (void *)i);
+        /* cache line aligned slots */
+        assert(((uintptr_t)ctxes[i] & 63) == 0);
+    }
+    for (i = 0; i < NTHREADS; ++i) {
+        (void)mnthr_join(ctxes[i]);
+    }
+    assert(nrun == NTHREADS);
+
+    mnthr_metrics_get(&c);
+    CTRACE("ctx slab bytes %"PRIu64, c.ctx_slab_bytes);
+    assert(c.ctx_slab_bytes > 0);
+
+    /* slots go back to the slabs */
+    (void)mnthr_gc();
+
+    mnthr_shutdown();
+    return 0;
+}
+
+
+int
+main(void)
+{
+    mnthr_set_placement(MNTHR_PLACE_HUGE_CTXES |
+                        MNTHR_PLACE_HUGE_STACKS |
+                        MNTHR_PLACE_NUMA_LOCAL);
+    if (mnthr_init() != 0) {
+        perror("mnthr_init");
+        return 1;
+    }
+    (void)mnthr_spawn("run", run, 0);
+    (void)mnthr_loop();
+    (void)mnthr_fini();
+    return 0;
+}
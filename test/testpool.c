@@ -0,0 +1,129 @@
+#include <assert.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#include <mncommon/util.h>
+#include <mncommon/dumpm.h>
+
+#include <mnthr.h>
+
+#define NJOBS 100
+
+typedef struct _myjob {
+    mnthr_job_t job;
+    int n;
+} myjob_t;
+
+static myjob_t jobs[NJOBS];
+static int total;
+
+
+static int
+work(mnthr_job_t *job)
+{
+    myjob_t *j = (myjob_t *)job;
+
+    (void)mnthr_sleep((uintptr_t)job->udata);
+    total += j->n;
+    return j->n;
+}
+
+
+static void
+dump_stats(mnthr_pool_t *pool)
+{
+    mnthr_pool_stats_t st;
+
+    mnthr_pool_get_stats(pool, &st);
+    CTRACE("submitted %"PRIu64" completed %"PRIu64" depth max %"PRIu64
+           " workers %"PRIu64" (spawned %"PRIu64" retired %"PRIu64")"
+           " wait avg %"PRIu64" max %"PRIu64
+           " latency avg %"PRIu64" max %"PRIu64" usec",
+           st.submitted,
+           st.completed,
+           st.queue_depth_max,
+           st.nworkers,
+           st.spawned,
+           st.retired,
+           st.completed ? st.wait_nsec / st.completed / 1000 : 0,
+           st.wait_nsec_max / 1000,
+           st.completed ? st.latency_nsec / st.completed / 1000 : 0,
+           st.latency_nsec_max / 1000);
+}
+
+
+static int
+run(UNUSED int argc, UNUSED void *argv[])
+{
+    mnthr_pool_t *pool;
+    mnthr_job_t *batch[NJOBS];
+    mnthr_pool_stats_t st;
+    int i;
+    UNUSED int res;
+
+    /* fixed size, futures */
+    pool = mnthr_pool_new("fixed", 4, 4, 0);
+    for (i = 0; i < NJOBS; ++i) {
+        mnthr_job_init(&jobs[i].job, work, (void *)(uintptr_t)1);
+        jobs[i].n = i;
+        batch[i] = &jobs[i].job;
+    }
+    res = mnthr_pool_submit_batch(pool, batch, NJOBS);
+    assert(res == 0);
+    for (i = 0; i < NJOBS; ++i) {
+        res = mnthr_job_wait(&jobs[i].job);
+        assert(res == i);
+        mnthr_job_fini(&jobs[i].job);
+    }
+    assert(total == NJOBS * (NJOBS - 1) / 2);
+    dump_stats(pool);
+    mnthr_pool_get_stats(pool, &st);
+    assert(st.completed == NJOBS);
+    assert(st.queue_depth_max >= NJOBS - 4);
+    assert(st.spawned == 4 && st.nworkers == 4);
+    res = mnthr_pool_destroy(pool);
+    assert(res == 0);
+
+    /* scaling */
+    pool = mnthr_pool_new("scaling", 1, 8, 1000);
+    for (i = 0; i < NJOBS; ++i) {
+        mnthr_job_init(&jobs[i].job, work, (void *)(uintptr_t)10);
+        jobs[i].n = i;
+        res = mnthr_pool_submit(pool, &jobs[i].job);
+        assert(res == 0);
+    }
+    for (i = 0; i < NJOBS; ++i) {
+        res = mnthr_job_wait(&jobs[i].job);
+        assert(res == i);
+        mnthr_job_fini(&jobs[i].job);
+    }
+    dump_stats(pool);
+    mnthr_pool_get_stats(pool, &st);
+    assert(st.spawned > 1 && st.spawned <= 8 + st.retired);
+
+    /* back to nmin once idle */
+    (void)mnthr_sleep(1500);
+    dump_stats(pool);
+    mnthr_pool_get_stats(pool, &st);
+    assert(st.nworkers == 1);
+    res = mnthr_pool_destroy(pool);
+    assert(res == 0);
+
+    mnthr_shutdown();
+    return 0;
+}
+
+
+int
+main(void)
+{
+    if (mnthr_init() != 0) {
+        perror("mnthr_init");
+        return 1;
+    }
+    (void)mnthr_spawn("run", run, 0);
+    (void)mnthr_loop();
+    (void)mnthr_fini();
+    return 0;
+}
@@ -0,0 +1,125 @@
+#include <assert.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <time.h>
+
+#include <mncommon/util.h>
+#include <mncommon/dumpm.h>
+
+#include <mnthr.h>
+
+static bool done;
+static uint64_t max_lateness;
+
+
+static uint64_t
+now_nsec(void)
+{
+    struct timespec ts;
+
+    /* the loop's clock stands still while a thread runs */
+    (void)clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+static void
+spin(uint64_t msec, bool cooperative)
+{
+    uint64_t end;
+    volatile uint64_t x = 0;
+
+    end = now_nsec() + msec * 1000000;
+    while (now_nsec() < end) {
+        int i;
+
+        for (i = 0; i < 1000; ++i) {
+            x += i;
+        }
+        if (cooperative) {
+            /* only the runaway mark can make it yield */
+            (void)mnthr_maybe_yield();
+        }
+    }
+}
+
+
+static int
+spinner(UNUSED int argc, UNUSED void *argv[])
+{
+    spin(300, true);
+    done = true;
+    return 0;
+}
+
+
+static int
+ticker(UNUSED int argc, UNUSED void *argv[])
+{
+    while (!done) {
+        uint64_t t0, lateness;
+
+        t0 = mnthr_get_now_nsec_precise();
+        (void)mnthr_sleep(1);
+        lateness = mnthr_get_now_nsec_precise() - t0 - 1000000;
+        max_lateness = MAX(max_lateness, lateness);
+    }
+    return 0;
+}
+
+
+static int
+run(UNUSED int argc, UNUSED void *argv[])
+{
+    mnthr_ctx_t *s, *t;
+    mnthr_metrics_counters_t c;
+    UNUSED int res;
+
+    mnthr_set_slice_budget(0);
+    res = mnthr_preempt_start(5000, MNTHR_PREEMPT_YIELD);
+    assert(res == 0);
+    /* already started */
+    res = mnthr_preempt_start(5000, MNTHR_PREEMPT_YIELD);
+    assert(res != 0);
+
+    t = mnthr_spawn("ticker", ticker, 0);
+    s = mnthr_spawn("spinner", spinner, 0);
+    (void)mnthr_join(s);
+    (void)mnthr_join(t);
+
+    mnthr_metrics_get(&c);
+    CTRACE("preemptions %"PRIu64" max lateness %"PRIu64" usec",
+           c.preemptions,
+           max_lateness / 1000);
+    assert(c.preemptions > 0);
+    assert(max_lateness < 100000000);
+
+    /* the runaway gets interrupted at its next CPOINT */
+    res = mnthr_preempt_stop();
+    assert(res == 0);
+    res = mnthr_preempt_start(5000, MNTHR_PREEMPT_INTERRUPT);
+    assert(res == 0);
+    spin(100, false);
+    res = mnthr_sleep(1);
+    assert(res == (int)MNTHR_CO_RC_PREEMPTED);
+    res = mnthr_preempt_stop();
+    assert(res == 0);
+
+    mnthr_shutdown();
+    return 0;
+}
+
+
+int
+main(void)
+{
+    if (mnthr_init() != 0) {
+        perror("mnthr_init");
+        return 1;
+    }
+    (void)mnthr_spawn("run", run, 0);
+    (void)mnthr_loop();
+    (void)mnthr_fini();
+    return 0;
+}
@@ -0,0 +1,91 @@
+#include <assert.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#include <mncommon/util.h>
+#include <mncommon/dumpm.h>
+
+#include <mnthr.h>
+
+static int nstarted;
+static int ncancelled;
+
+
+/* argv[0] is an array of delays in msec, argv[1] the attempt */
+static int
+request(UNUSED int argc, void *argv[])
+{
+    uint64_t *delays = argv[0];
+    intptr_t i = (intptr_t)argv[1];
+    int res;
+
+    ++nstarted;
+    if ((res = mnthr_sleep(delays[i])) != 0) {
+        ++ncancelled;
+        return res;
+    }
+    return 0;
+}
+
+
+static int
+failing(UNUSED int argc, UNUSED void *argv[])
+{
+    ++nstarted;
+    return 123;
+}
+
+
+static int
+run(UNUSED int argc, UNUSED void *argv[])
+{
+    mnthr_cofunc_t fns[3] = { request, request, request };
+    mnthr_cofunc_t ffns[3] = { failing, failing, failing };
+    uint64_t delays[3] = { 50, 5, 5 };
+    uint64_t slow[3] = { 1000, 1000, 1000 };
+    uint64_t t0, elapsed;
+    int winner;
+    UNUSED int res;
+
+    /* the hedge wins, the rest are cancelled */
+    t0 = mnthr_get_now_nsec_precise();
+    res = mnthr_race(fns, delays, 3, 10000, 0, &winner);
+    assert(res == 0);
+    elapsed = mnthr_get_now_nsec_precise() - t0;
+    CTRACE("winner %d started %d cancelled %d in %"PRIu64" usec",
+           winner, nstarted, ncancelled, elapsed / 1000);
+    assert(winner == 1);
+    assert(nstarted == 2 && ncancelled == 1);
+    assert(elapsed < 50000000);
+
+    /* failures do not wait for the hedge delay */
+    nstarted = 0;
+    res = mnthr_race(ffns, NULL, 3, 1000000, 0, &winner);
+    assert(res == 123);
+    assert(nstarted == 3);
+
+    /* nobody answers in time */
+    nstarted = 0;
+    ncancelled = 0;
+    res = mnthr_race(fns, slow, 3, 0, 20000, &winner);
+    assert(res == (int)MNTHR_WAIT_TIMEOUT);
+    assert(nstarted == 3 && ncancelled == 3);
+
+    mnthr_shutdown();
+    return 0;
+}
+
+
+int
+main(void)
+{
+    if (mnthr_init() != 0) {
+        perror("mnthr_init");
+        return 1;
+    }
+    (void)mnthr_spawn("run", run, 0);
+    (void)mnthr_loop();
+    (void)mnthr_fini();
+    return 0;
+}
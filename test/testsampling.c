@@ -0,0 +1,94 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#include <mncommon/util.h>
+#include <mncommon/dumpm.h>
+
+#include <mnthr.h>
+
+#define FOLDED "testsampling.folded"
+
+static volatile uint64_t sink;
+
+
+static void
+burn(unsigned n)
+{
+    unsigned i;
+
+    for (i = 0; i < n; ++i) {
+        sink += i * i;
+    }
+}
+
+
+static int
+spinner(UNUSED int argc, void *argv[])
+{
+    int i;
+    unsigned n;
+
+    n = (unsigned)(uintptr_t)argv[0];
+
+    for (i = 0; i < 200; ++i) {
+        burn(n);
+        (void)mnthr_yield();
+    }
+    return 0;
+}
+
+
+static int
+monitor(UNUSED int argc, UNUSED void *argv[])
+{
+    mnthr_ctx_t *a, *b;
+
+    a = mnthr_spawn("light", spinner, 1, (void *)(uintptr_t)100000);
+    b = mnthr_spawn("heavy", spinner, 1, (void *)(uintptr_t)400000);
+
+    (void)mnthr_join(a);
+    (void)mnthr_join(b);
+    return 0;
+}
+
+
+static void
+test0(void)
+{
+    int res;
+
+    if (mnthr_init() != 0) {
+        perror("mnthr_init");
+        return;
+    }
+
+    res = mnthr_profiler_start(1000, 100000);
+    assert(res == 0);
+    /* already started */
+    res = mnthr_profiler_start(1000, 100000);
+    assert(res != 0);
+
+    (void)mnthr_spawn("monitor", monitor, 0);
+    mnthr_loop();
+
+    res = mnthr_profiler_stop();
+    assert(res == 0);
+
+    res = mnthr_profiler_write_folded(FOLDED);
+    CTRACE("samples: %d", res);
+    assert(res >= 0);
+
+    if (mnthr_fini() != 0) {
+        perror("mnthr_fini");
+        return;
+    }
+}
+
+
+int
+main(UNUSED int argc, UNUSED char *argv[])
+{
+    test0();
+    return 0;
+}
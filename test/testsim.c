@@ -0,0 +1,169 @@
+#include <assert.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <mncommon/util.h>
+#include <mncommon/dumpm.h>
+
+#include <mnthr.h>
+
+#define HOUR (3600ul * 1000)
+
+static int fds[2];
+static char order[64];
+static size_t norder;
+
+
+static uint64_t
+real_nsec(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0) {
+        FAIL("clock_gettime");
+    }
+    return ts.tv_nsec + ts.tv_sec * 1000000000;
+}
+
+
+static int
+sleeper(UNUSED int argc, void *argv[])
+{
+    char c;
+
+    c = (char)(intptr_t)argv[0];
+    (void)mnthr_sleep(HOUR);
+    order[norder++] = c;
+    (void)mnthr_yield();
+    order[norder++] = c;
+    return 0;
+}
+
+
+static int
+writer(UNUSED int argc, UNUSED void *argv[])
+{
+    UNUSED int res;
+
+    (void)mnthr_sleep(HOUR);
+    res = mnthr_write_all(fds[1], "x", 1);
+    assert(res == 0);
+    return 0;
+}
+
+
+static int
+reader(UNUSED int argc, UNUSED void *argv[])
+{
+    char c;
+    UNUSED ssize_t n;
+
+    /* nothing to read for an hour */
+    n = mnthr_read_allb(fds[0], &c, 1);
+    assert(n == 1);
+    assert(c == 'x');
+    return 0;
+}
+
+
+static int
+idle_reader(UNUSED int argc, UNUSED void *argv[])
+{
+    char c;
+
+    (void)mnthr_read_allb(fds[0], &c, 1);
+    return 0;
+}
+
+
+static int
+run(UNUSED int argc, UNUSED void *argv[])
+{
+    uint64_t t0;
+    mnthr_ctx_t *r;
+    int i;
+    UNUSED int res;
+
+    t0 = mnthr_get_now_nsec();
+    (void)mnthr_sleep(10 * HOUR);
+    CTRACE("virtual %"PRIu64" msec",
+           (mnthr_get_now_nsec() - t0) / 1000000);
+    assert(mnthr_get_now_nsec() - t0 >= 10 * HOUR * 1000000);
+    assert(mnthr_get_now_nsec() - t0 < (10 * HOUR + 1) * 1000000);
+
+    res = mnthr_sim_socketpair(fds);
+    assert(res == 0);
+    t0 = mnthr_get_now_nsec();
+    r = mnthr_spawn("reader", reader, 0);
+    (void)mnthr_spawn("writer", writer, 0);
+    res = mnthr_join(r);
+    assert(res == 0);
+    assert(mnthr_get_now_nsec() - t0 >= HOUR * 1000000);
+
+    /* timeouts fire on the virtual clock */
+    t0 = mnthr_get_now_nsec();
+    res = MNTHR_WAIT_FOR(2 * HOUR, "idle_reader", idle_reader);
+    assert(res == (int)MNTHR_WAIT_TIMEOUT);
+    assert(mnthr_get_now_nsec() - t0 >= 2 * HOUR * 1000000);
+    close(fds[0]);
+    close(fds[1]);
+
+    for (i = 0; i < 8; ++i) {
+        (void)mnthr_spawn("sleeper", sleeper, 1, (void *)(intptr_t)('a' + i));
+    }
+    (void)mnthr_sleep(2 * HOUR);
+
+    mnthr_shutdown();
+    return 0;
+}
+
+
+static void
+test0(uint64_t seed, char *res)
+{
+    uint64_t t0;
+
+    norder = 0;
+    memset(order, '\0', sizeof(order));
+    if (mnthr_sim_init(seed) != 0) {
+        perror("mnthr_sim_init");
+        return;
+    }
+    assert(mnthr_sim_enabled());
+    if (mnthr_init() != 0) {
+        perror("mnthr_init");
+        return;
+    }
+    t0 = real_nsec();
+    (void)mnthr_spawn("run", run, 0);
+    (void)mnthr_loop();
+    (void)mnthr_fini();
+    /* back to the real clock */
+    assert(!mnthr_sim_enabled());
+    CTRACE("seed %"PRIu64": %s in %"PRIu64" msec of real time",
+           seed,
+           order,
+           (real_nsec() - t0) / 1000000);
+    assert(norder == 16);
+    assert(real_nsec() - t0 < 10ul * 1000000000);
+    memcpy(res, order, sizeof(order));
+}
+
+
+int
+main(void)
+{
+    char a[64], b[64];
+
+    test0(0, a);
+    assert(strcmp(a, "abcdefghabcdefgh") == 0);
+    test0(12345, a);
+    test0(12345, b);
+    /* the same seed replays the same order */
+    assert(strcmp(a, b) == 0);
+    return 0;
+}
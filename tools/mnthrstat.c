@@ -0,0 +1,144 @@
+/*
+ * Print counters of a running mnthr process.
+ *
+ *  mnthrstat [-i INTERVAL] [-n COUNT] PATH
+ *
+ * PATH is the metrics region given to mnthr_metrics_open() (or the
+ * MNTHR_METRICS environment variable), or /proc/PID/fd/FD for an
+ * anonymous region.  Reading the region does not involve the observed
+ * process in any way.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "mnthr_metrics.h"
+
+static const char *names[] = {
+#define MNTHR_METRICS_NAME(n) #n,
+    MNTHR_METRICS_COUNTERS(MNTHR_METRICS_NAME)
+#undef MNTHR_METRICS_NAME
+};
+
+
+static void
+usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-i INTERVAL] [-n COUNT] PATH\n", prog);
+}
+
+
+static void
+dump(const mnthr_metrics_t *m, const mnthr_metrics_counters_t *c)
+{
+    const uint64_t *v;
+    size_t i;
+
+    v = (const uint64_t *)c;
+
+    printf("pid %" PRIu64 " updated %" PRIu64 "\n", m->pid, m->updated);
+    for (i = 0; i < MNTHR_METRICS_NCOUNTERS; ++i) {
+        printf("%s %" PRIu64 "\n", names[i], v[i]);
+    }
+    if (c->poller_wakeups != 0) {
+        printf("events_per_wakeup %.2f\n",
+               (double)c->poller_events / (double)c->poller_wakeups);
+        printf("empty_wakeups_ratio %.2f\n",
+               (double)c->poller_empty_wakeups / (double)c->poller_wakeups);
+    }
+    if (c->poller_iterations != 0) {
+        double n = (double)c->poller_iterations;
+
+        printf("reg_add_per_iteration %.2f\n", c->poller_reg_add / n);
+        printf("reg_del_per_iteration %.2f\n", c->poller_reg_del / n);
+        printf("ioctls_per_iteration %.2f\n", c->poller_ioctls / n);
+        printf("timer_updates_per_iteration %.2f\n",
+               c->poller_timer_updates / n);
+    }
+    printf("\n");
+    fflush(stdout);
+}
+
+
+int
+main(int argc, char *argv[])
+{
+    int ch;
+    unsigned interval, count;
+    const char *path;
+    const mnthr_metrics_t *m;
+    struct stat sb;
+    int fd;
+
+    interval = 0;
+    count = 1;
+    while ((ch = getopt(argc, argv, "i:n:")) != -1) {
+        switch (ch) {
+        case 'i':
+            interval = strtoul(optarg, NULL, 10);
+            if (count == 1) {
+                count = 0;
+            }
+            break;
+
+        case 'n':
+            count = strtoul(optarg, NULL, 10);
+            break;
+
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (optind != argc - 1) {
+        usage(argv[0]);
+        return 1;
+    }
+    path = argv[optind];
+
+    if ((fd = open(path, O_RDONLY)) == -1) {
+        perror(path);
+        return 1;
+    }
+    if (fstat(fd, &sb) != 0 || (size_t)sb.st_size < sizeof(mnthr_metrics_t)) {
+        fprintf(stderr, "%s: not a metrics region\n", path);
+        return 1;
+    }
+    if ((m = mmap(NULL,
+                  sizeof(mnthr_metrics_t),
+                  PROT_READ,
+                  MAP_SHARED,
+                  fd,
+                  0)) == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+    (void)close(fd);
+
+    while (1) {
+        mnthr_metrics_counters_t c;
+
+        if (mnthr_metrics_read(m, &c) != 0) {
+            fprintf(stderr,
+                    "%s: incompatible metrics region (version %u)\n",
+                    path,
+                    m->version);
+            return 1;
+        }
+        dump(m, &c);
+
+        if (count != 0 && --count == 0) {
+            break;
+        }
+        sleep(interval != 0 ? interval : 1);
+    }
+
+    return 0;
+}